@@ -0,0 +1,203 @@
+/*
+	Benchmark main.cpp
+	Timing comparison of the scalar and batched ejectile energy loss through a layered target. A batch of alphas with random
+	energies, angles, and reaction depths is sent through a carbon backed 10B target (reaction in the 10B layer) using
+	both paths, and the time per particle and the largest difference between the two paths is reported.
+
+	Then times the generic ChainSystem against the hand-written TwoStepSystem and ThreeStepSystem on the example chain of
+	kinematics.yaml (10B(3He,4He)9B->4He+5Li->4He+p), with the same target and seed, one event at a time and in batches.
+
+	Run from the repository top level (so that etc/mass.txt can be found) as
+	./bin/Benchmark [number of particles] [batch size] [number of chain events]
+*/
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <algorithm>
+#include "Mask/Stopwatch.h"
+#include "Mask/LayeredTarget.h"
+#include "Mask/BeamEnergyLossMap.h"
+#include "Mask/EventBatch.h"
+#include "Mask/RandomGenerator.h"
+#include "Mask/TwoStepSystem.h"
+#include "Mask/ThreeStepSystem.h"
+#include "Mask/ChainSystem.h"
+
+//The ReactionChain of kinematics.yaml
+static std::vector<Mask::StepParameters> CreateExampleChain()
+{
+	std::vector<Mask::StepParameters> chain(3);
+	chain[0].rxnType = Mask::RxnType::Reaction;
+	chain[0].Z = {5, 2, 2};
+	chain[0].A = {10, 3, 4};
+	chain[0].meanBeamEnergy = 24.0;
+	chain[0].sigmaBeamEnergy = 0.0;
+	chain[0].thetaType = Mask::RxnThetaType::Lab;
+	chain[0].thetaMin = 15.0;
+	chain[0].thetaMax = 15.0;
+	chain[0].phiMin = 0.0;
+	chain[0].phiMax = 0.0;
+	chain[0].meanResidualEx = 16.798;
+	chain[0].sigmaResidualEx = 0.033;
+
+	chain[1].rxnType = Mask::RxnType::Decay;
+	chain[1].Z = {5, 2};
+	chain[1].A = {9, 4};
+	chain[1].phiMin = 0.0;
+	chain[1].phiMax = 360.0;
+	chain[1].meanResidualEx = 0.0;
+	chain[1].sigmaResidualEx = 0.522;
+	chain[1].angularDistFile = "./etc/isotropic_dist.txt";
+
+	chain[2].rxnType = Mask::RxnType::Decay;
+	chain[2].Z = {3, 2};
+	chain[2].A = {5, 4};
+	chain[2].phiMin = 0.0;
+	chain[2].phiMax = 360.0;
+	chain[2].meanResidualEx = 0.0;
+	chain[2].sigmaResidualEx = 0.0;
+	chain[2].angularDistFile = "./etc/isotropic_dist.txt";
+	return chain;
+}
+
+struct ChainTimes
+{
+	double eventTime = 0.0; //nanoseconds per event
+	double batchTime = 0.0;
+};
+
+static ChainTimes TimeSystem(Mask::ReactionSystem& system, const Mask::LayeredTarget& target, const Mask::BeamEnergyLossMap& map,
+							 std::size_t nEvents, std::size_t batchSize)
+{
+	ChainTimes times;
+	system.SetLayeredTarget(target, &map);
+	Mask::Stopwatch sw;
+	sw.Start();
+	for(uint64_t i=0; i<nEvents; i++)
+		system.RunEvent(i);
+	sw.Stop();
+	times.eventTime = sw.GetElapsedMilliseconds()*1.0e6/nEvents;
+
+	Mask::EventBatch batch;
+	sw.Start();
+	for(uint64_t i=0; i<nEvents; i += batchSize)
+		system.RunBatch(batch, i, std::min<uint64_t>(batchSize, nEvents - i));
+	sw.Stop();
+	times.batchTime = sw.GetElapsedMilliseconds()*1.0e6/nEvents;
+	return times;
+}
+
+//Hand-written system against the ChainSystem of the same chain; both start from the same seed and run the same event indices
+template<typename HandWritten, std::size_t N>
+static void CompareChain(const std::vector<Mask::StepParameters>& chain, Mask::LayeredTarget& target, std::size_t nEvents,
+						 std::size_t batchSize)
+{
+	HandWritten handWritten(chain);
+	Mask::ChainSystem<N, true> generic(chain);
+	if(!handWritten.IsValid() || !generic.IsValid())
+	{
+		std::cerr << "Could not build the " << N << " step chain for the benchmark" << std::endl;
+		return;
+	}
+
+	for(auto& nucleus : *(handWritten.GetNuclei()))
+		target.BuildEnergyLossTables(Mask::SpeciesLookup::GetInstance().FindSpecies(nucleus.Z, nucleus.A));
+	Mask::BeamEnergyLossMap map;
+	handWritten.BuildBeamEnergyLossMap(target, map);
+
+	ChainTimes handWrittenTimes = TimeSystem(handWritten, target, map, nEvents, batchSize);
+	ChainTimes genericTimes = TimeSystem(generic, target, map, nEvents, batchSize);
+
+	std::cout << "Chain: " << generic.GetSystemEquation() << std::endl;
+	std::cout << "Hand-written time per event(nanoseconds): " << handWrittenTimes.eventTime << " batched: " << handWrittenTimes.batchTime << std::endl;
+	std::cout << "ChainSystem time per event(nanoseconds): " << genericTimes.eventTime << " batched: " << genericTimes.batchTime << std::endl;
+	std::cout << "ChainSystem/hand-written: " << genericTimes.eventTime/handWrittenTimes.eventTime << " batched: "
+			  << genericTimes.batchTime/handWrittenTimes.batchTime << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+	std::size_t nParticles = 1000000;
+	std::size_t batchSize = 1024;
+	std::size_t nChainEvents = 100000;
+	if(argc > 1)
+		nParticles = std::stoul(argv[1]);
+	if(argc > 2)
+		batchSize = std::stoul(argv[2]);
+	if(argc > 3)
+		nChainEvents = std::stoul(argv[3]);
+
+	static constexpr int zp = 2;
+	static constexpr int ap = 4;
+	static constexpr std::size_t rxnLayer = 1;
+
+	Mask::LayeredTarget target;
+	target.SetEnergyLossMode(Mask::EnergyLossMode::Tabulated);
+	target.AddLayer({6}, {12}, {1}, 20.0);
+	target.AddLayer({5}, {10}, {1}, 74.0);
+	target.AddLayer({6}, {12}, {1}, 20.0);
+
+	Mask::Stopwatch sw;
+	sw.Start();
+	const Mask::Species& alpha = Mask::SpeciesLookup::GetInstance().FindSpecies(zp, ap);
+	target.BuildEnergyLossTables(alpha);
+	sw.Stop();
+	std::cout << "Table build time(milliseconds): " << sw.GetElapsedMilliseconds() << std::endl;
+
+	std::mt19937_64 generator(12345);
+	std::uniform_real_distribution<double> energyDist(0.5, 20.0);
+	std::uniform_real_distribution<double> angleDist(0.0, M_PI);
+	std::uniform_real_distribution<double> depthDist(0.0, 1.0);
+	std::vector<double> energies(nParticles), angles(nParticles), depths(nParticles);
+	for(std::size_t i=0; i<nParticles; i++)
+	{
+		energies[i] = energyDist(generator);
+		angles[i] = angleDist(generator);
+		depths[i] = depthDist(generator);
+	}
+
+	std::vector<double> scalarLoss(nParticles), batchLoss(nParticles);
+	sw.Start();
+	for(std::size_t i=0; i<nParticles; i++)
+		scalarLoss[i] = target.GetEjectileEnergyLoss(alpha, energies[i], rxnLayer, angles[i], depths[i]);
+	sw.Stop();
+	double scalarTime = sw.GetElapsedMilliseconds();
+
+	sw.Start();
+	for(std::size_t i=0; i<nParticles; i += batchSize)
+	{
+		std::size_t n = std::min(batchSize, nParticles - i);
+		target.GetEjectileEnergyLoss(alpha, &energies[i], &angles[i], &depths[i], rxnLayer, &batchLoss[i], n);
+	}
+	sw.Stop();
+	double batchTime = sw.GetElapsedMilliseconds();
+
+	double maxDifference = 0.0;
+	for(std::size_t i=0; i<nParticles; i++)
+		maxDifference = std::max(maxDifference, std::fabs(scalarLoss[i] - batchLoss[i]));
+
+#ifdef __AVX2__
+	std::cout << "Batched kernel: AVX2" << std::endl;
+#else
+	std::cout << "Batched kernel: scalar (build with MASK_ENABLE_AVX2 for the vectorized kernel)" << std::endl;
+#endif
+	std::cout << "Number of particles: " << nParticles << " Batch size: " << batchSize << std::endl;
+	std::cout << "Scalar time per particle(nanoseconds): " << scalarTime*1.0e6/nParticles << std::endl;
+	std::cout << "Batched time per particle(nanoseconds): " << batchTime*1.0e6/nParticles << std::endl;
+	std::cout << "Speedup: " << scalarTime/batchTime << std::endl;
+	std::cout << "Largest difference(MeV): " << maxDifference << std::endl;
+
+	//Generic chain executor against the hand-written systems
+	Mask::RandomGenerator::SetSeed(12345);
+	Mask::LayeredTarget chainTarget;
+	chainTarget.SetEnergyLossMode(Mask::EnergyLossMode::Tabulated);
+	chainTarget.AddLayer({5}, {10}, {1}, 74.0);
+	std::vector<Mask::StepParameters> chain = CreateExampleChain();
+	std::cout << "Number of chain events: " << nChainEvents << std::endl;
+	CompareChain<Mask::TwoStepSystem, 2>({chain[0], chain[1]}, chainTarget, nChainEvents, batchSize);
+	CompareChain<Mask::ThreeStepSystem, 3>(chain, chainTarget, nChainEvents, batchSize);
+
+	return 0;
+}
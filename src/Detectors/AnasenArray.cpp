@@ -23,6 +23,7 @@ AnasenArray::AnasenArray() :
 		m_backwardQQQs.emplace_back(s_qqqPhiList[i], (-1.0)*s_qqqZList[i]);
 		m_backwardQQQs[i].SetSmearing(true);
 	}
+	m_detectorEloss.SetEnergyLossMode(Mask::EnergyLossMode::Tabulated);
 }
 
 AnasenArray::~AnasenArray() {}
@@ -230,7 +231,7 @@ double AnasenArray::RunConsistencyCheck()
 
 }
 
-DetectorResult AnasenArray::IsRing1(const Mask::Nucleus& nucleus)
+DetectorResult AnasenArray::IsRing1(const Mask::Nucleus& nucleus, const Mask::Species& species)
 {
 	DetectorResult observation;
 	double thetaIncident;
@@ -246,7 +247,7 @@ DetectorResult AnasenArray::IsRing1(const Mask::Nucleus& nucleus)
 			if(thetaIncident > M_PI/2.0)
 				thetaIncident = M_PI - thetaIncident;
 
-			observation.energy_deposited = m_detectorEloss.GetEnergyLossTotal(nucleus.Z, nucleus.A, nucleus.GetKE(), thetaIncident);
+			observation.energy_deposited = m_detectorEloss.GetEnergyLossTotal(species, nucleus.GetKE(), thetaIncident);
 			observation.det_name = "R1";
 			return observation;
 		}
@@ -255,7 +256,7 @@ DetectorResult AnasenArray::IsRing1(const Mask::Nucleus& nucleus)
 	return observation;
 }
 
-DetectorResult AnasenArray::IsRing2(const Mask::Nucleus& nucleus)
+DetectorResult AnasenArray::IsRing2(const Mask::Nucleus& nucleus, const Mask::Species& species)
 {
 	DetectorResult observation;
 	double thetaIncident;
@@ -271,7 +272,7 @@ DetectorResult AnasenArray::IsRing2(const Mask::Nucleus& nucleus)
 			if(thetaIncident > M_PI/2.0)
 				thetaIncident = M_PI - thetaIncident;
 
-			observation.energy_deposited = m_detectorEloss.GetEnergyLossTotal(nucleus.Z, nucleus.A, nucleus.GetKE(), thetaIncident);
+			observation.energy_deposited = m_detectorEloss.GetEnergyLossTotal(species, nucleus.GetKE(), thetaIncident);
 			observation.det_name = "R2";
 			return observation;
 		}
@@ -280,7 +281,7 @@ DetectorResult AnasenArray::IsRing2(const Mask::Nucleus& nucleus)
 	return observation;
 }
 
-DetectorResult AnasenArray::IsQQQ(const Mask::Nucleus& nucleus)
+DetectorResult AnasenArray::IsQQQ(const Mask::Nucleus& nucleus, const Mask::Species& species)
 {
 	DetectorResult observation;
 	double thetaIncident;
@@ -296,7 +297,7 @@ DetectorResult AnasenArray::IsQQQ(const Mask::Nucleus& nucleus)
 			if(thetaIncident > M_PI/2.0)
 				thetaIncident = M_PI - thetaIncident;
 
-			observation.energy_deposited = m_detectorEloss.GetEnergyLossTotal(nucleus.Z, nucleus.A, nucleus.GetKE(), thetaIncident);
+			observation.energy_deposited = m_detectorEloss.GetEnergyLossTotal(species, nucleus.GetKE(), thetaIncident);
 			observation.det_name = "FQQQ";
 			return observation;
 		}
@@ -315,7 +316,7 @@ DetectorResult AnasenArray::IsQQQ(const Mask::Nucleus& nucleus)
 			if(thetaIncident > M_PI/2.0)
 				thetaIncident = M_PI - thetaIncident;
 
-			observation.energy_deposited = m_detectorEloss.GetEnergyLossTotal(nucleus.Z, nucleus.A, nucleus.GetKE(), thetaIncident);
+			observation.energy_deposited = m_detectorEloss.GetEnergyLossTotal(species, nucleus.GetKE(), thetaIncident);
 			observation.det_name = "BQQQ";
 			return observation;
 		}
@@ -324,17 +325,17 @@ DetectorResult AnasenArray::IsQQQ(const Mask::Nucleus& nucleus)
 	return observation;
 }
 
-DetectorResult AnasenArray::IsDetected(const Mask::Nucleus& nucleus)
+DetectorResult AnasenArray::IsDetected(const Mask::Nucleus& nucleus, const Mask::Species& species)
 {
 	DetectorResult result;
 	if(nucleus.GetKE() <= s_energyThreshold)
 		return result;
 
 	if(!result.detectFlag)
-		result = IsRing1(nucleus);
+		result = IsRing1(nucleus, species);
 	if(!result.detectFlag)
-		result = IsRing2(nucleus);
+		result = IsRing2(nucleus, species);
 	if(!result.detectFlag)
-		result = IsQQQ(nucleus);
+		result = IsQQQ(nucleus, species);
 	return result;
 }
\ No newline at end of file
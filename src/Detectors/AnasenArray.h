@@ -15,15 +15,17 @@ class AnasenArray : public DetectorArray
 public:
 	AnasenArray();
 	~AnasenArray();
-	virtual DetectorResult IsDetected(const Mask::Nucleus& nucleus);
+	virtual DetectorResult IsDetected(const Mask::Nucleus& nucleus, const Mask::Species& species) override;
 	virtual void DrawDetectorSystem(const std::string& filename) override;
 	virtual double RunConsistencyCheck() override;
 	virtual void SetDeadChannelMap(const std::string& filename) override { dmap.LoadMapfile(filename); }
+	virtual void SetEnergyLossMode(Mask::EnergyLossMode mode) override { m_detectorEloss.SetEnergyLossMode(mode); }
+	virtual void BuildEnergyLossTables(const Mask::Species& species) override { m_detectorEloss.BuildEnergyLossTable(species); }
 
 private:
-	DetectorResult IsRing1(const Mask::Nucleus& nucleus);
-	DetectorResult IsRing2(const Mask::Nucleus& nucleus);
-	DetectorResult IsQQQ(const Mask::Nucleus& nucleus);
+	DetectorResult IsRing1(const Mask::Nucleus& nucleus, const Mask::Species& species);
+	DetectorResult IsRing2(const Mask::Nucleus& nucleus, const Mask::Species& species);
+	DetectorResult IsQQQ(const Mask::Nucleus& nucleus, const Mask::Species& species);
 
 	std::vector<SX3Detector> m_Ring1;
 	std::vector<SX3Detector> m_Ring2;
@@ -1,11 +1,20 @@
 #include "DetectorApp.h"
 #include <fstream>
 #include <iostream>
+#include <cmath>
+#include <thread>
+#include <atomic>
+
+#include "TROOT.h"
+
+#include "Mask/ConfigSerializer.h"
+#include "Mask/RandomGenerator.h"
 
 #include "yaml-cpp/yaml.h"
 
 DetectorApp::DetectorApp() :
-    m_resources(nullptr)
+    m_elossMode(Mask::EnergyLossMode::Tabulated), m_writerMode(Mask::WriterMode::Queue), m_mergeShards(false), m_writerQueueCapacity(Mask::EventQueue::s_defaultCapacity), m_writerQueueMemory(0.0), m_seed(0), m_isAcceptanceMapOnly(false), m_acceptanceZ(0), m_acceptanceA(0), m_acceptanceKE(0.0), m_acceptanceCosThetaBins(0),
+    m_acceptancePhiBins(0), m_acceptanceLayer(0), m_nDetected(0), m_weightSum(0.0), m_detectedWeightSum(0.0), m_resources(nullptr), m_isWorkerFailed(false)
 {
 }
 
@@ -29,19 +38,86 @@ bool DetectorApp::LoadConfig(const std::string& filename)
         return false;
     }
 
-    m_inputFileName = data["InputDataFile"].as<std::string>();
-    m_outputFileName = data["OutputDataFile"].as<std::string>();
+    //Optional, defaults to false. With AcceptanceMapOnly no data is read or written, only the acceptance map is made
+    if(data["AcceptanceMapOnly"])
+        m_isAcceptanceMapOnly = data["AcceptanceMapOnly"].as<bool>();
+    if(!m_isAcceptanceMapOnly)
+    {
+        m_inputFileName = data["InputDataFile"].as<std::string>();
+        m_outputFileName = data["OutputDataFile"].as<std::string>();
+    }
     m_deadChannelFileName = data["DeadChannelFile"].as<std::string>();
+    //Optional. Without a seed one is chosen at random (and printed), as in the kinematics simulation
+    if(data["Seed"])
+        m_seed = data["Seed"].as<uint64_t>();
+    else
+        m_seed = Mask::RandomGenerator::GenerateSeed();
+    //The detector response of every event draws from the event's own stream of this seed, so it does not depend on the number of threads
+    Mask::RandomGenerator::SetSeed(m_seed);
     m_nthreads = data["NumberOfThreads"].as<uint64_t>();
     ArrayType type = StringToArrayType(data["ArrayType"].as<std::string>());
+    //Optional, defaults to Tabulated. Exact runs the full catima integration for every hit (for validation)
+    if(data["EnergyLossMode"])
+        m_elossMode = Mask::StringToEnergyLossMode(data["EnergyLossMode"].as<std::string>());
+    //Optional, defaults to Queue. Shards has each thread write its own file; with MergeShards (default false) they are merged at the end.
+    //BufferMerger has each thread fill a buffer which is merged into the output file as the run goes
+    if(data["WriterMode"])
+        m_writerMode = Mask::StringToWriterMode(data["WriterMode"].as<std::string>());
+    if(data["MergeShards"])
+        m_mergeShards = data["MergeShards"].as<bool>();
+    //Optional, defaults to 65536 events. WriterQueueMemory(MB) further limits the memory of the queued events
+    if(data["WriterQueueCapacity"])
+        m_writerQueueCapacity = data["WriterQueueCapacity"].as<uint64_t>();
+    if(data["WriterQueueMemory(MB)"])
+        m_writerQueueMemory = data["WriterQueueMemory(MB)"].as<double>();
+    //Optional, if given the acceptance map of the array is written for the given species and kinetic energy
+    if(data["AcceptanceMap"])
+    {
+        YAML::Node mapData = data["AcceptanceMap"];
+        m_acceptanceMapFileName = mapData["File"].as<std::string>();
+        m_acceptanceZ = mapData["Z"].as<uint32_t>();
+        m_acceptanceA = mapData["A"].as<uint32_t>();
+        m_acceptanceKE = mapData["KineticEnergy(MeV)"].as<double>();
+        m_acceptanceCosThetaBins = mapData["CosThetaBins"].as<std::size_t>();
+        m_acceptancePhiBins = mapData["PhiBins"].as<std::size_t>();
+        //Optional, the target the nucleus leaves from the middle of ReactionLayer (default 0), as TargetLayers of the kinematics config
+        if(mapData["TargetLayers"])
+        {
+            m_acceptanceTarget = Mask::ConfigSerializer::DeserializeTarget(mapData["TargetLayers"]);
+            if(mapData["ReactionLayer"])
+                m_acceptanceLayer = mapData["ReactionLayer"].as<std::size_t>();
+            if(m_acceptanceLayer >= m_acceptanceTarget.GetNumberOfLayers())
+            {
+                std::cerr << "Invalid acceptance map reaction layer " << m_acceptanceLayer << " of " << m_acceptanceTarget.GetNumberOfLayers() << " target layers" << std::endl;
+                return false;
+            }
+        }
+    }
 
     for(uint64_t i=0; i<m_nthreads; i++)
     {
         m_detectorList.push_back(CreateDetectorArray(type));
+        if(m_detectorList.back() == nullptr)
+        {
+            std::cerr << "Invalid array type " << data["ArrayType"].as<std::string>() << std::endl;
+            return false;
+        }
+        m_detectorList.back()->SetEnergyLossMode(m_elossMode);
         if(m_deadChannelFileName != "None")
             m_detectorList.back()->SetDeadChannelMap(m_deadChannelFileName);
     }
-    m_resources = std::make_unique<Mask::ThreadPool<DetectorArray*, uint64_t>>(m_nthreads);
+    m_resources = std::make_unique<Mask::ThreadPool<DetectorArray*>>(m_nthreads);
+
+    if(m_isAcceptanceMapOnly)
+    {
+        if(m_acceptanceMapFileName.empty())
+        {
+            std::cerr << "AcceptanceMapOnly is set but no acceptance map is requested" << std::endl;
+            return false;
+        }
+        std::cout << "Acceptance map file " << m_acceptanceMapFileName << "..." << std::endl;
+        return true;
+    }
 
     m_fileReader.Open(m_inputFileName, "SimTree");
     if(!m_fileReader.IsOpen() || !m_fileReader.IsTree())
@@ -50,28 +126,114 @@ bool DetectorApp::LoadConfig(const std::string& filename)
         return false;
     }
     m_nentries = m_fileReader.GetSize();
+    //Species of every nucleus in the data, resolved once, and their range tables, built before the arrays are used (no-op in Exact mode)
+    for(auto& nucleus : m_fileReader.GetFirstEntry())
+    {
+        m_species.push_back(&Mask::SpeciesLookup::GetInstance().FindSpecies(nucleus.Z, nucleus.A));
+        for(auto array : m_detectorList)
+            array->BuildEnergyLossTables(*m_species.back());
+    }
 
-    //Little bit of integer division mangling to make sure we read every event in file
-    uint64_t quotient = m_nentries / m_nthreads;
-    uint64_t remainder = m_nentries % m_nthreads;
-    m_chunkSamples.push_back(quotient + remainder);
-    for(uint64_t i=1; i<m_nthreads; i++)
-        m_chunkSamples.push_back(quotient);
-
-    m_fileWriter.Open(m_outputFileName, "SimTree");
-    if(!m_fileWriter.IsOpen() || !m_fileWriter.IsTree())
+    if(m_writerMode != Mask::WriterMode::Queue)
     {
-        std::cerr << "Unable to open output data file " << m_outputFileName << std::endl;
-        return false;
+        //Every thread fills its own file, on disk or in memory for the merger
+        ROOT::EnableThreadSafety();
+        if(!m_shardWriter.Open(m_outputFileName, "SimTree", m_nthreads, m_writerMode))
+            return false;
+    }
+    else
+    {
+        m_fileWriter.Open(m_outputFileName, "SimTree");
+        if(!m_fileWriter.IsOpen() || !m_fileWriter.IsTree())
+        {
+            std::cerr << "Unable to open output data file " << m_outputFileName << std::endl;
+            return false;
+        }
+        m_fileWriter.SetQueueCapacity(m_writerQueueCapacity, m_writerQueueMemory, m_fileReader.GetFirstEntry());
     }
 
     std::cout << "Allocating " << m_nthreads << " threads..." << std::endl;
     std::cout << "Input data file " << m_inputFileName << "..." << std::endl;
     std::cout << "With " << m_nentries << " events in the file..." << std::endl;
     std::cout << "Output data file " << m_outputFileName << "..." << std::endl;
+    std::cout << "Energy loss mode " << Mask::EnergyLossModeToString(m_elossMode) << "..." << std::endl;
+    std::cout << "Random seed " << m_seed << "..." << std::endl;
+    if(m_writerMode == Mask::WriterMode::BufferMerger)
+        std::cout << "Output merged from per-thread buffers..." << std::endl;
+    else if(m_writerMode == Mask::WriterMode::Shards)
+        std::cout << "Output shards " << Mask::ShardedFileWriter::GetShardFileName(m_outputFileName, 0) << " ... (" << (m_mergeShards ? "merged" : "chained") << " at the end)..." << std::endl;
+    else
+        std::cout << "Writer queue capacity " << m_fileWriter.GetQueueCapacity() << " events..." << std::endl;
+    if(!m_acceptanceMapFileName.empty())
+        std::cout << "Acceptance map file " << m_acceptanceMapFileName << "..." << std::endl;
     return true;
 }
 
+/*
+    Fraction of each direction bin in which a nucleus of the chosen species and kinetic energy, made at the reaction point, is
+    detected. An evenly spaced grid of directions is tested in every bin, with the thresholds, energy loss and dead channels of the
+    efficiency calculation. With target layers the nucleus first loses energy on its way out of the target, from the middle of
+    the reaction layer. The cos(theta) bins are handed out to the arrays of all threads.
+*/
+void DetectorApp::BuildAcceptanceMap()
+{
+    std::cout << "Building acceptance map..." << std::endl;
+    Mask::AcceptanceMap map(m_acceptanceCosThetaBins, m_acceptancePhiBins);
+    const Mask::Species& species = Mask::SpeciesLookup::GetInstance().FindSpecies(m_acceptanceZ, m_acceptanceA);
+    bool isTargetSet = m_acceptanceTarget.GetNumberOfLayers() != 0;
+    if(isTargetSet)
+    {
+        m_acceptanceTarget.SetEnergyLossMode(m_elossMode);
+        m_acceptanceTarget.BuildEnergyLossTables(species);
+    }
+    for(auto array : m_detectorList)
+        array->BuildEnergyLossTables(species);
+    double cosThetaStep = map.GetCosThetaBinWidth()/s_acceptanceSubdivisions;
+    double phiStep = map.GetPhiBinWidth()/s_acceptanceSubdivisions;
+
+    std::atomic<std::size_t> nextBin(0);
+    auto fillBins = [&](DetectorArray* array)
+    {
+        Mask::Nucleus nucleus = Mask::CreateNucleus(m_acceptanceZ, m_acceptanceA);
+        std::size_t i;
+        while((i = nextBin.fetch_add(1)) < map.GetNumberOfCosThetaBins())
+        {
+            Mask::RandomGenerator::GetInstance().SetEvent(i); //Each bin has its own stream, whichever thread fills it
+            for(std::size_t j=0; j<map.GetNumberOfPhiBins(); j++)
+            {
+                int nDetected = 0;
+                for(int k=0; k<s_acceptanceSubdivisions; k++)
+                {
+                    double theta = std::acos(map.GetCosThetaLowEdge(i) + (k + 0.5)*cosThetaStep);
+                    double kineticEnergy = m_acceptanceKE;
+                    if(isTargetSet)
+                        kineticEnergy -= m_acceptanceTarget.GetEjectileEnergyLoss(species, m_acceptanceKE, m_acceptanceLayer, theta, 0.5);
+                    if(kineticEnergy <= 0.0)
+                        continue; //Stopped in the target
+                    double energy = kineticEnergy + nucleus.groundStateMass;
+                    double momentum = std::sqrt(energy*energy - nucleus.groundStateMass*nucleus.groundStateMass);
+                    for(int l=0; l<s_acceptanceSubdivisions; l++)
+                    {
+                        nucleus.SetVec4Spherical(theta, map.GetPhiLowEdge(j) + (l + 0.5)*phiStep, momentum, energy);
+                        if(array->IsDetected(nucleus, species).detectFlag)
+                            nDetected++;
+                    }
+                }
+                map.SetAcceptance(i, j, double(nDetected)/(s_acceptanceSubdivisions*s_acceptanceSubdivisions));
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for(auto array : m_detectorList)
+        workers.emplace_back(fillBins, array);
+    for(auto& worker : workers)
+        worker.join();
+
+    if(map.WriteMapFile(m_acceptanceMapFileName))
+        std::cout << "Acceptance map written to " << m_acceptanceMapFileName << ", mean acceptance " << map.GetMeanAcceptance() << std::endl;
+}
+
 void DetectorApp::Run()
 {
 	std::cout<<"Running efficiency calculation..."<<std::endl;
@@ -82,35 +244,90 @@ void DetectorApp::Run()
         return;
     }
 
+    if(!m_acceptanceMapFileName.empty())
+        BuildAcceptanceMap();
+    if(m_isAcceptanceMapOnly)
+        return;
+
+    //The writer sleeps until events are queued, and stops once every job has finished
+    m_fileWriter.SetNumberOfProducers(m_detectorList.size());
     for(uint64_t i=0; i<m_detectorList.size(); i++)
     {
         //Create a job for the thread pool, using a lambda and providing a tuple of the arguments
-        m_resources->PushJob({[this](DetectorArray* array, uint64_t chunkSamples)
+        m_resources->PushJob({[this, shardIndex = i](DetectorArray* array)
             {
-                if(system == nullptr)
-		    	    return;
-
-                std::vector<Mask::Nucleus> data;
-                DetectorResult result;
-	            for(uint64_t i=0; i<chunkSamples; i++)
-	            {
-                    m_fileReader.Read(data);
-                    for(auto& nucleus : data)
+                if(array == nullptr)
+                {
+                    m_fileWriter.FinishProducer();
+                    return;
+                }
+
+                Mask::FileWriter* shard = nullptr;
+                uint64_t nDetected = 0;
+                double weightSum = 0.0, detectedWeightSum = 0.0;
+                try
+                {
+                    if(m_shardWriter.IsOpen())
                     {
-                        result = array->IsDetected(nucleus);
-                        if(result.detectFlag)
+                        m_shardWriter.StartShard(shardIndex);
+                        shard = &m_shardWriter.GetShard(shardIndex);
+                    }
+
+                    std::vector<Mask::Nucleus> data;
+                    uint64_t eventIndex;
+                    double weight;
+                    DetectorResult result;
+                    bool isEventDetected;
+                    //Events are taken from the shared reader until none are left, so threads with slower events take fewer
+                    while(!m_isWorkerFailed.load(std::memory_order_relaxed) && m_fileReader.Read(data, eventIndex, weight))
+                    {
+                        Mask::RandomGenerator::GetInstance().SetEvent(eventIndex);
+                        isEventDetected = false;
+                        for(std::size_t k=0; k<data.size() && k<m_species.size(); k++)
                         {
-                            nucleus.isDetected = true;
-                            nucleus.detectedKE = result.energy_deposited;
-                            nucleus.detectedTheta = result.direction.Theta();
-                            nucleus.detectedPhi = result.direction.Phi();
-                            nucleus.detectedPos = result.direction;
+                            Mask::Nucleus& nucleus = data[k];
+                            result = array->IsDetected(nucleus, *m_species[k]);
+                            if(result.detectFlag)
+                            {
+                                isEventDetected = true;
+                                nucleus.isDetected = true;
+                                nucleus.detectedKE = result.energy_deposited;
+                                nucleus.detectedTheta = result.direction.Theta();
+                                nucleus.detectedPhi = result.direction.Phi();
+                                nucleus.detectedPos = result.direction;
+                            }
                         }
+                        weightSum += weight;
+                        if(isEventDetected)
+                        {
+                            nDetected++;
+                            detectedWeightSum += weight;
+                        }
+                        if(shard != nullptr)
+                            shard->Fill(data, eventIndex, weight);
+                        else
+                            m_fileWriter.PushData(data, eventIndex, weight);
                     }
-		            m_fileWriter.PushData(data);
-	            }
+                }
+                catch(...)
+                {
+                    //The job must still finish, or the writer waits for it forever. The exception is rethrown on the main thread
+                    m_isWorkerFailed.store(true);
+                    std::scoped_lock<std::mutex> guard(m_countMutex);
+                    if(!m_workerException)
+                        m_workerException = std::current_exception();
+                }
+
+                if(shard != nullptr)
+                    m_shardWriter.FinishShard(shardIndex);
+
+                std::scoped_lock<std::mutex> guard(m_countMutex);
+                m_nDetected += nDetected;
+                m_weightSum += weightSum;
+                m_detectedWeightSum += detectedWeightSum;
+                m_fileWriter.FinishProducer();
             },
-        {m_detectorList[i], m_chunkSamples[i]} //arguments to function, in order
+        {m_detectorList[i]} //arguments to function, in order
         }
         );
     }
@@ -121,21 +338,35 @@ void DetectorApp::Run()
 	uint64_t flushVal = size*percent;
 	uint64_t flushCount = 0;
 
-	while(true)
+    //With shards nothing is queued, and this only waits for the jobs to finish
+	while(m_fileWriter.Write())
 	{
+        ++count;
         if(count == flushVal)
 	    {
 	    	count = 0;
 	    	++flushCount;
 	    	std::cout<<"\rPercent of data written to disk: "<<percent*flushCount*100<<"%"<<std::flush;
 	    }
-
-		if(m_resources->IsFinished() && m_fileWriter.GetQueueSize() == 0)
-				break;
-		else if(m_fileWriter.Write())
-				++count;
 	}
 
     std::cout << std::endl;
-	
+    if(m_workerException)
+        std::rethrow_exception(m_workerException);
+    if(m_writerMode == Mask::WriterMode::BufferMerger)
+    {
+        std::cout << "Writing the merged output..." << std::endl;
+        m_shardWriter.Close(false);
+    }
+    else if(m_writerMode == Mask::WriterMode::Shards)
+    {
+        std::cout << (m_mergeShards ? "Merging the output shards..." : "Writing the chain of the output shards...") << std::endl;
+        m_shardWriter.Close(m_mergeShards);
+    }
+    else
+        m_fileWriter.PrintQueueStatistics();
+    //With acceptance-biased input the weighted fraction is the efficiency; the unweighted count is what the biasing improves
+    std::cout << "Events with a detected nucleus: " << m_nDetected << " of " << m_nentries << std::endl;
+    if(m_weightSum > 0.0)
+        std::cout << "Weighted fraction of events with a detected nucleus: " << m_detectedWeightSum/m_weightSum << std::endl;
 }
\ No newline at end of file
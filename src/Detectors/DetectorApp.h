@@ -3,12 +3,18 @@
 
 #include "DetectorArray.h"
 #include "Mask/FileWriter.h"
+#include "Mask/ShardedFileWriter.h"
 #include "Mask/FileReader.h"
 #include "Mask/ThreadPool.h"
+#include "Mask/AcceptanceMap.h"
+#include "Mask/LayeredTarget.h"
 
 #include <string>
 #include <vector>
 #include <memory>
+#include <mutex>
+#include <atomic>
+#include <exception>
 
 class DetectorApp
 {
@@ -21,20 +27,49 @@ public:
     void Run();
 
 private:
+    void BuildAcceptanceMap();
 
     std::vector<DetectorArray*> m_detectorList; //One array per thread
-    std::vector<uint64_t> m_chunkSamples;
+    std::vector<const Mask::Species*> m_species; //Of each nucleus of an event, which has the same nuclei in every entry
     Mask::FileWriter m_fileWriter;
+    Mask::ShardedFileWriter m_shardWriter; //Shards and BufferMerger modes only
     Mask::FileReader m_fileReader;
 
     std::string m_inputFileName;
     std::string m_outputFileName;
     std::string m_deadChannelFileName;
+    Mask::EnergyLossMode m_elossMode;
 
     uint64_t m_nthreads;
     uint64_t m_nentries;
+    Mask::WriterMode m_writerMode;
+    bool m_mergeShards;
+    uint64_t m_writerQueueCapacity; //Events held between the workers and the writer
+    double m_writerQueueMemory; //Limit on the memory of the queued events, in MB; 0 for no limit
+    uint64_t m_seed; //Global seed of the random streams of the events
 
-    std::unique_ptr<Mask::ThreadPool<DetectorArray*, uint64_t>> m_resources;
+    //Acceptance map of the array, for biasing the event generation (see Mask::AcceptanceMap)
+    std::string m_acceptanceMapFileName;
+    bool m_isAcceptanceMapOnly; //No input data; only the map is made
+    uint32_t m_acceptanceZ;
+    uint32_t m_acceptanceA;
+    double m_acceptanceKE;
+    std::size_t m_acceptanceCosThetaBins;
+    std::size_t m_acceptancePhiBins;
+    Mask::LayeredTarget m_acceptanceTarget; //Energy loss on the way out of the target, if any layers are given
+    std::size_t m_acceptanceLayer;
+
+    //Events with at least one detected nucleus, and the sums of the event weights
+    std::mutex m_countMutex;
+    uint64_t m_nDetected;
+    double m_weightSum;
+    double m_detectedWeightSum;
+
+    static constexpr int s_acceptanceSubdivisions = 4; //Directions tested per bin, along each axis
+
+    std::unique_ptr<Mask::ThreadPool<DetectorArray*>> m_resources;
+    std::exception_ptr m_workerException; //First exception thrown by a job, rethrown by Run
+    std::atomic<bool> m_isWorkerFailed; //Stops the other jobs
 };
 
 #endif
\ No newline at end of file
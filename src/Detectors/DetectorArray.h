@@ -6,6 +6,8 @@
 
 #include "Math/Point3D.h"
 #include "Mask/Nucleus.h"
+#include "Mask/EnergyLossTable.h"
+#include "Mask/Species.h"
 
 struct DetectorResult
 {
@@ -28,10 +30,14 @@ public:
 	DetectorArray() {};
 	virtual ~DetectorArray() {};
 
-	virtual DetectorResult IsDetected(const Mask::Nucleus& nucleus) = 0;
+	//The species of the nucleus is resolved by the caller, once per kind of nucleus rather than for every hit
+	virtual DetectorResult IsDetected(const Mask::Nucleus& nucleus, const Mask::Species& species) = 0;
 	virtual void DrawDetectorSystem(const std::string& filename) = 0;
 	virtual double RunConsistencyCheck() = 0;
 	virtual void SetDeadChannelMap(const std::string& filename) = 0;
+	virtual void SetEnergyLossMode(Mask::EnergyLossMode mode) = 0;
+	//Called at setup for every species which will be tested, after SetEnergyLossMode
+	virtual void BuildEnergyLossTables(const Mask::Species& species) = 0;
 
 protected:
 	bool IsDoubleEqual(double x, double y) { return std::fabs(x-y) < s_epsilon ? true : false; };
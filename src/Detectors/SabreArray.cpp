@@ -20,6 +20,7 @@ SabreArray::SabreArray() :
 	m_degradedDetectors[2] = false;
 	m_degradedDetectors[3] = false;
 	m_degradedDetectors[4] = true;
+	SetEnergyLossMode(Mask::EnergyLossMode::Tabulated);
     //No degraded detectors
 	// m_degradedDetectors[0] = false;
 	// m_degradedDetectors[1] = false;
@@ -109,8 +110,24 @@ double SabreArray::RunConsistencyCheck()
  	return ((double)count)/npoints;
 }
 
+/*Tabulated mode (the default) uses range tables for the dead layer, detector, and degrader; Exact integrates every hit*/
+void SabreArray::SetEnergyLossMode(Mask::EnergyLossMode mode)
+{
+	m_deadlayerEloss.SetEnergyLossMode(mode);
+	m_detectorEloss.SetEnergyLossMode(mode);
+	m_degraderEloss.SetEnergyLossMode(mode);
+}
+
+/*Tables are built the first time a species hits the array. Each thread has its own array, so no locking is needed*/
+void SabreArray::BuildEnergyLossTables(const Mask::Species& species)
+{
+	m_deadlayerEloss.BuildEnergyLossTable(species);
+	m_detectorEloss.BuildEnergyLossTable(species);
+	m_degraderEloss.BuildEnergyLossTable(species);
+}
+
 /*Returns if detected, as well as total energy deposited in SABRE*/
-DetectorResult SabreArray::IsDetected(const Mask::Nucleus& nucleus)
+DetectorResult SabreArray::IsDetected(const Mask::Nucleus& nucleus, const Mask::Species& species)
 {
 	DetectorResult observation;
 	if(nucleus.GetKE() <= s_energyThreshold)
@@ -135,13 +152,13 @@ DetectorResult SabreArray::IsDetected(const Mask::Nucleus& nucleus)
 		//Energy loss
 		ke = nucleus.GetKE();
 		if(m_degradedDetectors[detector.GetDetectorID()])
-			ke -= m_degraderEloss.GetEnergyLossTotal(nucleus.Z, nucleus.A, ke, M_PI - thetaIncident);
-		ke -= m_deadlayerEloss.GetEnergyLossTotal(nucleus.Z, nucleus.A, ke, M_PI - thetaIncident);
+			ke -= m_degraderEloss.GetEnergyLossTotal(species, ke, M_PI - thetaIncident);
+		ke -= m_deadlayerEloss.GetEnergyLossTotal(species, ke, M_PI - thetaIncident);
 		if(ke <= s_energyThreshold)
 			break;
 
 		observation.det_name = "SABRE"+std::to_string(detector.GetDetectorID());
-		observation.energy_deposited = m_detectorEloss.GetEnergyLossTotal(nucleus.Z, nucleus.A, ke, M_PI - thetaIncident);
+		observation.energy_deposited = m_detectorEloss.GetEnergyLossTotal(species, ke, M_PI - thetaIncident);
 		observation.detectFlag = true;
 		return observation;
 	}
@@ -13,12 +13,13 @@ public:
 	SabreArray();
 	~SabreArray();
     virtual void SetDeadChannelMap(const std::string& filename) override { m_deadMap.LoadMapfile(filename); };
-	virtual DetectorResult IsDetected(const Mask::Nucleus& nucleus) override;
+    virtual void SetEnergyLossMode(Mask::EnergyLossMode mode) override;
+    virtual void BuildEnergyLossTables(const Mask::Species& species) override;
+	virtual DetectorResult IsDetected(const Mask::Nucleus& nucleus, const Mask::Species& species) override;
     void DrawDetectorSystem(const std::string& filename) override;
     double RunConsistencyCheck() override;
 
 private:
-
 	std::vector<SabreDetector> m_detectors;
     
 	Mask::Target m_deadlayerEloss;
@@ -0,0 +1,104 @@
+#include "AcceptanceMap.h"
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+namespace Mask {
+
+	AcceptanceMap::AcceptanceMap() :
+		m_nCosThetaBins(0), m_nPhiBins(0)
+	{
+	}
+
+	AcceptanceMap::AcceptanceMap(std::size_t nCosThetaBins, std::size_t nPhiBins) :
+		m_nCosThetaBins(nCosThetaBins), m_nPhiBins(nPhiBins), m_values(nCosThetaBins*nPhiBins, 0.0)
+	{
+	}
+
+	AcceptanceMap::~AcceptanceMap() {}
+
+	bool AcceptanceMap::ReadMapFile(const std::string& filename)
+	{
+		std::ifstream input(filename);
+		if(!input.is_open())
+		{
+			std::cerr << "Unable to open acceptance map file " << filename << std::endl;
+			return false;
+		}
+
+		std::string junk;
+		std::size_t nCosThetaBins = 0, nPhiBins = 0;
+		input >> junk >> nCosThetaBins >> junk >> nPhiBins;
+		std::vector<double> values;
+		double value;
+		while(input >> value)
+			values.push_back(std::clamp(value, 0.0, 1.0));
+		input.close();
+
+		if(nCosThetaBins == 0 || nPhiBins == 0 || values.size() != nCosThetaBins*nPhiBins)
+		{
+			std::cerr << "Unexpected number of values in acceptance map file " << filename << "! Expected " << nCosThetaBins*nPhiBins
+					  << " and given " << values.size() << std::endl;
+			return false;
+		}
+
+		m_nCosThetaBins = nCosThetaBins;
+		m_nPhiBins = nPhiBins;
+		m_values = std::move(values);
+		return true;
+	}
+
+	bool AcceptanceMap::WriteMapFile(const std::string& filename) const
+	{
+		std::ofstream output(filename);
+		if(!output.is_open())
+		{
+			std::cerr << "Unable to open acceptance map file " << filename << std::endl;
+			return false;
+		}
+
+		output << "CosThetaBins: " << m_nCosThetaBins << std::endl;
+		output << "PhiBins: " << m_nPhiBins << std::endl;
+		for(std::size_t i=0; i<m_nCosThetaBins; i++)
+		{
+			for(std::size_t j=0; j<m_nPhiBins; j++)
+				output << m_values[i*m_nPhiBins + j] << " ";
+			output << std::endl;
+		}
+		output.close();
+		return true;
+	}
+
+	//Acceptance of the bin containing the direction; phi may be given in (-pi, pi] (as from ROOT) or [0, 2pi)
+	double AcceptanceMap::GetAcceptance(double cosTheta, double phi) const
+	{
+		if(!IsValid() || cosTheta < -1.0 || cosTheta > 1.0)
+			return 0.0;
+
+		if(phi < 0.0)
+			phi += 2.0*M_PI;
+		std::size_t cosThetaBin = std::min<std::size_t>((cosTheta + 1.0)/GetCosThetaBinWidth(), m_nCosThetaBins - 1);
+		std::size_t phiBin = std::min<std::size_t>(phi/GetPhiBinWidth(), m_nPhiBins - 1);
+		return m_values[cosThetaBin*m_nPhiBins + phiBin];
+	}
+
+	void AcceptanceMap::SetAcceptance(std::size_t cosThetaBin, std::size_t phiBin, double value)
+	{
+		if(cosThetaBin >= m_nCosThetaBins || phiBin >= m_nPhiBins)
+			return;
+		m_values[cosThetaBin*m_nPhiBins + phiBin] = std::clamp(value, 0.0, 1.0);
+	}
+
+	//Fraction of the full solid angle accepted
+	double AcceptanceMap::GetMeanAcceptance() const
+	{
+		if(!IsValid())
+			return 0.0;
+
+		double sum = 0.0;
+		for(double value : m_values)
+			sum += value;
+		return sum/m_values.size();
+	}
+
+}
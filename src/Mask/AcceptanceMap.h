@@ -0,0 +1,49 @@
+/*
+	AcceptanceMap.h
+	Fraction of each direction bin accepted by a detector array, binned uniformly in cos(theta) over [-1, 1] and phi over
+	[0, 2pi) (i.e. equal solid angle bins). The map is written by the Detectors application for a chosen DetectorArray and
+	species, and read by Mask to bias the sampled angles of a reaction step towards the detectors (see
+	ReactionSystem::AcceptDirection).
+
+	File format: "CosThetaBins: n", "PhiBins: m", then the n*m acceptances, phi fastest.
+*/
+#ifndef ACCEPTANCEMAP_H
+#define ACCEPTANCEMAP_H
+
+#include <string>
+#include <vector>
+#include <cmath>
+
+namespace Mask {
+
+	class AcceptanceMap
+	{
+	public:
+		AcceptanceMap();
+		AcceptanceMap(std::size_t nCosThetaBins, std::size_t nPhiBins);
+		~AcceptanceMap();
+
+		bool ReadMapFile(const std::string& filename);
+		bool WriteMapFile(const std::string& filename) const;
+
+		double GetAcceptance(double cosTheta, double phi) const;
+		void SetAcceptance(std::size_t cosThetaBin, std::size_t phiBin, double value);
+		double GetMeanAcceptance() const;
+
+		std::size_t GetNumberOfCosThetaBins() const { return m_nCosThetaBins; }
+		std::size_t GetNumberOfPhiBins() const { return m_nPhiBins; }
+		double GetCosThetaBinWidth() const { return 2.0/m_nCosThetaBins; }
+		double GetPhiBinWidth() const { return 2.0*M_PI/m_nPhiBins; }
+		double GetCosThetaLowEdge(std::size_t bin) const { return -1.0 + bin*GetCosThetaBinWidth(); }
+		double GetPhiLowEdge(std::size_t bin) const { return bin*GetPhiBinWidth(); }
+		bool IsValid() const { return !m_values.empty(); }
+
+	private:
+		std::size_t m_nCosThetaBins;
+		std::size_t m_nPhiBins;
+		std::vector<double> m_values;
+	};
+
+}
+
+#endif
@@ -3,52 +3,48 @@
 #include <fstream>
 #include <cmath>
 #include <iostream>
-#include "LegendrePoly.h"
+#include <algorithm>
 
 namespace Mask {
 
 	AngularDistribution::AngularDistribution() :
-		m_uniformCosineDist(-1.0, 1.0), m_uniformProbDist(0.0, 1.0), m_branchingRatio(1.0), m_L(0), m_isIsotropic(true)
+		m_uniformCosineDist(-1.0, 1.0), m_uniformProbDist(0.0, 1.0), m_branchingRatio(1.0), m_L(0), m_isIsotropic(true),
+		m_samplingMode(AngularSamplingMode::Tabulated), m_maxProbability(0.5), m_isInvertible(true)
 	{
+		SetDefault();
 	}
-	
+
 	AngularDistribution::AngularDistribution(const std::string& file) :
-		m_uniformCosineDist(-1.0, 1.0), m_branchingRatio(1.0), m_L(0), m_isIsotropic(true)
+		m_uniformCosineDist(-1.0, 1.0), m_uniformProbDist(0.0, 1.0), m_branchingRatio(1.0), m_L(0), m_isIsotropic(true),
+		m_samplingMode(AngularSamplingMode::Tabulated), m_maxProbability(0.5), m_isInvertible(true)
 	{
 		ReadDistributionFile(file);
 	}
-	
+
 	AngularDistribution::~AngularDistribution() {}
-	
+
 	void AngularDistribution::ReadDistributionFile(const std::string& file)
 	{
-	
+
 		if(file == "none" || file == "")
 		{
-			m_L=0;
-			m_branchingRatio=1.0;
-			m_constants.clear();
-			m_constants.push_back(0.5);
-			m_isIsotropic = true;
+			SetDefault();
 			return;
 		}
-	
+
 		std::ifstream input(file);
 		std::string junk;
 		int l;
 		double par;
-	
+
 		if(!input.is_open())
 		{
 			std::cerr << "Unable to open distribution file. All values reset to default." << std::endl;
-			m_L=0;
-			m_branchingRatio=1.0;
-			m_constants.clear();
-			m_constants.push_back(0.5);
-			m_isIsotropic = true;
+			SetDefault();
 			return;
 		}
-	
+
+		m_constants.clear();
 		input>>junk>>l;
 		while(input>>junk)
 		{
@@ -56,70 +52,259 @@ namespace Mask {
 			m_constants.push_back(par);
 		}
 		input.close();
-	
+
 		if(m_constants.size() != ((std::size_t) l+1))
 		{
 			std::cerr << "Unexpected number of constants for given angular momentum! Expected " << l+1 << " and given " << m_constants.size() << std::endl;
 			std::cerr << "Setting all values to default." << std::endl;
-			m_L=0;
-			m_branchingRatio=1.0;
-			m_constants.clear();
-			m_constants.push_back(0.5);
-			m_isIsotropic = true;
+			SetDefault();
 			return;
 		}
-	
+
 		//Total branching ratio
 		m_branchingRatio = m_constants[0]*2.0;
 		m_L = l;
 
 		//Renormalize distribution such that total prob is 1.0.
 		//Test branching ratio to see if we "make" a decay particle,
-		//then use re-normalized distribution to pick an angle. 
+		//then use re-normalized distribution to pick an angle.
 		if(m_constants[0] != 0.5)
 		{
 			double norm = 0.5/m_constants[0];
 			for(auto& value : m_constants)
 				value *= norm;
 		}
-	
+
 		m_isIsotropic = false;
-	
+		BuildTable();
 	}
-	
+
+	void AngularDistribution::SetDefault()
+	{
+		m_L=0;
+		m_branchingRatio=1.0;
+		m_constants.clear();
+		m_constants.push_back(0.5);
+		m_isIsotropic = true;
+		BuildTable();
+	}
+
+	/*
+		Tabulate W and its cumulative distribution at s_nNodes evenly spaced values of cos(theta), along with a guide table
+		which gives the starting segment for the search of a given cumulative probability. A series which is negative for
+		some angles is not a valid distribution; it cannot be inverted and is sampled by rejection instead.
+	*/
+	void AngularDistribution::BuildTable()
+	{
+		m_cdfValues.resize(s_nNodes);
+		m_pdfValues.resize(s_nNodes);
+		m_guide.resize(s_nNodes);
+
+		double step = 2.0/(s_nNodes - 1);
+		double cosTheta;
+		m_isInvertible = true;
+		m_maxProbability = 0.0;
+		for(std::size_t i=0; i<s_nNodes; i++)
+		{
+			cosTheta = i == s_nNodes - 1 ? 1.0 : -1.0 + i*step;
+			m_pdfValues[i] = GetProbability(cosTheta);
+			m_cdfValues[i] = GetCumulativeProbability(cosTheta);
+			m_maxProbability = std::max(m_maxProbability, m_pdfValues[i]);
+			if(m_pdfValues[i] < 0.0 || (i > 0 && m_cdfValues[i] < m_cdfValues[i-1]))
+				m_isInvertible = false;
+		}
+
+		if(!m_isInvertible)
+		{
+			std::cerr << "Angular distribution is negative for some angles, and will be sampled by rejection." << std::endl;
+			return;
+		}
+
+		std::size_t segment = 0;
+		double probability;
+		for(std::size_t k=0; k<s_nNodes; k++)
+		{
+			probability = double(k)/(s_nNodes - 1);
+			while(segment < s_nNodes - 2 && m_cdfValues[segment + 1] <= probability)
+				segment++;
+			m_guide[k] = segment;
+		}
+	}
+
 	double AngularDistribution::GetRandomCosTheta()
 	{
-		if(m_isIsotropic) 
-			return m_uniformCosineDist(RandomGenerator::GetInstance().GetGenerator());
-	
-		double test, probability;
-		double costheta;
-	
-		test = m_uniformProbDist(RandomGenerator::GetInstance().GetGenerator());
+		if(m_isIsotropic)
+			return RandomGenerator::GetInstance().Sample(m_uniformCosineDist);
+
+		double test = RandomGenerator::GetInstance().Sample(m_uniformProbDist);
 		if(test > m_branchingRatio)
 			return -10;
-	
-		do
+
+		if(!m_isInvertible)
+			return SampleRejection();
+
+		//Given that the branching test passed, test/branchingRatio is uniform on [0, 1]
+		double probability = m_branchingRatio > 0.0 ? test/m_branchingRatio : 0.0;
+		if(m_samplingMode == AngularSamplingMode::Exact)
+			return InvertExact(probability);
+		else
+			return InvertTabulated(probability);
+	}
+
+	//Segment [i, i+1] of the table which contains the given cumulative probability
+	std::size_t AngularDistribution::FindSegment(double probability) const
+	{
+		std::size_t segment = m_guide[std::min(static_cast<std::size_t>(probability*(s_nNodes - 1)), s_nNodes - 1)];
+		while(segment < s_nNodes - 2 && m_cdfValues[segment + 1] < probability)
+			segment++;
+		return segment;
+	}
+
+	/*
+		Invert the cubic Hermite interpolant of the cumulative distribution in the containing segment. The node slopes are the
+		values of W, so the interpolant is accurate to ~1e-9 in cos(theta). Newton's method with a bisection safeguard.
+	*/
+	double AngularDistribution::InvertTabulated(double probability) const
+	{
+		std::size_t segment = FindSegment(probability);
+		double step = 2.0/(s_nNodes - 1);
+		double f0 = m_cdfValues[segment];
+		double f1 = m_cdfValues[segment + 1];
+		if(f1 <= f0)
+			return -1.0 + segment*step;
+
+		double m0 = step*m_pdfValues[segment];
+		double m1 = step*m_pdfValues[segment + 1];
+		double low = 0.0, high = 1.0;
+		double t = std::clamp((probability - f0)/(f1 - f0), 0.0, 1.0);
+		double t2, t3, value, slope, next;
+		for(int i=0; i<s_maxIterations; i++)
+		{
+			t2 = t*t;
+			t3 = t2*t;
+			value = (2.0*t3 - 3.0*t2 + 1.0)*f0 + (t3 - 2.0*t2 + t)*m0 + (-2.0*t3 + 3.0*t2)*f1 + (t3 - t2)*m1 - probability;
+			slope = (6.0*t2 - 6.0*t)*(f0 - f1) + (3.0*t2 - 4.0*t + 1.0)*m0 + (3.0*t2 - 2.0*t)*m1;
+			if(value > 0.0)
+				high = t;
+			else
+				low = t;
+
+			next = slope > 0.0 ? t - value/slope : 0.5*(low + high);
+			if(std::fabs(next - t) < s_tolerance)
+			{
+				t = next;
+				break;
+			}
+			if(next <= low || next >= high)
+				next = 0.5*(low + high);
+			t = next;
+		}
+		return std::clamp(-1.0 + (segment + t)*step, -1.0, 1.0);
+	}
+
+	/*
+		Solve the analytic cumulative distribution for cos(theta) to full precision, starting from the segment given by the table.
+		Newton's method with a bisection safeguard, so it always converges. Used to validate InvertTabulated.
+	*/
+	double AngularDistribution::InvertExact(double probability) const
+	{
+		std::size_t segment = FindSegment(probability);
+		double step = 2.0/(s_nNodes - 1);
+		double low = -1.0 + segment*step;
+		double high = segment == s_nNodes - 2 ? 1.0 : low + step;
+		double cosTheta = 0.5*(low + high);
+		double value, slope, next;
+		for(int i=0; i<s_maxExactIterations; i++)
 		{
-			probability = 0.0;
-			costheta = m_uniformCosineDist(RandomGenerator::GetInstance().GetGenerator());
-			test = m_uniformProbDist(RandomGenerator::GetInstance().GetGenerator());
-			for(std::size_t i=0; i<m_constants.size(); i++)
-				probability += m_constants[i]*P_l(i*2, costheta);
+			value = GetCumulativeProbability(cosTheta) - probability;
+			slope = GetProbability(cosTheta);
+			if(value > 0.0)
+				high = cosTheta;
+			else
+				low = cosTheta;
+
+			next = slope > 0.0 ? cosTheta - value/slope : 0.5*(low + high);
+			if(std::fabs(next - cosTheta) <= s_exactTolerance)
+			{
+				cosTheta = next;
+				break;
+			}
+			if(next <= low || next >= high)
+				next = 0.5*(low + high);
+			cosTheta = next;
 		}
-		while(test > probability);
-	
+		return cosTheta;
+	}
+
+	//Rejection sampler for distributions which are negative for some angles. The envelope is the largest tabulated value of W.
+	//Only the first attempt takes Sobol dimensions; redraws come from the Philox stream
+	double AngularDistribution::SampleRejection()
+	{
+		RandomGenerator& rng = RandomGenerator::GetInstance();
+		double envelope = std::max(1.0, m_maxProbability);
+		double test, probability, costheta;
+		while(true)
+		{
+			costheta = rng.Sample(m_uniformCosineDist);
+			test = envelope*rng.Sample(m_uniformProbDist);
+			probability = GetProbability(costheta);
+			if(test <= probability)
+				break;
+			rng.StartRedraw();
+		}
+
 		return costheta;
 	}
 
-	double AngularDistribution::GetProbability(double cosTheta)
+	//W(cos(theta)). The even Legendre polynomials are built up by recursion in a single pass
+	double AngularDistribution::GetProbability(double cosTheta) const
 	{
-		double prob = 0.0;
-		for (std::size_t i=0; i<m_constants.size(); i++)
+		double prob = m_constants[0];
+		double previous = 1.0;
+		double current = cosTheta;
+		double next;
+		for(std::size_t n=2; n<2*m_constants.size(); n++)
 		{
-			prob += m_constants[i] * P_l(i*2, cosTheta);
+			next = ((2.0*n - 1.0)*cosTheta*current - (n - 1.0)*previous)/n;
+			previous = current;
+			current = next;
+			if(n % 2 == 0)
+				prob += m_constants[n/2]*current;
+		}
+		return prob;
+	}
+
+	/*
+		Integral of W from -1 to cos(theta), using int_{-1}^{x} P_n = (P_{n+1}(x) - P_{n-1}(x))/(2n + 1) for n > 0.
+		Only the odd polynomials P_1 ... P_{2L+1} are needed.
+	*/
+	double AngularDistribution::GetCumulativeProbability(double cosTheta) const
+	{
+		std::size_t nTerms = m_constants.size();
+		double prob = m_constants[0]*(cosTheta + 1.0);
+		double previous = 1.0;
+		double current = cosTheta;
+		double next;
+		std::size_t upper, lower;
+		for(std::size_t n=1; n<=2*nTerms - 1; n++)
+		{
+			if(n > 1)
+			{
+				next = ((2.0*n - 1.0)*cosTheta*current - (n - 1.0)*previous)/n;
+				previous = current;
+				current = next;
+			}
+			if(n % 2 == 0)
+				continue;
+
+			upper = (n - 1)/2; //Term i for which P_n = P_{2i+1}
+			lower = (n + 1)/2; //Term i for which P_n = P_{2i-1}
+			if(upper > 0)
+				prob += m_constants[upper]*current/(4.0*upper + 1.0);
+			if(lower < nTerms)
+				prob -= m_constants[lower]*current/(4.0*lower + 1.0);
 		}
 		return prob;
 	}
 
-}
\ No newline at end of file
+}
@@ -1,3 +1,11 @@
+/*
+	AngularDistribution.h
+	Decay angular distribution, given as a series of even Legendre polynomials W(cos(theta)) = sum_i a_i P_2i(cos(theta)).
+	cos(theta) is sampled by inverting the cumulative distribution, which is known analytically for a Legendre series.
+	In Tabulated mode the cumulative distribution is tabulated when the file is read, and each sample is one uniform number
+	and a table lookup. Exact mode solves for cos(theta) against the analytic cumulative distribution on every sample, and is
+	intended for validating the tabulated sampler. Both modes use the same uniform number, so they can be compared event by event.
+*/
 #ifndef ANGULARDISTRIBUTION_H
 #define ANGULARDISTRIBUTION_H
 
@@ -7,6 +15,30 @@
 
 namespace Mask {
 
+	enum class AngularSamplingMode
+	{
+		Exact, //Solve the analytic cumulative distribution for every sample
+		Tabulated //Interpolate the cumulative distribution tabulated at load
+	};
+
+	static AngularSamplingMode StringToAngularSamplingMode(const std::string& mode)
+	{
+		if(mode == "Exact")
+			return AngularSamplingMode::Exact;
+		else
+			return AngularSamplingMode::Tabulated;
+	}
+
+	static std::string AngularSamplingModeToString(AngularSamplingMode mode)
+	{
+		switch(mode)
+		{
+			case AngularSamplingMode::Exact: return "Exact";
+			case AngularSamplingMode::Tabulated: return "Tabulated";
+			default: return "Tabulated";
+		}
+	}
+
 	class AngularDistribution
 	{
 	public:
@@ -15,22 +47,46 @@ namespace Mask {
 		~AngularDistribution();
 		void ReadDistributionFile(const std::string& file);
 		double GetRandomCosTheta();
+		std::size_t GetNumberOfDimensions() const { return m_isIsotropic || m_isInvertible ? 1 : 3; } //Sobol dimensions of one GetRandomCosTheta
 		int GetL() { return m_L; }
 		double GetBranchingRatio() { return m_branchingRatio; }
-		double GetProbability(double cosTheta);
-	
+		double GetProbability(double cosTheta) const;
+		double GetCumulativeProbability(double cosTheta) const;
+		void SetSamplingMode(AngularSamplingMode mode) { m_samplingMode = mode; }
+		AngularSamplingMode GetSamplingMode() const { return m_samplingMode; }
+
 	private:
 		bool IsIsotropic() { return m_isIsotropic; }
-		
+		void SetDefault();
+		void BuildTable();
+		std::size_t FindSegment(double probability) const;
+		double InvertTabulated(double probability) const;
+		double InvertExact(double probability) const;
+		double SampleRejection();
+
 		std::uniform_real_distribution<double> m_uniformCosineDist;
 		std::uniform_real_distribution<double> m_uniformProbDist;
-	
+
 		double m_branchingRatio;
 		int m_L;
 		std::vector<double> m_constants;
 		bool m_isIsotropic;
+
+		AngularSamplingMode m_samplingMode;
+		//Cumulative distribution and distribution at s_nNodes evenly spaced cos(theta), from -1 to 1
+		std::vector<double> m_cdfValues;
+		std::vector<double> m_pdfValues;
+		std::vector<std::size_t> m_guide; //m_guide[k] is the segment containing cumulative probability k/(s_nNodes-1)
+		double m_maxProbability;
+		bool m_isInvertible; //False if W is negative somewhere; such distributions fall back to rejection sampling
+
+		static constexpr std::size_t s_nNodes = 257;
+		static constexpr int s_maxIterations = 8;
+		static constexpr int s_maxExactIterations = 100;
+		static constexpr double s_tolerance = 1.0e-12; //In the fractional position within a segment
+		static constexpr double s_exactTolerance = 1.0e-15; //In cos(theta)
 	};
 
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,158 @@
+/*
+	BeamEnergyLossMap.cpp
+	Precomputed energy loss of the beam on its way to the reaction point, as a function of the beam energy and the depth of the
+	reaction within the reaction layer (upstream layers included). See BeamEnergyLossMap.h for details.
+*/
+#include "BeamEnergyLossMap.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Mask {
+
+	/*
+		Cubic Hermite interpolation over n uniformly spaced values value(k), in the segment [index, index+1] at fractional
+		position t. Node slopes are central differences, one sided at the ends of the grid.
+	*/
+	template<typename Accessor>
+	static double UniformCubic(const Accessor& value, std::size_t n, std::size_t index, double t)
+	{
+		double y0 = value(index);
+		double y1 = value(index+1);
+		double m0 = index == 0 ? y1 - y0 : 0.5*(y1 - value(index-1));
+		double m1 = index+2 >= n ? y1 - y0 : 0.5*(value(index+2) - y0);
+		double t2 = t*t;
+		double t3 = t2*t;
+		return (2.0*t3 - 3.0*t2 + 1.0)*y0 + (t3 - 2.0*t2 + t)*m0 + (-2.0*t3 + 3.0*t2)*y1 + (t3 - t2)*m1;
+	}
+
+	BeamEnergyLossMap::BeamEnergyLossMap() :
+		m_energyMin(0.0), m_energyMax(0.0), m_energyStep(0.0), m_nEnergyNodes(0), m_isValid(false)
+	{
+	}
+
+	BeamEnergyLossMap::~BeamEnergyLossMap() {}
+
+	//Grid over a normal beam energy distribution: mean +/- s_energyWidth sigma, or a single row for a beam with no energy spread
+	void BeamEnergyLossMap::Build(const LayeredTarget& target, const Species& projectile, std::size_t rxnLayer, double meanEnergy, double sigmaEnergy)
+	{
+		if(sigmaEnergy > 0.0)
+			BuildRange(target, projectile, rxnLayer, std::max(meanEnergy - s_energyWidth*sigmaEnergy, 0.0), meanEnergy + s_energyWidth*sigmaEnergy);
+		else
+			BuildRange(target, projectile, rxnLayer, meanEnergy, meanEnergy);
+	}
+
+	/*
+		Tabulate the beam energy loss over the beam energies [energyMin, energyMax] and the reaction depth. A single beam energy
+		(energyMin == energyMax) only needs the depth dimension. The map is only valid where the interpolation agrees with the
+		direct calculation to within s_tolerance.
+	*/
+	void BeamEnergyLossMap::BuildRange(const LayeredTarget& target, const Species& projectile, std::size_t rxnLayer, double energyMin, double energyMax)
+	{
+		m_isValid = false;
+		if(rxnLayer >= target.GetNumberOfLayers() || energyMax < energyMin)
+			return;
+
+		if(energyMax > energyMin)
+		{
+			m_nEnergyNodes = s_nEnergyNodes;
+			m_energyMin = energyMin;
+			m_energyMax = energyMax;
+			m_energyStep = (m_energyMax - m_energyMin)/(m_nEnergyNodes - 1);
+		}
+		else
+		{
+			m_nEnergyNodes = 1;
+			m_energyMin = energyMin;
+			m_energyMax = energyMin;
+			m_energyStep = 0.0;
+		}
+
+		m_elosses.resize(m_nEnergyNodes*s_nDepthNodes);
+		double depthStep = 1.0/(s_nDepthNodes - 1);
+		double energy;
+		for(std::size_t i=0; i<m_nEnergyNodes; i++)
+		{
+			energy = (i == m_nEnergyNodes - 1) ? m_energyMax : m_energyMin + i*m_energyStep;
+			for(std::size_t j=0; j<s_nDepthNodes; j++)
+				m_elosses[i*s_nDepthNodes + j] = target.GetProjectileEnergyLoss(projectile, energy, rxnLayer, 0.0, j*depthStep);
+		}
+
+		/*
+			Check the interpolation against the direct calculation between the grid points. At low energies (near where the
+			beam stops in the target) the loss is too sharply curved to interpolate, so drop the energy rows below the highest
+			segment which fails the check; those beam energies fall back to the direct calculation. Dropping rows changes the
+			slopes of the new lowest segment, so it is checked again.
+		*/
+		m_isValid = true;
+		auto checkSegment = [&](std::size_t segment)
+		{
+			double direct, energy, depth;
+			for(std::size_t k=0; k<s_nChecks; k++)
+			{
+				energy = m_nEnergyNodes == 1 ? m_energyMin : m_energyMin + (segment + 0.5)*m_energyStep;
+				depth = m_nEnergyNodes == 1 ? (segment + (k + 0.5)/s_nChecks)*depthStep : (k + 0.5)/s_nChecks;
+				direct = target.GetProjectileEnergyLoss(projectile, energy, rxnLayer, 0.0, depth);
+				if(std::fabs(GetEnergyLoss(energy, depth) - direct) > s_tolerance*direct)
+					return false;
+			}
+			return true;
+		};
+
+		if(m_nEnergyNodes == 1)
+		{
+			for(std::size_t j=0; j<s_nDepthNodes-1; j++)
+			{
+				if(!checkSegment(j))
+				{
+					m_isValid = false;
+					return;
+				}
+			}
+			return;
+		}
+
+		std::size_t firstRow = 0;
+		for(std::size_t i=m_nEnergyNodes-1; i>0; i--)
+		{
+			if(!checkSegment(i-1))
+			{
+				firstRow = i;
+				break;
+			}
+		}
+
+		while(firstRow > 0)
+		{
+			if(firstRow > m_nEnergyNodes - 2)
+			{
+				m_isValid = false;
+				return;
+			}
+			m_elosses.erase(m_elosses.begin(), m_elosses.begin() + firstRow*s_nDepthNodes);
+			m_energyMin += firstRow*m_energyStep;
+			m_nEnergyNodes -= firstRow;
+			firstRow = checkSegment(0) ? 0 : 1;
+		}
+	}
+
+	double BeamEnergyLossMap::InterpolateDepth(std::size_t energyIndex, double rxnDepth) const
+	{
+		const double* row = &m_elosses[energyIndex*s_nDepthNodes];
+		double position = std::clamp(rxnDepth, 0.0, 1.0)*(s_nDepthNodes - 1);
+		std::size_t index = std::min(static_cast<std::size_t>(position), s_nDepthNodes - 2);
+		return UniformCubic([row](std::size_t k) { return row[k]; }, s_nDepthNodes, index, position - index);
+	}
+
+	//Energy lost (MeV) by the beam before reaching rxnDepth in the reaction layer. Requires IsEnergyInRange(beamEnergy).
+	double BeamEnergyLossMap::GetEnergyLoss(double beamEnergy, double rxnDepth) const
+	{
+		if(m_nEnergyNodes == 1)
+			return InterpolateDepth(0, rxnDepth);
+
+		double position = (beamEnergy - m_energyMin)/m_energyStep;
+		std::size_t index = std::min(static_cast<std::size_t>(position), m_nEnergyNodes - 2);
+		return UniformCubic([this, rxnDepth](std::size_t k) { return InterpolateDepth(k, rxnDepth); }, m_nEnergyNodes, index, position - index);
+	}
+
+}
@@ -0,0 +1,52 @@
+/*
+	BeamEnergyLossMap.h
+	Precomputed energy loss of the beam on its way to the reaction point, as a function of the beam energy and the depth of the
+	reaction within the reaction layer (upstream layers included). The grid spans the beam energy distribution of a system (the
+	mean +/- 6 sigma of a normal distribution, or the whole range of a tabulated one); for a monoenergetic beam it collapses to a
+	single row in depth. It is built once and shared read-only by the systems of every thread. Values between grid points are
+	given by cubic interpolation. Beam energies outside of the grid (including those where the interpolation is not accurate)
+	should be calculated with LayeredTarget::GetProjectileEnergyLoss.
+*/
+#ifndef BEAMENERGYLOSSMAP_H
+#define BEAMENERGYLOSSMAP_H
+
+#include "LayeredTarget.h"
+#include <vector>
+
+namespace Mask {
+
+	class BeamEnergyLossMap
+	{
+	public:
+		BeamEnergyLossMap();
+		~BeamEnergyLossMap();
+
+		void Build(const LayeredTarget& target, const Species& projectile, std::size_t rxnLayer, double meanEnergy, double sigmaEnergy);
+		void BuildRange(const LayeredTarget& target, const Species& projectile, std::size_t rxnLayer, double energyMin, double energyMax);
+
+		bool IsValid() const { return m_isValid; }
+		bool IsEnergyInRange(double energy) const
+		{
+			return m_isValid && (m_nEnergyNodes == 1 ? energy == m_energyMin : (energy >= m_energyMin && energy <= m_energyMax));
+		}
+		double GetEnergyLoss(double beamEnergy, double rxnDepth) const;
+
+	private:
+		double InterpolateDepth(std::size_t energyIndex, double rxnDepth) const;
+
+		double m_energyMin, m_energyMax, m_energyStep;
+		std::size_t m_nEnergyNodes;
+		std::vector<double> m_elosses; //m_nEnergyNodes rows of s_nDepthNodes
+
+		bool m_isValid;
+
+		static constexpr std::size_t s_nDepthNodes = 65;
+		static constexpr std::size_t s_nEnergyNodes = 129;
+		static constexpr double s_energyWidth = 6.0; //Grid spans the mean +/- this many sigma
+		static constexpr std::size_t s_nChecks = 16; //Points checked per grid segment when building
+		static constexpr double s_tolerance = 1.0e-4; //Relative, above the round-off of the range tables for thin layers
+	};
+
+}
+
+#endif
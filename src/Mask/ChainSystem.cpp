@@ -0,0 +1,319 @@
+#include "ChainSystem.h"
+#include "RandomGenerator.h"
+#include "KinematicsExceptions.h"
+
+#include <sstream>
+
+namespace Mask {
+
+	template<std::size_t N, bool ReactionFirst>
+	ChainSystem<N, ReactionFirst>::ChainSystem(const std::vector<StepParameters>& params) :
+		ReactionSystem()
+	{
+		Init(params);
+	}
+
+	template<std::size_t N, bool ReactionFirst>
+	ChainSystem<N, ReactionFirst>::~ChainSystem() {}
+
+	template<std::size_t N, bool ReactionFirst>
+	void ChainSystem<N, ReactionFirst>::Init(const std::vector<StepParameters>& params)
+	{
+		if(params.size() != N || params[0].rxnType != (ReactionFirst ? RxnType::Reaction : RxnType::Decay))
+		{
+			m_isValid = false;
+			std::cerr << "Invalid parameters at ChainSystem::Init(), does not match a " << N << " step chain starting with a "
+					  << (ReactionFirst ? "Reaction" : "Decay") << "!" << std::endl;
+			return;
+		}
+
+		std::size_t nReactants = ReactionFirst ? 3 : 2;
+		for(std::size_t i=0; i<N; i++)
+		{
+			if((i == 0 && (params[i].Z.size() != nReactants || params[i].A.size() != nReactants)) ||
+			   (i != 0 && (params[i].rxnType != RxnType::Decay || params[i].Z.size() != 2 || params[i].A.size() != 2)))
+			{
+				m_isValid = false;
+				std::cerr << "Invalid parameters at ChainSystem::Init(), step " << i + 1 << " is not a valid "
+						  << (i == 0 ? RxnTypeToString(params[0].rxnType) : "Decay") << "!" << std::endl;
+				return;
+			}
+		}
+
+		//Setup nuclei and the slots of each step
+		m_nuclei.resize(ReactionFirst ? 2*N + 2 : 2*N + 1);
+		int zr, ar;
+		if constexpr(ReactionFirst)
+		{
+			zr = params[0].Z[0] + params[0].Z[1] - params[0].Z[2];
+			ar = params[0].A[0] + params[0].A[1] - params[0].A[2];
+			m_nuclei[0] = CreateNucleus(params[0].Z[0], params[0].A[0]); //target
+			m_nuclei[1] = CreateNucleus(params[0].Z[1], params[0].A[1]); //projectile
+			m_nuclei[2] = CreateNucleus(params[0].Z[2], params[0].A[2]); //ejectile
+			m_nuclei[3] = CreateNucleus(zr, ar); //residual
+			m_slots[0] = {0, 1, 2, 3};
+		}
+		else
+		{
+			zr = params[0].Z[0] - params[0].Z[1];
+			ar = params[0].A[0] - params[0].A[1];
+			m_nuclei[0] = CreateNucleus(params[0].Z[0], params[0].A[0]); //parent
+			m_nuclei[1] = CreateNucleus(params[0].Z[1], params[0].A[1]); //breakup1
+			m_nuclei[2] = CreateNucleus(zr, ar); //breakup2
+			m_slots[0] = {0, 0, 1, 2};
+		}
+
+		for(std::size_t i=1; i<N; i++)
+		{
+			if(zr != params[i].Z[0] || ar != params[i].A[0])
+			{
+				m_isValid = false;
+				std::cerr << "Invalid parameters at ChainSystem::Init(), step " << i << " and step " << i + 1 << " are not sequential! Step "
+						  << i << " residual (Z,A): (" << zr << "," << ar << ") Step " << i + 1 << " target (Z,A): (" << params[i].Z[0] << ","
+						  << params[i].A[0] << ")" << std::endl;
+				return;
+			}
+			std::size_t residual = m_slots[i-1].residual;
+			std::size_t breakup1 = ReactionFirst ? 2*i + 2 : 2*i + 1;
+			zr = params[i].Z[0] - params[i].Z[1];
+			ar = params[i].A[0] - params[i].A[1];
+			m_nuclei[breakup1] = CreateNucleus(params[i].Z[1], params[i].A[1]); //breakup1
+			m_nuclei[breakup1 + 1] = CreateNucleus(zr, ar); //breakup2
+			m_slots[i] = {residual, residual, breakup1, breakup1 + 1};
+		}
+
+		for(std::size_t i=0; i<N; i++)
+		{
+			const ReactionSlots& slots = m_slots[i];
+			m_steps[i].BindNuclei(&(m_nuclei[slots.target]), IsDecayStep(i) ? nullptr : &(m_nuclei[slots.projectile]),
+								  &(m_nuclei[slots.ejectile]), &(m_nuclei[slots.residual]));
+		}
+		m_steps[N-1].SetResidualEnergyLoss(true);
+		SetSystemEquation();
+
+		//Sampling parameters of each step
+		for(std::size_t i=0; i<N; i++)
+		{
+			if(IsDecayStep(i))
+			{
+				AddPhiRange(params[i].phiMin, params[i].phiMax);
+				AddDecayAngularDistribution(params[i].angularDistFile);
+				AddExcitationDistribution(params[i].meanResidualEx, params[i].sigmaResidualEx, params[i].residualExFile);
+			}
+			else
+			{
+				AddBeamDistribution(params[i].meanBeamEnergy, params[i].sigmaBeamEnergy, params[i].beamEnergyFile);
+				m_steps[i].SetEjectileThetaType(params[i].thetaType);
+				AddThetaRange(params[i].thetaMin, params[i].thetaMax);
+				AddPhiRange(params[i].phiMin, params[i].phiMax);
+				FixReactionDirection(m_steps[i]);
+				AddExcitationDistribution(params[i].meanResidualEx, params[i].sigmaResidualEx, params[i].residualExFile);
+			}
+		}
+	}
+
+	template<std::size_t N, bool ReactionFirst>
+	void ChainSystem<N, ReactionFirst>::SetLayeredTarget(const LayeredTarget& target, const BeamEnergyLossMap* beamElossMap)
+	{
+		m_target = &target;
+		m_rxnLayer = m_target->FindLayerContaining(m_nuclei[0].Z, m_nuclei[0].A);
+		if(m_rxnLayer != m_target->GetNumberOfLayers())
+		{
+			for(auto& step : m_steps)
+			{
+				step.SetLayeredTarget(m_target);
+				step.SetRxnLayer(m_rxnLayer);
+			}
+			if constexpr(ReactionFirst)
+				m_steps[0].SetBeamEnergyLossMap(beamElossMap);
+			m_isTargetSet = true;
+		}
+		else
+			throw ReactionLayerException();
+	}
+
+	template<std::size_t N, bool ReactionFirst>
+	void ChainSystem<N, ReactionFirst>::SetSystemEquation()
+	{
+		std::stringstream stream;
+		if constexpr(ReactionFirst)
+		{
+			stream << m_nuclei[0].isotopicSymbol << "("
+				   << m_nuclei[1].isotopicSymbol << ", "
+				   << m_nuclei[2].isotopicSymbol << ")"
+				   << m_nuclei[3].isotopicSymbol;
+		}
+		else
+			stream << m_nuclei[0].isotopicSymbol;
+
+		for(std::size_t i=(ReactionFirst ? 1 : 0); i<N; i++)
+		{
+			stream << "->"
+				   << m_nuclei[m_slots[i].ejectile].isotopicSymbol << "+"
+				   << m_nuclei[m_slots[i].residual].isotopicSymbol;
+		}
+		m_sysEquation = stream.str();
+	}
+
+	template<std::size_t N, bool ReactionFirst>
+	ChainParameters<N> ChainSystem<N, ReactionFirst>::SampleParameters()
+	{
+		ChainParameters<N> params;
+		if constexpr(ReactionFirst)
+			SampleDirection(0, m_thetaRanges[0], m_phiRanges[0], params.cosTheta[0], params.phi[0]);
+		else
+			SampleDirection(0, m_decayAngularDistributions[0], m_phiRanges[0], params.cosTheta[0], params.phi[0]);
+		for(std::size_t i=1; i<N; i++)
+			SampleDirection(i, m_decayAngularDistributions[GetDecayIndex(i)], m_phiRanges[i], params.cosTheta[i], params.phi[i]);
+		for(std::size_t i=0; i<N; i++)
+			params.theta[i] = std::acos(params.cosTheta[i]);
+		params.rxnDepth = SampleDepth();
+		StartExcitations();
+		while(!SampleExcitations(params))
+			RedrawExcitations();
+		return params;
+	}
+
+	//Beam energy and excitations, each excitation truncated to the region allowed by the step before it
+	template<std::size_t N, bool ReactionFirst>
+	bool ChainSystem<N, ReactionFirst>::SampleExcitations(ChainParameters<N>& params)
+	{
+		//Nothing random about the limit of a decay from the ground state, so redrawing can not help; the step fails with a
+		//NegativeQValue status instead
+		if constexpr(ReactionFirst)
+		{
+			params.beamEnergy = SampleBeamEnergy();
+			if(!SampleExcitation(0, m_steps[0].GetReactionExcitationLimit(params.beamEnergy), params.ex[0]))
+				return false;
+		}
+		else
+			SampleExcitation(0, m_steps[0].GetDecayExcitationLimit(0.0), params.ex[0]);
+
+		for(std::size_t i=1; i<N; i++)
+		{
+			if(!SampleExcitation(i, m_steps[i].GetDecayExcitationLimit(params.ex[i-1]), params.ex[i]))
+				return false;
+		}
+		return true;
+	}
+
+	template<std::size_t N, bool ReactionFirst>
+	ReactionStatus ChainSystem<N, ReactionFirst>::RunSystem()
+	{
+		ChainParameters<N> params = SampleParameters();
+
+		for(std::size_t i=0; i<N; i++)
+		{
+			m_steps[i].SetReactionDepth(params.rxnDepth);
+			m_steps[i].SetPolarRxnAngle(params.theta[i]);
+			m_steps[i].SetAzimRxnAngle(params.phi[i]);
+			m_steps[i].SetExcitation(params.ex[i]);
+		}
+		if constexpr(ReactionFirst)
+			m_steps[0].SetBeamKE(params.beamEnergy);
+
+		//A decay which did not happen (branching ratio) leaves its products, and everything after it, at rest. A reaction
+		//first step always happens
+		for(std::size_t i=0; i<N; i++)
+		{
+			if((i != 0 || !ReactionFirst) && params.cosTheta[i] == -10)
+			{
+				for(std::size_t j=i; j<N; j++)
+				{
+					Nucleus& breakup1 = m_nuclei[m_slots[j].ejectile];
+					Nucleus& breakup2 = m_nuclei[m_slots[j].residual];
+					breakup1.vec4.SetPxPyPzE(0., 0., 0., breakup1.groundStateMass);
+					breakup2.vec4.SetPxPyPzE(0., 0., 0., breakup2.groundStateMass);
+				}
+				return ReactionStatus::Success;
+			}
+			ReactionStatus status = m_steps[i].Calculate();
+			if(status != ReactionStatus::Success)
+				return status;
+		}
+		return ReactionStatus::Success;
+	}
+
+	//Parameters are sampled event by event (each event has its own random stream), then the kinematics run over the whole batch
+	template<std::size_t N, bool ReactionFirst>
+	void ChainSystem<N, ReactionFirst>::RunBatch(EventBatch& batch, uint64_t firstEvent, std::size_t size)
+	{
+		batch.Resize(m_nuclei.size(), size);
+		batch.SetFirstEvent(firstEvent);
+		m_stepColumns.resize(N);
+		for(auto& step : m_stepColumns)
+			step.Resize(size);
+
+		ChainParameters<N> params;
+		for(std::size_t i=0; i<size; i++)
+		{
+			StartEvent(firstEvent + i);
+			params = SampleParameters();
+			batch.SetWeight(i, m_eventWeight);
+			bool isActive = true;
+			for(std::size_t j=0; j<N; j++)
+			{
+				StepColumns& step = m_stepColumns[j];
+				step.beamEnergy[i] = params.beamEnergy;
+				step.theta[i] = params.theta[j];
+				step.phi[i] = params.phi[j];
+				step.ex[i] = params.ex[j];
+				step.rxnDepth[i] = params.rxnDepth;
+				isActive = isActive && ((j == 0 && ReactionFirst) || params.cosTheta[j] != -10);
+				step.isActive[i] = isActive;
+			}
+			if constexpr(!ReactionFirst)
+				batch.SetAtRest(0, i, m_nuclei[0].groundStateMass);
+		}
+
+		for(std::size_t i=0; i<N; i++)
+			m_steps[i].CalculateBatch(batch, m_slots[i], m_stepColumns[i]);
+		CountStatus(batch);
+	}
+
+	template class ChainSystem<1, true>;
+	template class ChainSystem<2, true>;
+	template class ChainSystem<3, true>;
+	template class ChainSystem<4, true>;
+	template class ChainSystem<5, true>;
+	template class ChainSystem<6, true>;
+	template class ChainSystem<7, true>;
+	template class ChainSystem<8, true>;
+	template class ChainSystem<1, false>;
+	template class ChainSystem<2, false>;
+	template class ChainSystem<3, false>;
+	template class ChainSystem<4, false>;
+	template class ChainSystem<5, false>;
+	template class ChainSystem<6, false>;
+	template class ChainSystem<7, false>;
+	template class ChainSystem<8, false>;
+
+	template<bool ReactionFirst>
+	static ReactionSystem* CreateChainExecutor(const std::vector<StepParameters>& params)
+	{
+		switch(params.size())
+		{
+			case 1: return new ChainSystem<1, ReactionFirst>(params);
+			case 2: return new ChainSystem<2, ReactionFirst>(params);
+			case 3: return new ChainSystem<3, ReactionFirst>(params);
+			case 4: return new ChainSystem<4, ReactionFirst>(params);
+			case 5: return new ChainSystem<5, ReactionFirst>(params);
+			case 6: return new ChainSystem<6, ReactionFirst>(params);
+			case 7: return new ChainSystem<7, ReactionFirst>(params);
+			case 8: return new ChainSystem<8, ReactionFirst>(params);
+		}
+
+		std::cerr << "Reaction chains are limited to " << maxChainSteps << " steps; given " << params.size() << std::endl;
+		return nullptr;
+	}
+
+	//Instantiate the executor for the length of the chain and the kind of its first step
+	ReactionSystem* CreateChainSystem(const std::vector<StepParameters>& params)
+	{
+		if(!params.empty() && params[0].rxnType == RxnType::Reaction)
+			return CreateChainExecutor<true>(params);
+		else
+			return CreateChainExecutor<false>(params);
+	}
+
+}
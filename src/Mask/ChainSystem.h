@@ -0,0 +1,63 @@
+/*
+	ChainSystem.h
+	A reaction chain of any length, built from the ReactionChain of the configuration. The first step is either a Reaction or a Decay;
+	every following step is the decay of the residual (heavy) nucleus of the step before it. The executor is a template on the
+	number of steps and on the kind of the first step, so the per-step loops have a compile-time trip count (and unroll), the
+	per-step state lives in fixed-size arrays, and whether a step is a reaction or a decay is never tested per event: the first
+	step is handled with if constexpr and every later step is a decay. CreateChainSystem instantiates the executor matching the
+	chain, up to maxChainSteps steps.
+
+	Nucleus slots: a Reaction first step uses target (0), projectile (1), ejectile (2) and residual (3), and step k > 0 adds its
+	breakup1 (light) and breakup2 (heavy) at 2k + 2 and 2k + 3. A Decay first step uses parent (0), breakup1 (1) and breakup2 (2),
+	and step k > 0 adds its products at 2k + 1 and 2k + 2. Only the residual of the final step has its energy loss calculated;
+	every other residual decays inside the target.
+*/
+#ifndef CHAINSYSTEM_H
+#define CHAINSYSTEM_H
+
+#include "ReactionSystem.h"
+#include <array>
+
+namespace Mask {
+
+	constexpr std::size_t maxChainSteps = 8; //Longest chain CreateChainSystem instantiates an executor for
+
+	template<std::size_t N>
+	struct ChainParameters
+	{
+		double beamEnergy = 0.;
+		std::array<double, N> cosTheta = {};
+		std::array<double, N> theta = {};
+		std::array<double, N> phi = {};
+		std::array<double, N> ex = {};
+		double rxnDepth = 0.;
+	};
+
+	template<std::size_t N, bool ReactionFirst>
+	class ChainSystem : public ReactionSystem
+	{
+	public:
+		ChainSystem(const std::vector<StepParameters>& params);
+		~ChainSystem();
+
+		virtual void SetLayeredTarget(const LayeredTarget& target, const BeamEnergyLossMap* beamElossMap) override;
+		virtual ReactionStatus RunSystem() override;
+		virtual void RunBatch(EventBatch& batch, uint64_t firstEvent, std::size_t size) override;
+
+	private:
+		void Init(const std::vector<StepParameters>& params);
+		void SetSystemEquation() override;
+		ChainParameters<N> SampleParameters();
+		bool SampleExcitations(ChainParameters<N>& params);
+		static constexpr bool IsDecayStep(std::size_t step) { return step != 0 || !ReactionFirst; }
+		static constexpr std::size_t GetDecayIndex(std::size_t step) { return ReactionFirst ? step - 1 : step; } //Of a decay step
+
+		std::array<Reaction, N> m_steps;
+		std::array<ReactionSlots, N> m_slots;
+	};
+
+	ReactionSystem* CreateChainSystem(const std::vector<StepParameters>& params);
+
+}
+
+#endif
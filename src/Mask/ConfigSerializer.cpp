@@ -1,9 +1,22 @@
 #include "ConfigSerializer.h"
 #include "yaml-cpp/yaml.h"
 #include "RxnType.h"
+#include "RandomGenerator.h"
 
 namespace Mask {
 
+    //Optional: a tabulated excitation distribution, in which case the mean and sigma may be omitted
+    static void ReadExcitationDistribution(YAML::Node& yamlStream, StepParameters& params)
+    {
+        if(yamlStream["ResidualExcitationFile"])
+            params.residualExFile = yamlStream["ResidualExcitationFile"].as<std::string>();
+        if(params.residualExFile.empty() || yamlStream["ResidualExcitationMean(MeV)"])
+        {
+            params.meanResidualEx = yamlStream["ResidualExcitationMean(MeV)"].as<double>();
+            params.sigmaResidualEx = yamlStream["ResidualExcitationSigma(MeV)"].as<double>();
+        }
+    }
+
     static void SerializeDecay(YAML::Emitter& yamlStream, const StepParameters& params)
     {
         yamlStream << YAML::BeginMap;
@@ -21,6 +34,8 @@ namespace Mask {
         yamlStream << YAML::Key << "PhiMax(deg)" << YAML::Value << params.phiMax;
         yamlStream << YAML::Key << "ResidualExcitationMean(MeV)" << YAML::Value << params.meanResidualEx;
         yamlStream << YAML::Key << "ResidualExcitationSigma(MeV)" << YAML::Value << params.sigmaResidualEx;
+        if(!params.residualExFile.empty())
+            yamlStream << YAML::Key << "ResidualExcitationFile" << YAML::Value << params.residualExFile;
 		yamlStream << YAML::Key << "AngularDistributionFile" << YAML::Value << params.angularDistFile;
 		yamlStream << YAML::EndMap;
     }
@@ -37,12 +52,57 @@ namespace Mask {
         }
         params.phiMin = yamlStream["PhiMin(deg)"].as<double>();
         params.phiMax = yamlStream["PhiMax(deg)"].as<double>();
-        params.meanResidualEx = yamlStream["ResidualExcitationMean(MeV)"].as<double>();
-        params.sigmaResidualEx = yamlStream["ResidualExcitationSigma(MeV)"].as<double>();
+        ReadExcitationDistribution(yamlStream, params);
         params.angularDistFile = yamlStream["AngularDistributionFile"].as<std::string>();
         return params;
     }
 
+    static void SerializePhaseSpace(YAML::Emitter& yamlStream, const StepParameters& params)
+    {
+        yamlStream << YAML::BeginMap;
+        yamlStream << YAML::Key << "Type" << RxnTypeToString(params.rxnType);
+        yamlStream << YAML::Key << "Reactants" << YAML::Value << YAML::BeginSeq;
+        for (std::size_t i=0; i<params.Z.size(); i++)
+        {
+            yamlStream << YAML::BeginMap;
+            yamlStream << YAML::Key << "Z" << YAML::Value << params.Z[i];
+            yamlStream << YAML::Key << "A" << YAML::Value << params.A[i];
+            yamlStream << YAML::EndMap;
+        }
+        yamlStream << YAML::EndSeq;
+        yamlStream << YAML::Key << "PhaseSpaceMode" << YAML::Value << PhaseSpaceModeToString(params.phaseSpaceMode);
+        yamlStream << YAML::Key << "ParentExcitationMean(MeV)" << YAML::Value << params.meanResidualEx;
+        yamlStream << YAML::Key << "ParentExcitationSigma(MeV)" << YAML::Value << params.sigmaResidualEx;
+        if(!params.residualExFile.empty())
+            yamlStream << YAML::Key << "ParentExcitationFile" << YAML::Value << params.residualExFile;
+        yamlStream << YAML::EndMap;
+    }
+
+    static StepParameters DeserializePhaseSpace(YAML::Node& yamlStream)
+    {
+        StepParameters params;
+        params.rxnType = StringToRxnType(yamlStream["Type"].as<std::string>());
+        YAML::Node nuclei = yamlStream["Reactants"];
+        for(auto nucleus : nuclei)
+        {
+            params.Z.push_back(nucleus["Z"].as<int>());
+            params.A.push_back(nucleus["A"].as<int>());
+        }
+        //Optional, defaults to Weighted
+        if(yamlStream["PhaseSpaceMode"])
+            params.phaseSpaceMode = StringToPhaseSpaceMode(yamlStream["PhaseSpaceMode"].as<std::string>());
+        //Optional, defaults to 0. Only used when the parent is at rest (no reaction before the breakup)
+        params.meanResidualEx = 0.0;
+        params.sigmaResidualEx = 0.0;
+        if(yamlStream["ParentExcitationFile"])
+            params.residualExFile = yamlStream["ParentExcitationFile"].as<std::string>();
+        if(yamlStream["ParentExcitationMean(MeV)"])
+            params.meanResidualEx = yamlStream["ParentExcitationMean(MeV)"].as<double>();
+        if(yamlStream["ParentExcitationSigma(MeV)"])
+            params.sigmaResidualEx = yamlStream["ParentExcitationSigma(MeV)"].as<double>();
+        return params;
+    }
+
     static void SerializeReaction(YAML::Emitter& yamlStream, const StepParameters& params)
     {
         yamlStream << YAML::BeginMap;
@@ -58,6 +118,8 @@ namespace Mask {
 		yamlStream << YAML::EndSeq;
         yamlStream << YAML::Key << "BeamEnergyMean(MeV)" << YAML::Value << params.meanBeamEnergy;
         yamlStream << YAML::Key << "BeamEnergySigma(MeV)" << YAML::Value << params.sigmaBeamEnergy;
+        if(!params.beamEnergyFile.empty())
+            yamlStream << YAML::Key << "BeamEnergyFile" << YAML::Value << params.beamEnergyFile;
         yamlStream << YAML::Key << "ThetaType" << YAML::Value << RxnThetaTypeToString(params.thetaType);
         yamlStream << YAML::Key << "ThetaMin(deg)" << YAML::Value << params.thetaMin;
         yamlStream << YAML::Key << "ThetaMax(deg)" << YAML::Value << params.thetaMax;
@@ -65,6 +127,8 @@ namespace Mask {
         yamlStream << YAML::Key << "PhiMax(deg)" << YAML::Value << params.phiMax;
         yamlStream << YAML::Key << "ResidualExcitationMean(MeV)" << YAML::Value << params.meanResidualEx;
         yamlStream << YAML::Key << "ResidualExcitationSigma(MeV)" << YAML::Value << params.sigmaResidualEx;
+        if(!params.residualExFile.empty())
+            yamlStream << YAML::Key << "ResidualExcitationFile" << YAML::Value << params.residualExFile;
 		yamlStream << YAML::EndMap;
     }
 
@@ -78,15 +142,20 @@ namespace Mask {
             params.Z.push_back(nucleus["Z"].as<int>());
             params.A.push_back(nucleus["A"].as<int>());
         }
-        params.meanBeamEnergy = yamlStream["BeamEnergyMean(MeV)"].as<double>();
-        params.sigmaBeamEnergy = yamlStream["BeamEnergySigma(MeV)"].as<double>();
+        //Optional: a tabulated beam energy distribution, in which case the mean and sigma may be omitted
+        if(yamlStream["BeamEnergyFile"])
+            params.beamEnergyFile = yamlStream["BeamEnergyFile"].as<std::string>();
+        if(params.beamEnergyFile.empty() || yamlStream["BeamEnergyMean(MeV)"])
+        {
+            params.meanBeamEnergy = yamlStream["BeamEnergyMean(MeV)"].as<double>();
+            params.sigmaBeamEnergy = yamlStream["BeamEnergySigma(MeV)"].as<double>();
+        }
         params.thetaType = StringToRxnThetaType(yamlStream["ThetaType"].as<std::string>());
         params.thetaMin = yamlStream["ThetaMin(deg)"].as<double>();
         params.thetaMax = yamlStream["ThetaMax(deg)"].as<double>();
         params.phiMin = yamlStream["PhiMin(deg)"].as<double>();
         params.phiMax = yamlStream["PhiMax(deg)"].as<double>();
-        params.meanResidualEx = yamlStream["ResidualExcitationMean(MeV)"].as<double>();
-        params.sigmaResidualEx = yamlStream["ResidualExcitationSigma(MeV)"].as<double>();
+        ReadExcitationDistribution(yamlStream, params);
         return params;
     }
 
@@ -114,7 +183,7 @@ namespace Mask {
         yamlStream << YAML::EndSeq;
     }
 
-    static LayeredTarget DeserializeTarget(YAML::Node& yamlStream)
+    LayeredTarget ConfigSerializer::DeserializeTarget(YAML::Node yamlStream)
     {
         LayeredTarget target;
         std::vector<int> z, a, s;
@@ -152,6 +221,8 @@ namespace Mask {
 		yamlStream << YAML::BeginMap;
 		yamlStream << YAML::Key << "OutputFile" << YAML::Value << params.outputFileName;
 		yamlStream << YAML::Key << "Threads" << YAML::Value << params.nThreads;
+		yamlStream << YAML::Key << "Seed" << YAML::Value << params.seed;
+		yamlStream << YAML::Key << "SamplingMode" << YAML::Value << SamplingModeToString(params.samplingMode);
 		yamlStream << YAML::Key << "ReactionSamples" << YAML::Value << params.nSamples;
 		yamlStream << YAML::Key << "ReactionChain" << YAML::Value << YAML::BeginSeq;
 		for (auto& step : params.chainParams)
@@ -160,6 +231,7 @@ namespace Mask {
             {
                 case RxnType::Reaction: SerializeReaction(yamlStream, step); break;
                 case RxnType::Decay: SerializeDecay(yamlStream, step); break;
+                case RxnType::PhaseSpace: SerializePhaseSpace(yamlStream, step); break;
                 case RxnType::None:
                 {
                     std::cerr << "Error serializing config: none type reaction found!" << std::endl;
@@ -170,6 +242,23 @@ namespace Mask {
         yamlStream << YAML::EndSeq;
         yamlStream << YAML::Key << "TargetLayers" << YAML::Value;
         SerializeTarget(yamlStream, params.target);
+        yamlStream << YAML::Key << "EnergyLossMode" << YAML::Value << EnergyLossModeToString(params.target.GetEnergyLossMode());
+        if(!params.target.GetEnergyLossCacheDirectory().empty())
+            yamlStream << YAML::Key << "EnergyLossCacheDirectory" << YAML::Value << params.target.GetEnergyLossCacheDirectory();
+        yamlStream << YAML::Key << "AngularSamplingMode" << YAML::Value << AngularSamplingModeToString(params.angularSamplingMode);
+        yamlStream << YAML::Key << "BatchSize" << YAML::Value << params.batchSize;
+        yamlStream << YAML::Key << "WriterMode" << YAML::Value << WriterModeToString(params.writerMode);
+        if(params.writerMode == WriterMode::Shards)
+            yamlStream << YAML::Key << "MergeShards" << YAML::Value << params.mergeShards;
+        yamlStream << YAML::Key << "WriterQueueCapacity" << YAML::Value << params.writerQueueCapacity;
+        if(params.writerQueueMemory > 0.0)
+            yamlStream << YAML::Key << "WriterQueueMemory(MB)" << YAML::Value << params.writerQueueMemory;
+        if(!params.acceptanceMapFile.empty())
+        {
+            yamlStream << YAML::Key << "AcceptanceMapFile" << YAML::Value << params.acceptanceMapFile;
+            yamlStream << YAML::Key << "AcceptanceBiasStep" << YAML::Value << params.acceptanceBiasStep;
+            yamlStream << YAML::Key << "AcceptanceBiasFloor" << YAML::Value << params.acceptanceBiasFloor;
+        }
 
         output << yamlStream.c_str();
         output.close();
@@ -191,6 +280,14 @@ namespace Mask {
 
         params.outputFileName = data["OutputFile"].as<std::string>();
         params.nThreads = data["Threads"].as<uint32_t>();
+        //Optional, if not given a seed is drawn at random (and reported, so that the run can be repeated)
+        if(data["Seed"])
+            params.seed = data["Seed"].as<uint64_t>();
+        else
+            params.seed = RandomGenerator::GenerateSeed();
+        //Optional, defaults to PseudoRandom. Sobol draws the parameters of each event from a scrambled Sobol sequence
+        if(data["SamplingMode"])
+            params.samplingMode = StringToSamplingMode(data["SamplingMode"].as<std::string>());
         params.nSamples = data["ReactionSamples"].as<uint64_t>();
 
         auto steps = data["ReactionChain"];
@@ -209,6 +306,11 @@ namespace Mask {
                     params.chainParams.push_back(DeserializeReaction(step));
                     break;
                 }
+                case RxnType::PhaseSpace:
+                {
+                    params.chainParams.push_back(DeserializePhaseSpace(step));
+                    break;
+                }
                 case RxnType::None:
                 {
                     std::cerr << "Error deserializing config: None-type reaction found" << std::endl;
@@ -218,6 +320,40 @@ namespace Mask {
         }
         auto layers = data["TargetLayers"];
         params.target = DeserializeTarget(layers);
+        //Optional, defaults to Tabulated. Exact runs the full catima integration for every energy loss
+        if(data["EnergyLossMode"])
+            params.target.SetEnergyLossMode(StringToEnergyLossMode(data["EnergyLossMode"].as<std::string>()));
+        //Optional, if given tabulated energy loss tables are stored in (and loaded from) this directory
+        if(data["EnergyLossCacheDirectory"])
+            params.target.SetEnergyLossCacheDirectory(data["EnergyLossCacheDirectory"].as<std::string>());
+        //Optional, defaults to Tabulated. Exact solves for every decay angle, for validating the tabulated sampler
+        if(data["AngularSamplingMode"])
+            params.angularSamplingMode = StringToAngularSamplingMode(data["AngularSamplingMode"].as<std::string>());
+        //Optional, defaults to 256. 0 runs the scalar kinematics, for validating the batched kinematics
+        if(data["BatchSize"])
+            params.batchSize = data["BatchSize"].as<uint32_t>();
+        //Optional, defaults to Queue. Shards has each thread write its own file; with MergeShards (default false) they are merged at the end.
+        //BufferMerger has each thread fill a buffer which is merged into the output file as the run goes
+        if(data["WriterMode"])
+            params.writerMode = StringToWriterMode(data["WriterMode"].as<std::string>());
+        if(data["MergeShards"])
+            params.mergeShards = data["MergeShards"].as<bool>();
+        //Optional, defaults to 65536. Workers wait for the writer once this many events are queued (rounded up to a power of two)
+        if(data["WriterQueueCapacity"])
+            params.writerQueueCapacity = data["WriterQueueCapacity"].as<uint64_t>();
+        //Optional, if given the queue capacity is further limited so the queued events take at most this much memory
+        if(data["WriterQueueMemory(MB)"])
+            params.writerQueueMemory = data["WriterQueueMemory(MB)"].as<double>();
+        //Optional, if given the angles of AcceptanceBiasStep (default 1, a reaction with ThetaType Lab) are biased towards the acceptance of a detector array
+        //and each event is weighted. AcceptanceBiasFloor (default 0.01) is the probability of keeping a direction outside of it
+        if(data["AcceptanceMapFile"])
+        {
+            params.acceptanceMapFile = data["AcceptanceMapFile"].as<std::string>();
+            if(data["AcceptanceBiasStep"])
+                params.acceptanceBiasStep = data["AcceptanceBiasStep"].as<uint32_t>();
+            if(data["AcceptanceBiasFloor"])
+                params.acceptanceBiasFloor = data["AcceptanceBiasFloor"].as<double>();
+        }
         return true;
     }
 }
\ No newline at end of file
@@ -3,6 +3,10 @@
 
 #include "MaskApp.h"
 
+namespace YAML {
+    class Node;
+}
+
 namespace Mask {
 
     class ConfigSerializer
@@ -10,6 +14,7 @@ namespace Mask {
     public:
         static bool SerializeConfig(const std::string& configfile, const AppParameters& params);
         static bool DeserializeConfig(const std::string& configfile, AppParameters& params);
+        static LayeredTarget DeserializeTarget(YAML::Node yamlStream); //A TargetLayers sequence, as in the kinematics config
     };
 }
 
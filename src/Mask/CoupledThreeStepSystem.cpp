@@ -69,33 +69,35 @@ namespace Mask {
 		SetSystemEquation();
 
 		//Step one sampling parameters
-		AddBeamDistribution(step1Params.meanBeamEnergy, step1Params.sigmaBeamEnergy);
+		AddBeamDistribution(step1Params.meanBeamEnergy, step1Params.sigmaBeamEnergy, step1Params.beamEnergyFile);
 		m_step1.SetEjectileThetaType(step1Params.thetaType);
 		AddThetaRange(step1Params.thetaMin, step1Params.thetaMax);
 		AddPhiRange(step1Params.phiMin, step1Params.phiMax);
-		AddExcitationDistribution(step1Params.meanResidualEx, step1Params.sigmaResidualEx);
+		FixReactionDirection(m_step1);
+		AddExcitationDistribution(step1Params.meanResidualEx, step1Params.sigmaResidualEx, step1Params.residualExFile);
 
 		//Step two sampling parameters
 		AddPhiRange(step2Params.phiMin, step2Params.phiMax);
 		AddDecayAngularDistribution(step2Params.angularDistFile);
-		AddExcitationDistribution(step2Params.meanResidualEx, step2Params.sigmaResidualEx);
+		AddExcitationDistribution(step2Params.meanResidualEx, step2Params.sigmaResidualEx, step2Params.residualExFile);
 
 		//Step three sampling parameters
 		AddPhiRange(step3Params.phiMin, step3Params.phiMax);
 		AddDecayAngularDistribution(step3Params.angularDistFile);
-		AddExcitationDistribution(step3Params.meanResidualEx, step3Params.sigmaResidualEx);
+		AddExcitationDistribution(step3Params.meanResidualEx, step3Params.sigmaResidualEx, step3Params.residualExFile);
 	}
 
-	void CoupledThreeStepSystem::SetLayeredTarget(const LayeredTarget& target)
+	void CoupledThreeStepSystem::SetLayeredTarget(const LayeredTarget& target, const BeamEnergyLossMap* beamElossMap)
 	{
-		m_target = target;
-		m_rxnLayer = m_target.FindLayerContaining(m_nuclei[0].Z, m_nuclei[0].A);
-		if(m_rxnLayer != m_target.GetNumberOfLayers())
+		m_target = &target;
+		m_rxnLayer = m_target->FindLayerContaining(m_nuclei[0].Z, m_nuclei[0].A);
+		if(m_rxnLayer != m_target->GetNumberOfLayers())
 		{
-			m_step1.SetLayeredTarget(&m_target);
-			m_step2.SetLayeredTarget(&m_target);
-			m_step3.SetLayeredTarget(&m_target);
+			m_step1.SetLayeredTarget(m_target);
+			m_step2.SetLayeredTarget(m_target);
+			m_step3.SetLayeredTarget(m_target);
 			m_step1.SetRxnLayer(m_rxnLayer);
+			m_step1.SetBeamEnergyLossMap(beamElossMap);
 			m_step2.SetRxnLayer(m_rxnLayer);
 			m_step3.SetRxnLayer(m_rxnLayer);
 			m_isTargetSet = true;
@@ -121,21 +123,30 @@ namespace Mask {
 	CoupledThreeStepParameters CoupledThreeStepSystem::SampleParameters()
 	{
 		CoupledThreeStepParameters params;
-		std::mt19937& gen = RandomGenerator::GetInstance().GetGenerator();
-		params.beamEnergy = m_beamDistributions[0](gen);
-		params.rxnTheta = std::acos((m_thetaRanges[0])(gen));
-		params.rxnPhi = m_phiRanges[0](gen);
-		params.cosdecay1Theta = m_decayAngularDistributions[0].GetRandomCosTheta();
+		RandomGenerator& rng = RandomGenerator::GetInstance();
+		double cosTheta;
+		SampleDirection(0, m_thetaRanges[0], m_phiRanges[0], cosTheta, params.rxnPhi);
+		params.rxnTheta = std::acos(cosTheta);
+		SampleDirection(1, m_decayAngularDistributions[0], m_phiRanges[1], params.cosdecay1Theta, params.decay1Phi);
+		rng.SetDimension(ReserveDimensions(m_decayAngularDistributions[1].GetNumberOfDimensions()));
         params.cosRelativeAngle = m_decayAngularDistributions[1].GetRandomCosTheta();
 		params.decay1Theta = std::acos(params.cosdecay1Theta);
-		params.decay1Phi = m_phiRanges[1](gen);
-		params.residEx = m_exDistributions[0](gen);
-		params.decay1Ex = m_exDistributions[1](gen);
-		params.decay2Ex = m_exDistributions[2](gen);
-		params.rxnDepth = (m_rxnDepthDist(gen));
+		params.rxnDepth = SampleDepth();
+		StartExcitations();
+		while(!SampleExcitations(params))
+			RedrawExcitations();
 		return params;
 	}
 
+	//Beam energy and excitations, each excitation truncated to the region allowed by the step before it
+	bool CoupledThreeStepSystem::SampleExcitations(CoupledThreeStepParameters& params)
+	{
+		params.beamEnergy = SampleBeamEnergy();
+		return SampleExcitation(0, m_step1.GetReactionExcitationLimit(params.beamEnergy), params.residEx) &&
+			   SampleExcitation(1, m_step2.GetDecayExcitationLimit(params.residEx), params.decay1Ex) &&
+			   SampleExcitation(2, m_step3.GetDecayExcitationLimit(params.decay1Ex), params.decay2Ex);
+	}
+
     //Called after running step2
     void CoupledThreeStepSystem::SampleCoupling(CoupledThreeStepParameters& params)
     {
@@ -161,16 +172,10 @@ namespace Mask {
 		params.decay2Phi = a2PVec.Phi();
     }
 	
-	void CoupledThreeStepSystem::RunSystem()
+	ReactionStatus CoupledThreeStepSystem::RunSystem()
 	{
-		CoupledThreeStepParameters params;
-		do
-		{
-			params = SampleParameters();
-		}
-		while(!(m_step1.CheckReactionThreshold(params.beamEnergy, params.residEx) 
-				&& m_step2.CheckDecayThreshold(params.residEx, params.decay1Ex)
-				&& m_step3.CheckDecayThreshold(params.decay1Ex, params.decay2Ex)));
+		ReactionStatus status;
+		CoupledThreeStepParameters params = SampleParameters();
 		
 		m_step1.SetReactionDepth(params.rxnDepth);
 		m_step1.SetBeamKE(params.beamEnergy);
@@ -187,7 +192,9 @@ namespace Mask {
 		
 		m_step3.SetExcitation(params.decay2Ex);
 	
-		m_step1.Calculate();
+		status = m_step1.Calculate();
+		if(status != ReactionStatus::Success)
+			return status;
 	
 		if(params.cosdecay1Theta == -10)
 		{
@@ -195,9 +202,11 @@ namespace Mask {
 			m_nuclei[5].vec4.SetPxPyPzE(0., 0., 0., m_nuclei[5].groundStateMass);
 			m_nuclei[6].vec4.SetPxPyPzE(0., 0., 0., m_nuclei[6].groundStateMass);
 			m_nuclei[7].vec4.SetPxPyPzE(0., 0., 0., m_nuclei[7].groundStateMass);
-			return;
+			return ReactionStatus::Success;
 		}
-		m_step2.Calculate();
+		status = m_step2.Calculate();
+		if(status != ReactionStatus::Success)
+			return status;
 	
 		m_step3.SetResidualEnergyLoss(true);
 
@@ -205,6 +214,6 @@ namespace Mask {
 
 		m_step3.SetPolarRxnAngle(params.decay2Theta);
 		m_step3.SetAzimRxnAngle(params.decay2Phi);
-		m_step3.Calculate();
+		return m_step3.Calculate();
 	}
 }
\ No newline at end of file
@@ -29,13 +29,14 @@ namespace Mask {
 		CoupledThreeStepSystem(const std::vector<StepParameters>& params);
 		~CoupledThreeStepSystem();
 
-		virtual void SetLayeredTarget(const LayeredTarget& target) override;
-		virtual void RunSystem() override;
+		virtual void SetLayeredTarget(const LayeredTarget& target, const BeamEnergyLossMap* beamElossMap) override;
+		virtual ReactionStatus RunSystem() override;
 		
 	protected:
 		void Init(const std::vector<StepParameters>& params);
 		void SetSystemEquation() override;
 		CoupledThreeStepParameters SampleParameters();
+		bool SampleExcitations(CoupledThreeStepParameters& params);
         void SampleCoupling(CoupledThreeStepParameters& params);
 	
 		Reaction m_step1, m_step2, m_step3;
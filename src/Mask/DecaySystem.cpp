@@ -39,18 +39,18 @@ namespace Mask {
 		
 		AddPhiRange(step1Params.phiMin, step1Params.phiMax);
 		AddDecayAngularDistribution(step1Params.angularDistFile);
-		AddExcitationDistribution(step1Params.meanResidualEx, step1Params.sigmaResidualEx);
+		AddExcitationDistribution(step1Params.meanResidualEx, step1Params.sigmaResidualEx, step1Params.residualExFile);
 
 		return;
 	}
 	
-	void DecaySystem::SetLayeredTarget(const LayeredTarget& target)
+	void DecaySystem::SetLayeredTarget(const LayeredTarget& target, const BeamEnergyLossMap* beamElossMap)
 	{
-		m_target = target;
-		m_rxnLayer = m_target.FindLayerContaining(m_nuclei[0].Z, m_nuclei[0].A);
-		if(m_rxnLayer != m_target.GetNumberOfLayers())
+		m_target = &target;
+		m_rxnLayer = m_target->FindLayerContaining(m_nuclei[0].Z, m_nuclei[0].A);
+		if(m_rxnLayer != m_target->GetNumberOfLayers())
 		{
-			m_step1.SetLayeredTarget(&m_target);
+			m_step1.SetLayeredTarget(m_target);
 			m_step1.SetRxnLayer(m_rxnLayer);
 			m_isTargetSet = true;
 		}
@@ -67,20 +67,55 @@ namespace Mask {
 		m_sysEquation = stream.str();
 	}
 	
-	void DecaySystem::RunSystem()
+	DecayParameters DecaySystem::SampleParameters()
 	{
-		std::mt19937& gen = RandomGenerator::GetInstance().GetGenerator();
-		double rxnTheta = m_decayAngularDistributions[0].GetRandomCosTheta();
-		double rxnPhi = m_phiRanges[0](gen);
-		double ex = m_exDistributions[0](gen);
-		double rxnDepth = m_rxnDepthDist(gen);
+		DecayParameters params;
+		SampleDirection(0, m_decayAngularDistributions[0], m_phiRanges[0], params.rxnTheta, params.rxnPhi);
+		params.rxnDepth = SampleDepth();
+		//Residual excitation truncated to the region allowed by the decay of the ground state. If nothing is allowed the
+		//excitation is left at the mean, and the decay fails with a NegativeQValue status
+		StartExcitations();
+		SampleExcitation(0, m_step1.GetDecayExcitationLimit(0.0), params.residEx);
+		return params;
+	}
+
+	ReactionStatus DecaySystem::RunSystem()
+	{
+		DecayParameters params = SampleParameters();
+
+		m_step1.SetReactionDepth(params.rxnDepth);
+		m_step1.SetPolarRxnAngle(params.rxnTheta);
+		m_step1.SetAzimRxnAngle(params.rxnPhi);
+		m_step1.SetExcitation(params.residEx);
+		m_step1.SetResidualEnergyLoss(true);
+		return m_step1.Calculate();
+	}
+
+	//Parameters are sampled event by event (each event has its own random stream), then the kinematics run over the whole batch
+	void DecaySystem::RunBatch(EventBatch& batch, uint64_t firstEvent, std::size_t size)
+	{
+		batch.Resize(m_nuclei.size(), size);
+		batch.SetFirstEvent(firstEvent);
+		m_stepColumns.resize(1);
+		StepColumns& step1 = m_stepColumns[0];
+		step1.Resize(size);
+
+		DecayParameters params;
+		for(std::size_t i=0; i<size; i++)
+		{
+			StartEvent(firstEvent + i);
+			params = SampleParameters();
+			batch.SetWeight(i, m_eventWeight);
+			step1.theta[i] = params.rxnTheta;
+			step1.phi[i] = params.rxnPhi;
+			step1.ex[i] = params.residEx;
+			step1.rxnDepth[i] = params.rxnDepth;
+			batch.SetAtRest(0, i, m_nuclei[0].groundStateMass);
+		}
 
-		m_step1.SetReactionDepth(rxnDepth);
-		m_step1.SetPolarRxnAngle(rxnTheta);
-		m_step1.SetAzimRxnAngle(rxnPhi);
-		m_step1.SetExcitation(ex);
 		m_step1.SetResidualEnergyLoss(true);
-		m_step1.Calculate();
+		m_step1.CalculateBatch(batch, {0, 0, 1, 2}, step1);
+		CountStatus(batch);
 	}
 
 }
\ No newline at end of file
@@ -6,18 +6,28 @@
 
 namespace Mask {
 
+	struct DecayParameters
+	{
+		double rxnTheta = 0.;
+		double rxnPhi = 0.;
+		double residEx = 0.;
+		double rxnDepth = 0.;
+	};
+
 	class DecaySystem: public ReactionSystem
 	{
 	public:
 		DecaySystem(const std::vector<StepParameters>& params);
 		~DecaySystem();
 	
-		virtual void SetLayeredTarget(const LayeredTarget& target) override;
-		virtual void RunSystem() override;
+		virtual void SetLayeredTarget(const LayeredTarget& target, const BeamEnergyLossMap* beamElossMap) override;
+		virtual ReactionStatus RunSystem() override;
+		virtual void RunBatch(EventBatch& batch, uint64_t firstEvent, std::size_t size) override;
 	
 	private:
 		void Init(const std::vector<StepParameters>& params);
 		void SetSystemEquation() override;
+		DecayParameters SampleParameters();
 	
 		Reaction m_step1;
 	};
@@ -0,0 +1,205 @@
+/*
+	EnergyLossCache.cpp
+	Persistent storage for EnergyLossTables. Each table is written to its own binary file in a cache directory, named by a hash
+	of everything that determines the table. See EnergyLossCache.h for details.
+*/
+#include "EnergyLossCache.h"
+#include "catima/catima.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <filesystem>
+#include <system_error>
+#include <unistd.h>
+
+namespace Mask {
+
+	//64-bit FNV-1a
+	void EnergyLossCache::HashBytes(uint64_t& hash, const void* data, std::size_t size)
+	{
+		static constexpr uint64_t prime = 1099511628211ULL;
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		for(std::size_t i=0; i<size; i++)
+		{
+			hash ^= bytes[i];
+			hash *= prime;
+		}
+	}
+
+	/*
+		Key of the table of projectile in material. Besides the composition and the grid, it holds the catima configuration and
+		the stopping powers at a few energies, so that tables built by a different catima version or configuration are not
+		loaded (catima does not expose its version).
+	*/
+	uint64_t EnergyLossCache::GetKey(const std::vector<int>& z, const std::vector<int>& a, const std::vector<int>& stoich, int zp, int ap,
+									 const catima::Projectile& projectile, const catima::Material& material)
+	{
+		uint64_t hash = 14695981039346656037ULL;
+		uint64_t nElements = z.size();
+		HashBytes(hash, &nElements, sizeof(nElements));
+		for(std::size_t i=0; i<z.size(); i++)
+		{
+			int32_t element[3] = {z[i], a[i], stoich[i]};
+			HashBytes(hash, element, sizeof(element));
+		}
+		int32_t projectileZA[2] = {zp, ap};
+		HashBytes(hash, projectileZA, sizeof(projectileZA));
+
+		uint32_t version = s_version;
+		int32_t mantissaBits = EnergyLossTable::s_mantissaBits;
+		double grid[2] = {EnergyLossTable::s_tableEnergyMin, EnergyLossTable::s_tableEnergyMax};
+		HashBytes(hash, &version, sizeof(version));
+		HashBytes(hash, &mantissaBits, sizeof(mantissaBits));
+		HashBytes(hash, grid, sizeof(grid));
+
+		HashBytes(hash, &catima::default_config, sizeof(catima::default_config));
+		catima::Projectile probe = projectile;
+		for(double energy : s_probeEnergies)
+		{
+			probe.T = energy;
+			double stopping = catima::dedx(probe, material);
+			HashBytes(hash, &stopping, sizeof(stopping));
+		}
+		return hash;
+	}
+
+	std::string EnergyLossCache::GetFilePath(const std::string& directory, uint64_t key)
+	{
+		std::stringstream stream;
+		stream << directory;
+		if(!directory.empty() && directory.back() != '/')
+			stream << "/";
+		stream << "eloss_" << std::hex << std::setw(16) << std::setfill('0') << key << ".bin";
+		return stream.str();
+	}
+
+	/*
+		Read the cache file for key straight into table. Returns false if there is no file, or if the file does not match what
+		is expected for this key; the table is then invalid and should be built.
+	*/
+	bool EnergyLossCache::Load(const std::string& directory, uint64_t key, EnergyLossTable& table)
+	{
+		std::string path = GetFilePath(directory, key);
+		std::error_code error;
+		uint64_t fileSize = std::filesystem::file_size(path, error);
+		if(error || fileSize < sizeof(FileHeader))
+			return false;
+
+		std::ifstream input(path, std::ios::binary);
+		if(!input.is_open())
+			return false;
+
+		FileHeader header;
+		input.read(reinterpret_cast<char*>(&header), sizeof(FileHeader));
+
+		//The node counts come from the file, so they are checked against its size before any arithmetic on them
+		static constexpr uint64_t nodeBytes = 3*sizeof(double);
+		uint64_t payload = fileSize - sizeof(FileHeader);
+		if(!input || std::memcmp(header.magic, s_magic, sizeof(s_magic)) != 0 || header.version != s_version || header.key != key ||
+		   header.mantissaBits != (uint32_t) EnergyLossTable::s_mantissaBits || header.nEnergyNodes < 2 || header.nRangeNodes < 2 ||
+		   payload % nodeBytes != 0 || header.nEnergyNodes > payload/nodeBytes || header.nRangeNodes != payload/nodeBytes - header.nEnergyNodes)
+		{
+			std::cerr << "Energy loss cache file " << path << " does not match the expected format. It will be rebuilt." << std::endl;
+			return false;
+		}
+
+		std::size_t nE = header.nEnergyNodes;
+		std::size_t nR = header.nRangeNodes;
+		auto readVector = [&input](std::vector<double>& values, std::size_t size)
+		{
+			values.resize(size);
+			input.read(reinterpret_cast<char*>(values.data()), size*sizeof(double));
+		};
+		readVector(table.m_energyNodes, nE);
+		readVector(table.m_rangeValues, nE);
+		readVector(table.m_rangeSlopes, nE);
+		readVector(table.m_rangeNodes, nR);
+		readVector(table.m_energyValues, nR);
+		readVector(table.m_energySlopes, nR);
+		if(!input)
+		{
+			std::cerr << "Unable to read energy loss cache file " << path << ". It will be rebuilt." << std::endl;
+			table.m_isValid = false;
+			return false;
+		}
+
+		table.m_massU = header.massU;
+		table.m_inverseMassU = 1.0/header.massU;
+		table.m_energyMin = header.energyMin;
+		table.m_energyMax = header.energyMax;
+		table.m_rangeMin = header.rangeMin;
+		table.m_rangeMax = header.rangeMax;
+		table.m_energyKeyMin = header.energyKeyMin;
+		table.m_rangeKeyMin = header.rangeKeyMin;
+		table.m_isValid = true;
+		return true;
+	}
+
+	/*
+		Write a valid table to the cache. The file is written under a temporary name and then renamed, so that a concurrent
+		job never reads a partially written file.
+	*/
+	bool EnergyLossCache::Save(const std::string& directory, uint64_t key, const EnergyLossTable& table)
+	{
+		if(!table.IsValid())
+			return false;
+
+		std::error_code error;
+		std::filesystem::create_directories(directory, error);
+		if(error)
+		{
+			std::cerr << "Unable to create energy loss cache directory " << directory << ". Table will not be cached." << std::endl;
+			return false;
+		}
+
+		FileHeader header;
+		std::memcpy(header.magic, s_magic, sizeof(s_magic));
+		header.version = s_version;
+		header.mantissaBits = EnergyLossTable::s_mantissaBits;
+		header.key = key;
+		header.massU = table.m_massU;
+		header.energyMin = table.m_energyMin;
+		header.energyMax = table.m_energyMax;
+		header.rangeMin = table.m_rangeMin;
+		header.rangeMax = table.m_rangeMax;
+		header.energyKeyMin = table.m_energyKeyMin;
+		header.nEnergyNodes = table.m_energyNodes.size();
+		header.rangeKeyMin = table.m_rangeKeyMin;
+		header.nRangeNodes = table.m_rangeNodes.size();
+
+		std::string path = GetFilePath(directory, key);
+		std::string tempPath = path + "." + std::to_string(getpid()) + ".tmp";
+		std::ofstream output(tempPath, std::ios::binary);
+		if(!output.is_open())
+		{
+			std::cerr << "Unable to open energy loss cache file " << tempPath << ". Table will not be cached." << std::endl;
+			return false;
+		}
+
+		auto writeVector = [&output](const std::vector<double>& values)
+		{
+			output.write(reinterpret_cast<const char*>(values.data()), values.size()*sizeof(double));
+		};
+		output.write(reinterpret_cast<const char*>(&header), sizeof(FileHeader));
+		writeVector(table.m_energyNodes);
+		writeVector(table.m_rangeValues);
+		writeVector(table.m_rangeSlopes);
+		writeVector(table.m_rangeNodes);
+		writeVector(table.m_energyValues);
+		writeVector(table.m_energySlopes);
+		output.close();
+
+		if(output.fail() || std::rename(tempPath.c_str(), path.c_str()) != 0)
+		{
+			std::cerr << "Unable to write energy loss cache file " << path << ". Table will not be cached." << std::endl;
+			std::remove(tempPath.c_str());
+			return false;
+		}
+		return true;
+	}
+
+}
@@ -0,0 +1,53 @@
+/*
+	EnergyLossCache.h
+	Persistent storage for EnergyLossTables. Each table is written to its own binary file in a cache directory, named by a hash
+	of everything that determines the table: the material composition (Z, A, stoichiometry of each element), the projectile
+	Z and A, the table grid, and the catima configuration and stopping powers (see GetKey). Later runs against the same target
+	then read the file instead of integrating the stopping powers again.
+
+	Files are written to a temporary name and renamed into place, so many jobs can share a cache directory. Files which do
+	not match the expected format (wrong magic, version, key, or size) are ignored and rebuilt.
+*/
+#ifndef ENERGYLOSSCACHE_H
+#define ENERGYLOSSCACHE_H
+
+#include "EnergyLossTable.h"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace Mask {
+
+	class EnergyLossCache
+	{
+	public:
+		static uint64_t GetKey(const std::vector<int>& z, const std::vector<int>& a, const std::vector<int>& stoich, int zp, int ap,
+							  const catima::Projectile& projectile, const catima::Material& material);
+		static std::string GetFilePath(const std::string& directory, uint64_t key);
+		static bool Load(const std::string& directory, uint64_t key, EnergyLossTable& table);
+		static bool Save(const std::string& directory, uint64_t key, const EnergyLossTable& table);
+
+	private:
+		struct FileHeader
+		{
+			char magic[8];
+			uint32_t version;
+			uint32_t mantissaBits;
+			uint64_t key;
+			double massU;
+			double energyMin, energyMax;
+			double rangeMin, rangeMax;
+			uint64_t energyKeyMin, nEnergyNodes;
+			uint64_t rangeKeyMin, nRangeNodes;
+		};
+
+		static void HashBytes(uint64_t& hash, const void* data, std::size_t size);
+
+		static constexpr char s_magic[8] = {'M', 'A', 'S', 'K', 'E', 'L', 'T', '\0'};
+		static constexpr uint32_t s_version = 1; //Increment whenever the file layout or table construction changes
+		static constexpr double s_probeEnergies[3] = {0.1, 1.0, 10.0}; //MeV/u; stopping powers which go into the key
+	};
+
+}
+
+#endif
@@ -0,0 +1,332 @@
+/*
+	EnergyLossTable.cpp
+	Precomputed range-energy relation for a single projectile species in a single material. The range R(T) (g/cm^2)
+	is integrated once from the catima stopping powers, along with its inverse T(R). Energy loss through any
+	thickness then becomes two table lookups: T_out = T(R(T_in) - thickness). The reverse calculation (energy at the start
+	of a path given the energy at its end) uses the same tables: T_in = T(R(T_out) + thickness).
+
+	Energies passed to the public interface are total kinetic energies in MeV, thicknesses are in g/cm^2.
+*/
+#include "EnergyLossTable.h"
+#include "catima/catima.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace Mask {
+
+	EnergyLossTable::EnergyLossTable() :
+		m_massU(0.0), m_inverseMassU(0.0), m_energyMin(0.0), m_energyMax(0.0), m_rangeMin(0.0), m_rangeMax(0.0),
+		m_energyKeyMin(0), m_rangeKeyMin(0), m_isValid(false)
+	{
+	}
+
+	EnergyLossTable::EnergyLossTable(const catima::Projectile& projectile, const catima::Material& material) :
+		m_massU(0.0), m_inverseMassU(0.0), m_energyMin(0.0), m_energyMax(0.0), m_rangeMin(0.0), m_rangeMax(0.0),
+		m_energyKeyMin(0), m_rangeKeyMin(0), m_isValid(false)
+	{
+		Build(projectile, material);
+	}
+
+	EnergyLossTable::~EnergyLossTable() {}
+
+	void EnergyLossTable::Build(const catima::Projectile& projectile, const catima::Material& material)
+	{
+		m_isValid = false;
+		catima::Projectile proj = projectile;
+		m_massU = proj.A;
+		m_inverseMassU = 1.0/m_massU;
+
+		BuildRangeNodes(proj, material);
+		if(!m_isValid)
+			return;
+		BuildEnergyNodes(proj, material);
+	}
+
+	/*
+		Integrate R(T) = A * int_0^T dT'/S(T') over the energy nodes, where S is the catima stopping power (MeV/(g/cm^2)).
+		Each segment is integrated with Simpson's rule. Below the first node the stopping power is taken to go as sqrt(T),
+		which gives R_0 = 2*T_0*A/S(T_0).
+	*/
+	void EnergyLossTable::BuildRangeNodes(catima::Projectile& projectile, const catima::Material& material)
+	{
+		m_energyKeyMin = GetKey(s_tableEnergyMin);
+		std::size_t nNodes = GetKey(s_tableEnergyMax) - m_energyKeyMin + 1;
+		m_energyNodes.resize(nNodes);
+		m_rangeValues.resize(nNodes);
+		m_rangeSlopes.resize(nNodes);
+
+		double stopping, midStopping;
+		for(std::size_t i=0; i<nNodes; i++)
+		{
+			m_energyNodes[i] = GetNodeValue(m_energyKeyMin + i);
+			projectile.T = m_energyNodes[i];
+			stopping = catima::dedx(projectile, material);
+			if(!(stopping > 0.0))
+			{
+				std::cerr << "Invalid stopping power at EnergyLossTable::BuildRangeNodes() for T = " << m_energyNodes[i]
+						  << " MeV/u. Table is invalid." << std::endl;
+				return;
+			}
+			m_rangeSlopes[i] = m_massU/stopping;
+
+			if(i == 0)
+			{
+				m_rangeValues[i] = 2.0*m_energyNodes[i]*m_rangeSlopes[i];
+				continue;
+			}
+
+			projectile.T = 0.5*(m_energyNodes[i-1] + m_energyNodes[i]);
+			midStopping = catima::dedx(projectile, material);
+			m_rangeValues[i] = m_rangeValues[i-1] + (m_energyNodes[i] - m_energyNodes[i-1])/6.0 *
+							   (m_rangeSlopes[i-1] + 4.0*m_massU/midStopping + m_rangeSlopes[i]);
+		}
+
+		m_energyMin = m_energyNodes.front();
+		m_energyMax = m_energyNodes.back();
+		m_rangeMin = m_rangeValues.front();
+		m_rangeMax = m_rangeValues.back();
+		m_isValid = true;
+	}
+
+	/*
+		Tabulate the inverse, T(R), on its own set of range nodes. The energy domain of the table is then clipped to
+		the last range node, so that any range computed from an in-domain energy can always be inverted by lookup.
+	*/
+	void EnergyLossTable::BuildEnergyNodes(catima::Projectile& projectile, const catima::Material& material)
+	{
+		m_rangeKeyMin = GetKey(m_rangeMin) + 1;
+		uint64_t rangeKeyMax = GetKey(m_rangeMax);
+		if(rangeKeyMax <= m_rangeKeyMin)
+		{
+			std::cerr << "Range domain too small at EnergyLossTable::BuildEnergyNodes(). Table is invalid." << std::endl;
+			m_isValid = false;
+			return;
+		}
+
+		std::size_t nNodes = rangeKeyMax - m_rangeKeyMin + 1;
+		m_rangeNodes.resize(nNodes);
+		m_energyValues.resize(nNodes);
+		m_energySlopes.resize(nNodes);
+		for(std::size_t i=0; i<nNodes; i++)
+		{
+			m_rangeNodes[i] = GetNodeValue(m_rangeKeyMin + i);
+			m_energyValues[i] = SolveEnergyPerU(m_rangeNodes[i]);
+			projectile.T = m_energyValues[i];
+			m_energySlopes[i] = catima::dedx(projectile, material)*m_inverseMassU;
+		}
+
+		m_energyMax = m_energyValues.back();
+		m_rangeMax = m_rangeNodes.back();
+	}
+
+	//Only used when building the table. Bisect the forward interpolation to find T(R).
+	double EnergyLossTable::SolveEnergyPerU(double range) const
+	{
+		if(range < m_rangeMin)
+			return m_energyMin*(range/m_rangeMin)*(range/m_rangeMin);
+
+		auto iter = std::upper_bound(m_rangeValues.begin(), m_rangeValues.end(), range);
+		std::size_t index = iter - m_rangeValues.begin();
+		if(index >= m_rangeValues.size())
+			return m_energyNodes.back();
+		index -= 1;
+
+		double low = m_energyNodes[index];
+		double high = m_energyNodes[index+1];
+		double mid, value;
+		for(int i=0; i<64; i++)
+		{
+			mid = 0.5*(low + high);
+			value = Hermite(mid, m_energyNodes[index], m_energyNodes[index+1], m_rangeValues[index], m_rangeValues[index+1],
+							m_rangeSlopes[index], m_rangeSlopes[index+1]);
+			if(value < range)
+				low = mid;
+			else
+				high = mid;
+		}
+		return 0.5*(low + high);
+	}
+
+	//Range (g/cm^2) of a projectile with total kinetic energy (MeV). Requires IsEnergyInRange(energy).
+	double EnergyLossTable::GetRange(double energy) const
+	{
+		double energyPerU = energy*m_inverseMassU;
+		if(energyPerU <= 0.0)
+			return 0.0;
+		else if(energyPerU < m_energyMin)
+			return m_rangeMin*std::sqrt(energyPerU/m_energyMin);
+
+		std::size_t index = GetKey(energyPerU) - m_energyKeyMin;
+		return Hermite(energyPerU, m_energyNodes[index], m_energyNodes[index+1], m_rangeValues[index], m_rangeValues[index+1],
+					   m_rangeSlopes[index], m_rangeSlopes[index+1]);
+	}
+
+	//Total kinetic energy (MeV) of a projectile with the given range (g/cm^2)
+	double EnergyLossTable::GetEnergy(double range) const
+	{
+		if(range <= 0.0)
+			return 0.0;
+		else if(range < m_rangeNodes.front())
+			return m_energyValues.front()*(range/m_rangeNodes.front())*(range/m_rangeNodes.front())*m_massU;
+
+		std::size_t index = GetKey(range) - m_rangeKeyMin;
+		if(index + 1 >= m_rangeNodes.size())
+			return SolveEnergyPerU(range)*m_massU;
+
+		return Hermite(range, m_rangeNodes[index], m_rangeNodes[index+1], m_energyValues[index], m_energyValues[index+1],
+					   m_energySlopes[index], m_energySlopes[index+1])*m_massU;
+	}
+
+	//Energy lost (MeV) travelling through thickness (g/cm^2). Requires IsEnergyInRange(startEnergy).
+	double EnergyLossTable::GetEnergyLoss(double startEnergy, double thickness) const
+	{
+		if(startEnergy <= 0.0 || thickness <= 0.0)
+			return 0.0;
+
+		double finalRange = GetRange(startEnergy) - thickness;
+		if(finalRange <= 0.0)
+			return startEnergy;
+
+		return startEnergy - GetEnergy(finalRange);
+	}
+
+	/*
+		Energy lost (MeV) through thickness (g/cm^2) by a projectile which exits with finalEnergy (MeV).
+		Requires IsEnergyInRange(finalEnergy) and IsRangeInRange(GetRange(finalEnergy) + thickness).
+	*/
+	double EnergyLossTable::GetReverseEnergyLoss(double finalEnergy, double thickness) const
+	{
+		return GetEnergy(GetRange(finalEnergy) + thickness) - finalEnergy;
+	}
+
+	/*
+		Energy loss for a batch of n particles of this species, elosses[i] for (startEnergies[i], thicknesses[i]).
+		Elements whose start energy is outside of the table domain are set to -1 and false is returned, so that the caller
+		can calculate those elements some other way.
+	*/
+	bool EnergyLossTable::GetEnergyLoss(const double* startEnergies, const double* thicknesses, double* elosses, std::size_t n) const
+	{
+		bool isAllInRange = true;
+		std::size_t i = 0;
+#ifdef __AVX2__
+		for(; i+4 <= n; i += 4)
+			isAllInRange = GetEnergyLossAVX2(startEnergies + i, thicknesses + i, elosses + i) && isAllInRange;
+#endif
+		for(; i<n; i++)
+		{
+			if(IsEnergyInRange(startEnergies[i]))
+				elosses[i] = GetEnergyLoss(startEnergies[i], thicknesses[i]);
+			else
+			{
+				elosses[i] = -1.0;
+				isAllInRange = false;
+			}
+		}
+		return isAllInRange;
+	}
+
+#ifdef __AVX2__
+	static inline __m256d HermiteAVX2(__m256d x, __m256d x0, __m256d x1, __m256d y0, __m256d y1, __m256d m0, __m256d m1)
+	{
+		const __m256d two = _mm256_set1_pd(2.0);
+		const __m256d three = _mm256_set1_pd(3.0);
+		__m256d h = _mm256_sub_pd(x1, x0);
+		__m256d t = _mm256_div_pd(_mm256_sub_pd(x, x0), h);
+		__m256d t2 = _mm256_mul_pd(t, t);
+		__m256d t3 = _mm256_mul_pd(t2, t);
+		__m256d h00 = _mm256_add_pd(_mm256_sub_pd(_mm256_mul_pd(two, t3), _mm256_mul_pd(three, t2)), _mm256_set1_pd(1.0));
+		__m256d h10 = _mm256_add_pd(_mm256_sub_pd(t3, _mm256_mul_pd(two, t2)), t);
+		__m256d h01 = _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(-2.0), t3), _mm256_mul_pd(three, t2));
+		__m256d h11 = _mm256_sub_pd(t3, t2);
+		__m256d result = _mm256_mul_pd(h00, y0);
+		result = _mm256_add_pd(result, _mm256_mul_pd(_mm256_mul_pd(h10, h), m0));
+		result = _mm256_add_pd(result, _mm256_mul_pd(h01, y1));
+		return _mm256_add_pd(result, _mm256_mul_pd(_mm256_mul_pd(h11, h), m1));
+	}
+
+	/*
+		Four elements of the batched energy loss. Follows GetRange and GetEnergy lane by lane: node values are rebuilt from
+		the keys and only the tabulated values and slopes are gathered. Lanes which land in the last segment of the inverse
+		table (where the scalar path bisects) are recomputed with the scalar path. Returns false if any lane is outside of the
+		table domain.
+	*/
+	bool EnergyLossTable::GetEnergyLossAVX2(const double* startEnergies, const double* thicknesses, double* elosses) const
+	{
+		const __m256d zero = _mm256_setzero_pd();
+		const __m256i one = _mm256_set1_epi64x(1);
+
+		__m256d energy = _mm256_loadu_pd(startEnergies);
+		__m256d thickness = _mm256_loadu_pd(thicknesses);
+		__m256d energyPerU = _mm256_mul_pd(energy, _mm256_set1_pd(m_inverseMassU));
+		__m256d isInDomain = _mm256_cmp_pd(energyPerU, _mm256_set1_pd(m_energyMax), _CMP_LT_OQ);
+		__m256d isPositive = _mm256_cmp_pd(energyPerU, zero, _CMP_GT_OQ);
+		__m256d isValid = _mm256_and_pd(isInDomain, isPositive);
+
+		//Range of the incoming particle, R(T)
+		__m256d isBelowTable = _mm256_cmp_pd(energyPerU, _mm256_set1_pd(m_energyMin), _CMP_LT_OQ);
+		__m256d useTable = _mm256_andnot_pd(isBelowTable, isValid);
+		__m256i keyMin = _mm256_set1_epi64x(m_energyKeyMin);
+		__m256i index = _mm256_sub_epi64(_mm256_srli_epi64(_mm256_castpd_si256(energyPerU), s_keyShift), keyMin);
+		index = _mm256_and_si256(index, _mm256_castpd_si256(useTable)); //Unused lanes read node 0
+		__m256i key = _mm256_add_epi64(index, keyMin);
+		__m256d x0 = _mm256_castsi256_pd(_mm256_slli_epi64(key, s_keyShift));
+		__m256d x1 = _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_add_epi64(key, one), s_keyShift));
+		__m256d y0 = _mm256_i64gather_pd(m_rangeValues.data(), index, 8);
+		__m256d y1 = _mm256_i64gather_pd(m_rangeValues.data() + 1, index, 8);
+		__m256d m0 = _mm256_i64gather_pd(m_rangeSlopes.data(), index, 8);
+		__m256d m1 = _mm256_i64gather_pd(m_rangeSlopes.data() + 1, index, 8);
+		__m256d range = HermiteAVX2(energyPerU, x0, x1, y0, y1, m0, m1);
+		__m256d lowRange = _mm256_mul_pd(_mm256_set1_pd(m_rangeMin),
+										 _mm256_sqrt_pd(_mm256_div_pd(_mm256_max_pd(energyPerU, zero), _mm256_set1_pd(m_energyMin))));
+		range = _mm256_blendv_pd(range, lowRange, isBelowTable);
+		range = _mm256_and_pd(range, isPositive);
+
+		//Energy at the end of the path, T(R - thickness)
+		__m256d finalRange = _mm256_sub_pd(range, thickness);
+		__m256d isStopped = _mm256_cmp_pd(finalRange, zero, _CMP_LE_OQ);
+		__m256d rangeFront = _mm256_set1_pd(m_rangeNodes.front());
+		__m256d isBelowInverse = _mm256_cmp_pd(finalRange, rangeFront, _CMP_LT_OQ);
+		keyMin = _mm256_set1_epi64x(m_rangeKeyMin);
+		index = _mm256_sub_epi64(_mm256_srli_epi64(_mm256_castpd_si256(finalRange), s_keyShift), keyMin);
+		__m256d isEdge = _mm256_castsi256_pd(_mm256_cmpgt_epi64(index, _mm256_set1_epi64x(m_rangeNodes.size() - 2)));
+		isEdge = _mm256_andnot_pd(isBelowInverse, isEdge);
+		__m256d useInverse = _mm256_andnot_pd(_mm256_or_pd(isBelowInverse, isEdge), isValid);
+		index = _mm256_and_si256(index, _mm256_castpd_si256(useInverse));
+		key = _mm256_add_epi64(index, keyMin);
+		x0 = _mm256_castsi256_pd(_mm256_slli_epi64(key, s_keyShift));
+		x1 = _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_add_epi64(key, one), s_keyShift));
+		y0 = _mm256_i64gather_pd(m_energyValues.data(), index, 8);
+		y1 = _mm256_i64gather_pd(m_energyValues.data() + 1, index, 8);
+		m0 = _mm256_i64gather_pd(m_energySlopes.data(), index, 8);
+		m1 = _mm256_i64gather_pd(m_energySlopes.data() + 1, index, 8);
+		__m256d finalEnergy = HermiteAVX2(finalRange, x0, x1, y0, y1, m0, m1);
+		__m256d rangeRatio = _mm256_div_pd(finalRange, rangeFront);
+		__m256d lowEnergy = _mm256_mul_pd(_mm256_mul_pd(_mm256_set1_pd(m_energyValues.front()), rangeRatio), rangeRatio);
+		finalEnergy = _mm256_mul_pd(_mm256_blendv_pd(finalEnergy, lowEnergy, isBelowInverse), _mm256_set1_pd(m_massU));
+
+		__m256d eloss = _mm256_sub_pd(energy, finalEnergy);
+		eloss = _mm256_blendv_pd(eloss, energy, isStopped);
+		eloss = _mm256_and_pd(eloss, _mm256_and_pd(isPositive, _mm256_cmp_pd(thickness, zero, _CMP_GT_OQ)));
+		eloss = _mm256_blendv_pd(_mm256_set1_pd(-1.0), eloss, isInDomain);
+		_mm256_storeu_pd(elosses, eloss);
+
+		int edgeMask = _mm256_movemask_pd(_mm256_and_pd(isEdge, isValid));
+		if(edgeMask != 0)
+		{
+			for(int i=0; i<4; i++)
+			{
+				if(edgeMask & (1 << i))
+					elosses[i] = GetEnergyLoss(startEnergies[i], thicknesses[i]);
+			}
+		}
+		return _mm256_movemask_pd(isInDomain) == 0xF;
+	}
+#endif
+
+}
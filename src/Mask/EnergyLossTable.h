@@ -0,0 +1,127 @@
+/*
+	EnergyLossTable.h
+	Precomputed range-energy relation for a single projectile species in a single material. The range R(T) (g/cm^2)
+	is integrated once from the catima stopping powers, along with its inverse T(R). Energy loss through any
+	thickness then becomes two table lookups: T_out = T(R(T_in) - thickness). The reverse calculation (energy at the start
+	of a path given the energy at its end) uses the same tables: T_in = T(R(T_out) + thickness).
+
+	Table nodes are spaced uniformly in the mantissa of each power of two (2^s_mantissaBits nodes per octave),
+	so the node index of a value is just a shift of its IEEE-754 bit pattern; no log or search is needed per lookup.
+	Values between nodes are given by cubic Hermite interpolation, using the exact stopping power as the slope.
+	When compiled with AVX2 the batched energy loss processes four particles at a time; the node values themselves are rebuilt
+	from the keys, so each lookup only needs to gather the tabulated values and slopes.
+
+	Energies passed to the public interface are total kinetic energies in MeV, thicknesses are in g/cm^2.
+*/
+#ifndef ENERGYLOSSTABLE_H
+#define ENERGYLOSSTABLE_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include "catima/gwm_integrators.h"
+
+namespace Mask {
+
+	enum class EnergyLossMode
+	{
+		Exact, //Full catima integration for every call
+		Tabulated //Range table lookup, falls back to Exact outside of the table domain
+	};
+
+	static EnergyLossMode StringToEnergyLossMode(const std::string& mode)
+	{
+		if(mode == "Exact")
+			return EnergyLossMode::Exact;
+		else
+			return EnergyLossMode::Tabulated;
+	}
+
+	static std::string EnergyLossModeToString(EnergyLossMode mode)
+	{
+		switch(mode)
+		{
+			case EnergyLossMode::Exact: return "Exact";
+			case EnergyLossMode::Tabulated: return "Tabulated";
+			default: return "Tabulated";
+		}
+	}
+
+	class EnergyLossTable
+	{
+	public:
+		EnergyLossTable();
+		EnergyLossTable(const catima::Projectile& projectile, const catima::Material& material);
+		~EnergyLossTable();
+
+		void Build(const catima::Projectile& projectile, const catima::Material& material);
+
+		bool IsValid() const { return m_isValid; }
+		bool IsEnergyInRange(double energy) const { return m_isValid && energy*m_inverseMassU < m_energyMax; }
+		bool IsRangeInRange(double range) const { return m_isValid && range < m_rangeMax; }
+
+		double GetRange(double energy) const;
+		double GetEnergy(double range) const;
+		double GetEnergyLoss(double startEnergy, double thickness) const;
+		double GetReverseEnergyLoss(double finalEnergy, double thickness) const;
+		bool GetEnergyLoss(const double* startEnergies, const double* thicknesses, double* elosses, std::size_t n) const;
+
+	private:
+		friend class EnergyLossCache;
+
+		void BuildRangeNodes(catima::Projectile& projectile, const catima::Material& material);
+		void BuildEnergyNodes(catima::Projectile& projectile, const catima::Material& material);
+		double SolveEnergyPerU(double range) const;
+#ifdef __AVX2__
+		bool GetEnergyLossAVX2(const double* startEnergies, const double* thicknesses, double* elosses) const;
+#endif
+
+		static uint64_t GetKey(double value)
+		{
+			uint64_t bits;
+			std::memcpy(&bits, &value, sizeof(double));
+			return bits >> s_keyShift;
+		}
+
+		static double GetNodeValue(uint64_t key)
+		{
+			uint64_t bits = key << s_keyShift;
+			double value;
+			std::memcpy(&value, &bits, sizeof(double));
+			return value;
+		}
+
+		static double Hermite(double x, double x0, double x1, double y0, double y1, double m0, double m1)
+		{
+			double h = x1 - x0;
+			double t = (x - x0)/h;
+			double t2 = t*t;
+			double t3 = t2*t;
+			return (2.0*t3 - 3.0*t2 + 1.0)*y0 + (t3 - 2.0*t2 + t)*h*m0 + (-2.0*t3 + 3.0*t2)*y1 + (t3 - t2)*h*m1;
+		}
+
+		double m_massU;
+		double m_inverseMassU;
+		double m_energyMin, m_energyMax; //Per nucleon (MeV/u)
+		double m_rangeMin, m_rangeMax; //g/cm^2
+
+		//Range as a function of energy per nucleon
+		uint64_t m_energyKeyMin;
+		std::vector<double> m_energyNodes, m_rangeValues, m_rangeSlopes;
+
+		//Energy per nucleon as a function of range
+		uint64_t m_rangeKeyMin;
+		std::vector<double> m_rangeNodes, m_energyValues, m_energySlopes;
+
+		bool m_isValid;
+
+		static constexpr int s_mantissaBits = 5; //32 nodes per octave
+		static constexpr int s_keyShift = 52 - s_mantissaBits;
+		static constexpr double s_tableEnergyMin = 1.0/1024.0; //MeV/u
+		static constexpr double s_tableEnergyMax = 256.0; //MeV/u
+	};
+
+}
+
+#endif
@@ -0,0 +1,76 @@
+#include "EventBatch.h"
+
+namespace Mask {
+
+	void StepColumns::Resize(std::size_t size)
+	{
+		beamEnergy.resize(size);
+		theta.resize(size);
+		phi.resize(size);
+		ex.resize(size);
+		rxnDepth.resize(size);
+		isActive.assign(size, 1);
+		kineticEnergy.resize(size);
+		mass.resize(size);
+		angle.resize(size);
+		eloss.resize(size);
+		isValid.resize(size);
+	}
+
+	EventBatch::EventBatch() :
+		m_size(0), m_firstEvent(0)
+	{
+	}
+
+	EventBatch::~EventBatch() {}
+
+	void EventBatch::Resize(std::size_t nSlots, std::size_t size)
+	{
+		m_slots.resize(nSlots);
+		for(auto& slot : m_slots)
+		{
+			slot.px.resize(size);
+			slot.py.resize(size);
+			slot.pz.resize(size);
+			slot.E.resize(size);
+			slot.thetaCM.assign(size, 0.0);
+		}
+		m_status.assign(size, ReactionStatus::Success);
+		m_weight.assign(size, 1.0);
+		m_size = size;
+	}
+
+	void EventBatch::SetAtRest(std::size_t slot, std::size_t event, double mass)
+	{
+		FourVectorColumns& columns = m_slots[slot];
+		columns.px[event] = 0.0;
+		columns.py[event] = 0.0;
+		columns.pz[event] = 0.0;
+		columns.E[event] = mass;
+	}
+
+	void EventBatch::StoreNuclei(std::size_t event, const std::vector<Nucleus>& nuclei)
+	{
+		for(std::size_t i=0; i<m_slots.size() && i<nuclei.size(); i++)
+		{
+			FourVectorColumns& columns = m_slots[i];
+			columns.px[event] = nuclei[i].vec4.Px();
+			columns.py[event] = nuclei[i].vec4.Py();
+			columns.pz[event] = nuclei[i].vec4.Pz();
+			columns.E[event] = nuclei[i].vec4.E();
+			columns.thetaCM[event] = nuclei[i].thetaCM;
+		}
+	}
+
+	//Copy one event of the batch into nuclei, which must already hold the nuclei of the system (Z, A, masses, ...)
+	void EventBatch::FillNuclei(std::size_t event, std::vector<Nucleus>& nuclei) const
+	{
+		for(std::size_t i=0; i<m_slots.size() && i<nuclei.size(); i++)
+		{
+			const FourVectorColumns& columns = m_slots[i];
+			nuclei[i].vec4.SetPxPyPzE(columns.px[event], columns.py[event], columns.pz[event], columns.E[event]);
+			nuclei[i].thetaCM = columns.thetaCM[event];
+		}
+	}
+
+}
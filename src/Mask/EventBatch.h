@@ -0,0 +1,89 @@
+/*
+	EventBatch.h
+	Structure-of-arrays storage for a batch of events. Each nucleus slot of a ReactionSystem (the index into its nuclei vector)
+	has one column per four-vector component, so that the kinematics of a Reaction step can be calculated as plain loops over
+	the events of the batch, which the compiler can vectorize. The sampled inputs to each step are kept in the same layout
+	(StepColumns). Nuclei are only assembled at the I/O boundary, when an event is handed to the FileWriter.
+*/
+#ifndef EVENTBATCH_H
+#define EVENTBATCH_H
+
+#include "Nucleus.h"
+#include "RxnType.h"
+#include <vector>
+#include <cstdint>
+
+namespace Mask {
+
+	//Four-vector columns of one nucleus slot
+	struct FourVectorColumns
+	{
+		std::vector<double> px;
+		std::vector<double> py;
+		std::vector<double> pz;
+		std::vector<double> E;
+		std::vector<double> thetaCM;
+	};
+
+	//Sampled inputs to one Reaction step over a batch. beamEnergy is only used by reactions, isActive only by decays
+	struct StepColumns
+	{
+		void Resize(std::size_t size);
+
+		std::vector<double> beamEnergy;
+		std::vector<double> theta;
+		std::vector<double> phi;
+		std::vector<double> ex;
+		std::vector<double> rxnDepth;
+		std::vector<uint8_t> isActive; //False if the decay did not happen (branching ratio); the products are left at rest
+
+		//Work space for the energy loss of the products
+		std::vector<double> kineticEnergy;
+		std::vector<double> mass;
+		std::vector<double> angle;
+		std::vector<double> eloss;
+		std::vector<uint8_t> isValid;
+	};
+
+	//Nucleus slots of a Reaction step
+	struct ReactionSlots
+	{
+		std::size_t target;
+		std::size_t projectile;
+		std::size_t ejectile;
+		std::size_t residual;
+	};
+
+	class EventBatch
+	{
+	public:
+		EventBatch();
+		~EventBatch();
+
+		void Resize(std::size_t nSlots, std::size_t size);
+		void SetFirstEvent(uint64_t eventIndex) { m_firstEvent = eventIndex; }
+
+		std::size_t GetSize() const { return m_size; }
+		uint64_t GetFirstEvent() const { return m_firstEvent; }
+		FourVectorColumns& GetSlot(std::size_t slot) { return m_slots[slot]; }
+		const FourVectorColumns& GetSlot(std::size_t slot) const { return m_slots[slot]; }
+		ReactionStatus GetStatus(std::size_t event) const { return m_status[event]; }
+		void SetStatus(std::size_t event, ReactionStatus status) { m_status[event] = status; }
+		double GetWeight(std::size_t event) const { return m_weight[event]; }
+		void SetWeight(std::size_t event, double weight) { m_weight[event] = weight; }
+
+		void SetAtRest(std::size_t slot, std::size_t event, double mass);
+		void StoreNuclei(std::size_t event, const std::vector<Nucleus>& nuclei);
+		void FillNuclei(std::size_t event, std::vector<Nucleus>& nuclei) const;
+
+	private:
+		std::vector<FourVectorColumns> m_slots;
+		std::vector<ReactionStatus> m_status; //Events which failed are not valid, and are not written
+		std::vector<double> m_weight; //Importance sampling weight of each event (see ReactionSystem::AcceptDirection)
+		std::size_t m_size;
+		uint64_t m_firstEvent;
+	};
+
+}
+
+#endif
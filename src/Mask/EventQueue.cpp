@@ -0,0 +1,209 @@
+#include "EventQueue.h"
+
+#include <thread>
+#include <algorithm>
+#include <limits>
+#include <string>
+
+namespace Mask {
+
+	EventQueue::EventQueue() :
+		m_capacity(0), m_mask(0), m_enqueuePosition(0), m_dequeuePosition(0), m_nProducers(0), m_isConsumerWaiting(false),
+		m_nWaitingProducers(0), m_nFullPushes(0), m_peakSize(0)
+	{
+	}
+
+	EventQueue::EventQueue(std::size_t capacity) :
+		m_capacity(0), m_mask(0), m_enqueuePosition(0), m_dequeuePosition(0), m_nProducers(0), m_isConsumerWaiting(false),
+		m_nWaitingProducers(0), m_nFullPushes(0), m_peakSize(0)
+	{
+		SetCapacity(capacity);
+	}
+
+	EventQueue::~EventQueue() {}
+
+	void EventQueue::SetCapacity(std::size_t capacity)
+	{
+		std::size_t size = GetRoundedCapacity(capacity);
+
+		m_slots = std::make_unique<Slot[]>(size);
+		for(std::size_t i=0; i<size; i++)
+			m_slots[i].sequence.store(i, std::memory_order_relaxed);
+		m_capacity = size;
+		m_mask = size - 1;
+		m_enqueuePosition.store(0, std::memory_order_relaxed);
+		m_dequeuePosition.store(0, std::memory_order_relaxed);
+		m_peakSize = 0;
+		m_nFullPushes.store(0, std::memory_order_relaxed);
+	}
+
+	std::size_t EventQueue::GetRoundedCapacity(std::size_t capacity)
+	{
+		std::size_t size = 2;
+		while(size < capacity && size <= std::numeric_limits<std::size_t>::max()/4)
+			size <<= 1;
+		return size;
+	}
+
+	//A slot holds the nuclei in its own vector; a symbol too long for the string's inline buffer is on the heap as well
+	std::size_t EventQueue::GetEventBytes(const std::vector<Nucleus>& event)
+	{
+		std::size_t bytes = sizeof(Slot) + event.size()*sizeof(Nucleus);
+		std::size_t inlineCapacity = std::string().capacity();
+		for(auto& nucleus : event)
+		{
+			if(nucleus.isotopicSymbol.capacity() > inlineCapacity)
+				bytes += nucleus.isotopicSymbol.capacity() + 1;
+		}
+		return bytes;
+	}
+
+	void EventQueue::SetNumberOfProducers(std::size_t nProducers)
+	{
+		m_nProducers.store(nProducers);
+	}
+
+	void EventQueue::Push(const std::vector<Nucleus>& data, uint64_t eventIndex, double weight)
+	{
+		if(!TryPush(data, eventIndex, weight))
+			PushWhenFree(data, eventIndex, weight);
+
+		//Pairs with the fence in Pop: either the consumer sees the event before it sleeps, or this sees it asleep
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(m_isConsumerWaiting.load(std::memory_order_relaxed))
+			WakeConsumer();
+	}
+
+	void EventQueue::FinishProducer()
+	{
+		m_nProducers.fetch_sub(1);
+		WakeConsumer();
+	}
+
+	bool EventQueue::Pop(std::vector<Nucleus>& data, uint64_t& eventIndex, double& weight)
+	{
+		while(true)
+		{
+			std::size_t size = GetSize();
+			if(TryPop(data, eventIndex, weight))
+			{
+				m_peakSize = std::max(m_peakSize, size);
+				//Pairs with the fence in PushWhenFree: either the producer sees the free slot before it sleeps, or this sees it asleep
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if(m_nWaitingProducers.load(std::memory_order_relaxed) != 0)
+					WakeProducers();
+				return true;
+			}
+			else if(m_nProducers.load() == 0)
+				return TryPop(data, eventIndex, weight); //Anything pushed before the last producer finished
+
+			std::unique_lock<std::mutex> guard(m_waitMutex);
+			m_isConsumerWaiting.store(true, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			m_wakeCondition.wait(guard, [this]() { return !IsEmpty() || m_nProducers.load() == 0; });
+			m_isConsumerWaiting.store(false, std::memory_order_relaxed);
+		}
+	}
+
+	//A slot is free for position p when its sequence is p; claiming it advances the enqueue position
+	bool EventQueue::TryPush(const std::vector<Nucleus>& data, uint64_t eventIndex, double weight)
+	{
+		std::size_t position = m_enqueuePosition.load(std::memory_order_relaxed);
+		Slot* slot;
+		while(true)
+		{
+			slot = &m_slots[position & m_mask];
+			std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+			std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+			if(difference == 0)
+			{
+				if(m_enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if(difference < 0)
+				return false; //Full: the slot still holds the event from one lap ago
+			else
+				position = m_enqueuePosition.load(std::memory_order_relaxed);
+		}
+
+		slot->eventIndex = eventIndex;
+		slot->weight = weight;
+		slot->data.assign(data.begin(), data.end());
+		slot->sequence.store(position + 1, std::memory_order_release);
+		return true;
+	}
+
+	//Backpressure: a full queue is first waited out by yielding, as the writer usually frees a slot quickly, then by sleeping
+	void EventQueue::PushWhenFree(const std::vector<Nucleus>& data, uint64_t eventIndex, double weight)
+	{
+		m_nFullPushes.fetch_add(1, std::memory_order_relaxed);
+		for(int i=0; i<s_nFullYields; i++)
+		{
+			std::this_thread::yield();
+			if(TryPush(data, eventIndex, weight))
+				return;
+		}
+
+		while(true)
+		{
+			{
+				std::unique_lock<std::mutex> guard(m_spaceMutex);
+				m_nWaitingProducers.fetch_add(1);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				m_spaceCondition.wait(guard, [this]() { return !IsFull(); });
+				m_nWaitingProducers.fetch_sub(1);
+			}
+			if(TryPush(data, eventIndex, weight))
+				return;
+		}
+	}
+
+	//The slot at the dequeue position is ready when its sequence is position + 1; freeing it makes it ready for the next lap
+	bool EventQueue::TryPop(std::vector<Nucleus>& data, uint64_t& eventIndex, double& weight)
+	{
+		if(m_slots == nullptr)
+			return false;
+
+		std::size_t position = m_dequeuePosition.load(std::memory_order_relaxed);
+		Slot& slot = m_slots[position & m_mask];
+		if(slot.sequence.load(std::memory_order_acquire) != position + 1)
+			return false;
+
+		eventIndex = slot.eventIndex;
+		weight = slot.weight;
+		data.swap(slot.data); //Both vectors keep their capacity
+		slot.sequence.store(position + m_capacity, std::memory_order_release);
+		m_dequeuePosition.store(position + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	bool EventQueue::IsEmpty() const
+	{
+		if(m_slots == nullptr)
+			return true;
+
+		std::size_t position = m_dequeuePosition.load(std::memory_order_relaxed);
+		return m_slots[position & m_mask].sequence.load(std::memory_order_acquire) != position + 1;
+	}
+
+	//Full when the slot at the enqueue position still holds the event from one lap ago
+	bool EventQueue::IsFull() const
+	{
+		std::size_t position = m_enqueuePosition.load(std::memory_order_relaxed);
+		std::size_t sequence = m_slots[position & m_mask].sequence.load(std::memory_order_acquire);
+		return static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position) < 0;
+	}
+
+	void EventQueue::WakeConsumer()
+	{
+		std::scoped_lock<std::mutex> guard(m_waitMutex);
+		m_wakeCondition.notify_one();
+	}
+
+	void EventQueue::WakeProducers()
+	{
+		std::scoped_lock<std::mutex> guard(m_spaceMutex);
+		m_spaceCondition.notify_all();
+	}
+
+}
@@ -0,0 +1,101 @@
+/*
+	EventQueue.h
+	Bounded multi-producer, single-consumer queue of events between the worker threads and the FileWriter. It is a ring of
+	preallocated slots, each with a sequence number (D. Vyukov's bounded MPMC queue, used with a single consumer): a producer
+	claims a slot with one compare-and-swap on the enqueue position and publishes it by advancing the slot's sequence, so
+	producers never take a lock. The nuclei are copied into the slot's own vector, which keeps its capacity between uses, so no
+	memory is allocated once the ring has been filled once.
+
+	The consumer sleeps on a condition variable while the queue is empty, instead of polling. Producers only touch the mutex to
+	wake it when it is actually asleep. Pop returns false once the queue is empty and every producer has called FinishProducer.
+
+	The capacity bounds the memory held by queued events (see GetEventBytes, which includes the heap memory of the nuclei of a
+	sample event, i.e. their symbol strings). When the ring is full, producers yield a few
+	times and then sleep until the consumer frees a slot, so a slow writer throttles the workers instead of the queue growing.
+	The deepest the queue got and the number of pushes which found it full are kept, to tune the capacity.
+
+	The slots are only allocated by SetCapacity (or the capacity constructor). A queue without slots must not be pushed to, but
+	still counts its producers, so that Pop waits for them to finish; writers which are filled directly use it that way.
+*/
+#ifndef EVENTQUEUE_H
+#define EVENTQUEUE_H
+
+#include "Nucleus.h"
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+namespace Mask {
+
+	class EventQueue
+	{
+	public:
+		EventQueue(); //No slots until SetCapacity; only counts the producers (see above)
+		EventQueue(std::size_t capacity);
+		~EventQueue();
+
+		void SetCapacity(std::size_t capacity); //Not thread safe! Rounded up to a power of two (at least 2); allocates the slots
+		void SetNumberOfProducers(std::size_t nProducers); //Not thread safe! Call before the producers start
+
+		void Push(const std::vector<Nucleus>& data, uint64_t eventIndex, double weight); //Thread-safe
+		void FinishProducer(); //Thread-safe; called once by each producer when it is done
+		bool Pop(std::vector<Nucleus>& data, uint64_t& eventIndex, double& weight); //Consumer only; blocks while empty
+
+		std::size_t GetSize() const { return m_enqueuePosition.load(std::memory_order_relaxed) - m_dequeuePosition.load(std::memory_order_relaxed); }
+		std::size_t GetCapacity() const { return m_capacity; }
+		std::size_t GetPeakSize() const { return m_peakSize; } //Consumer only
+		uint64_t GetNumberOfFullPushes() const { return m_nFullPushes.load(std::memory_order_relaxed); }
+
+		static std::size_t GetRoundedCapacity(std::size_t capacity); //The capacity SetCapacity gives for capacity
+		static std::size_t GetEventBytes(const std::vector<Nucleus>& event); //Memory held by one queued event like event
+
+		static constexpr std::size_t s_defaultCapacity = 1 << 16;
+
+	private:
+		struct Slot
+		{
+			std::atomic<std::size_t> sequence;
+			uint64_t eventIndex;
+			double weight;
+			std::vector<Nucleus> data;
+		};
+
+		bool TryPush(const std::vector<Nucleus>& data, uint64_t eventIndex, double weight);
+		void PushWhenFree(const std::vector<Nucleus>& data, uint64_t eventIndex, double weight);
+		bool TryPop(std::vector<Nucleus>& data, uint64_t& eventIndex, double& weight);
+		bool IsEmpty() const;
+		bool IsFull() const;
+		void WakeConsumer();
+		void WakeProducers();
+
+		std::unique_ptr<Slot[]> m_slots;
+		std::size_t m_capacity;
+		std::size_t m_mask;
+
+		//Producer and consumer positions are kept on separate cache lines
+		alignas(64) std::atomic<std::size_t> m_enqueuePosition;
+		alignas(64) std::atomic<std::size_t> m_dequeuePosition;
+
+		alignas(64) std::atomic<std::size_t> m_nProducers;
+		std::atomic<bool> m_isConsumerWaiting;
+		std::mutex m_waitMutex;
+		std::condition_variable m_wakeCondition;
+
+		//Backpressure: producers waiting for a free slot
+		alignas(64) std::atomic<std::size_t> m_nWaitingProducers;
+		std::atomic<uint64_t> m_nFullPushes;
+		std::mutex m_spaceMutex;
+		std::condition_variable m_spaceCondition;
+
+		std::size_t m_peakSize;
+
+		static constexpr int s_nFullYields = 16; //Yields before a producer sleeps on a full queue
+	};
+
+}
+
+#endif
@@ -3,12 +3,12 @@
 namespace Mask {
 
     FileReader::FileReader() :
-        m_file(nullptr), m_tree(nullptr), m_branchHandle(nullptr), m_currentEntry(0), m_size(0)
+        m_file(nullptr), m_tree(nullptr), m_branchHandle(nullptr), m_eventHandle(0), m_hasEventBranch(false), m_weightHandle(1.0), m_hasWeightBranch(false), m_currentEntry(0), m_size(0)
     {
     }
 
     FileReader::FileReader(const std::string& filename, const std::string& treename) :
-        m_file(nullptr), m_tree(nullptr), m_branchHandle(nullptr), m_currentEntry(0), m_size(0)
+        m_file(nullptr), m_tree(nullptr), m_branchHandle(nullptr), m_eventHandle(0), m_hasEventBranch(false), m_weightHandle(1.0), m_hasWeightBranch(false), m_currentEntry(0), m_size(0)
     {
         Open(filename, treename);
     }
@@ -35,7 +35,15 @@ namespace Mask {
             }
             m_branchHandle = new std::vector<Nucleus>();
             m_tree->SetBranchAddress("nuclei", &m_branchHandle);
+            m_hasEventBranch = m_tree->GetBranch("event") != nullptr;
+            if(m_hasEventBranch)
+                m_tree->SetBranchAddress("event", &m_eventHandle);
+            m_hasWeightBranch = m_tree->GetBranch("weight") != nullptr;
+            if(m_hasWeightBranch)
+                m_tree->SetBranchAddress("weight", &m_weightHandle);
             m_size = m_tree->GetEntries();
+            if(m_size != 0 && m_tree->GetEntry(0) != 0)
+                m_firstEntry = *m_branchHandle;
             m_currentEntry = 0; //Reset file position
         }
     }
@@ -51,12 +59,26 @@ namespace Mask {
     }
 
     bool FileReader::Read(std::vector<Nucleus>& dataHandle)
+    {
+        uint64_t eventIndex;
+        return Read(dataHandle, eventIndex);
+    }
+
+    bool FileReader::Read(std::vector<Nucleus>& dataHandle, uint64_t& eventIndex)
+    {
+        double weight;
+        return Read(dataHandle, eventIndex, weight);
+    }
+
+    bool FileReader::Read(std::vector<Nucleus>& dataHandle, uint64_t& eventIndex, double& weight)
     {
         std::scoped_lock<std::mutex> guard(m_fileMutex);
         int bytes = m_tree->GetEntry(m_currentEntry);
         if(bytes != 0)
         {
             dataHandle = *m_branchHandle;
+            eventIndex = m_hasEventBranch ? m_eventHandle : m_currentEntry.load();
+            weight = m_hasWeightBranch ? m_weightHandle : 1.0;
             m_currentEntry++;
             return true;
         }
@@ -27,7 +27,11 @@ namespace Mask {
             Read: fills entry to given dataHandle. Returns true if data was successfully filled, otherwise returns false
         */
         bool Read(std::vector<Nucleus>& dataHandle); //Thread safe
+        bool Read(std::vector<Nucleus>& dataHandle, uint64_t& eventIndex); //Thread safe, also gives the event index of the entry
+        bool Read(std::vector<Nucleus>& dataHandle, uint64_t& eventIndex, double& weight); //Thread safe, also gives the event weight
         uint64_t GetSize() { return m_size; }//In entries (implicitly thread safe)
+        std::size_t GetNumberOfNuclei() const { return m_firstEntry.size(); } //In the first entry
+        const std::vector<Nucleus>& GetFirstEntry() const { return m_firstEntry; } //Every entry has the same nuclei, i.e. for setting up per-species data
         bool IsOpen() { return m_file == nullptr ? false : m_file->IsOpen(); } //Should be safe?
         bool IsTree() { return m_tree != nullptr; } //Should be safe?
 
@@ -36,10 +40,15 @@ namespace Mask {
         TTree* m_tree;
 
         std::vector<Nucleus>* m_branchHandle;
+        ULong64_t m_eventHandle;
+        bool m_hasEventBranch; //Older files have no event branch; the entry number is used instead
+        Double_t m_weightHandle;
+        bool m_hasWeightBranch; //Older files have no weight branch; every event has weight 1
 
         std::mutex m_fileMutex;
         std::atomic<uint64_t> m_currentEntry;
         std::atomic<uint64_t> m_size; //in entries
+        std::vector<Nucleus> m_firstEntry;
     };
 }
 
@@ -1,21 +1,21 @@
 #include "FileWriter.h"
 
+#include <iostream>
+#include <algorithm>
+
 namespace Mask {
 
     FileWriter::FileWriter() :
-        m_file(nullptr), m_tree(nullptr), m_queueSize(0)
+        m_file(nullptr), m_mergerFile(nullptr), m_tree(nullptr), m_weightHandle(1.0), m_unmergedBytes(0)
     {
     }
 
     FileWriter::FileWriter(const std::string& filename, const std::string& treename) :
-        m_file(nullptr), m_tree(nullptr)
+        m_file(nullptr), m_mergerFile(nullptr), m_tree(nullptr), m_weightHandle(1.0), m_unmergedBytes(0)
     {
         m_file = TFile::Open(filename.c_str(), "RECREATE");
         if(m_file != nullptr && m_file->IsOpen())
-        {
-            m_tree = new TTree(treename.c_str(), treename.c_str());
-            m_tree->Branch("nuclei", &m_dataHandle);
-        }
+            CreateTree(treename);
     }
 
     FileWriter::~FileWriter()
@@ -30,15 +30,37 @@ namespace Mask {
 
         m_file = TFile::Open(filename.c_str(), "RECREATE");
         if(m_file != nullptr && m_file->IsOpen())
-        {
-            m_tree = new TTree(treename.c_str(), treename.c_str());
-            m_tree->Branch("nuclei", &m_dataHandle);
-        }
+            CreateTree(treename);
+    }
+
+    /*
+        The tree is filled into a file of the merger, which is in memory; its compressed baskets are sent to the merger whenever
+        the file passes the merger's auto save size, and on Close. The file is created here so that it is the current directory
+        of the filling thread when the tree is made.
+    */
+    void FileWriter::Open(BufferMerger& merger, const std::string& treename)
+    {
+        if(IsOpen())
+            Close();
+
+        m_mergerFile = merger.GetFile();
+        m_mergerFile->cd();
+        CreateTree(treename);
+        m_unmergedBytes = 0;
     }
 
     void FileWriter::Close()
     {
-        if(m_file->IsOpen())
+        if(m_mergerFile != nullptr)
+        {
+            m_mergerFile->Write();
+            delete m_tree; //Before its file
+            m_tree = nullptr;
+            m_mergerFile.reset();
+            return;
+        }
+
+        if(m_file != nullptr && m_file->IsOpen())
         {
             if(m_tree != nullptr)
                 m_tree->Write(m_tree->GetName(), TObject::kOverwrite);
@@ -46,30 +68,71 @@ namespace Mask {
             m_file->Close();
             delete m_file;
             m_file = nullptr;
+            m_tree = nullptr; //Owned by the file
         }
     }
 
-    void FileWriter::PushData(const std::vector<Nucleus>& data)
+    void FileWriter::CreateTree(const std::string& treename)
     {
-        std::scoped_lock<std::mutex> guard(m_queueMutex);
-        m_queue.push(data);
-        ++m_queueSize;
+        m_tree = new TTree(treename.c_str(), treename.c_str());
+        m_tree->Branch("nuclei", &m_dataHandle);
+        m_tree->Branch("event", &m_eventHandle);
+        m_tree->Branch("weight", &m_weightHandle);
     }
 
-    bool FileWriter::Write()
+    //The queue rounds the capacity up to a power of two; only the memory limit brings it back down, to the power of two below it
+    std::size_t FileWriter::SetQueueCapacity(uint64_t maxEvents, double maxMemory, const std::vector<Nucleus>& sampleEvent)
     {
-        if(m_queueSize == 0)
-            return false;
-
-        //Aquire lock for as short a time as possible
+        std::size_t capacity = EventQueue::GetRoundedCapacity(maxEvents);
+        if(maxMemory > 0.0)
         {
-            std::scoped_lock<std::mutex> guard(m_queueMutex);
-            m_dataHandle = m_queue.front();
-            m_queue.pop();
+            double memoryEvents = maxMemory*s_bytesPerMB/EventQueue::GetEventBytes(sampleEvent);
+            while(capacity > 2 && capacity > memoryEvents)
+                capacity >>= 1;
         }
-        --m_queueSize;
+        m_queue.SetCapacity(capacity);
+        return m_queue.GetCapacity();
+    }
 
+    void FileWriter::PrintQueueStatistics() const
+    {
+        std::cout << "Peak writer queue depth: " << m_queue.GetPeakSize() << " of " << m_queue.GetCapacity() << " events" << std::endl;
+        if(m_queue.GetNumberOfFullPushes() != 0)
+            std::cout << "Events held back by a full writer queue: " << m_queue.GetNumberOfFullPushes() << std::endl;
+    }
+
+    void FileWriter::PushData(const std::vector<Nucleus>& data, uint64_t eventIndex, double weight)
+    {
+        m_queue.Push(data, eventIndex, weight);
+    }
+
+    bool FileWriter::Write()
+    {
+        uint64_t eventIndex;
+        if(!m_queue.Pop(m_dataHandle, eventIndex, m_weightHandle))
+            return false;
+
+        m_eventHandle = eventIndex;
         m_tree->Fill();
         return true;
     }
-}
\ No newline at end of file
+
+    void FileWriter::Fill(const std::vector<Nucleus>& data, uint64_t eventIndex, double weight)
+    {
+        m_dataHandle = data;
+        m_eventHandle = eventIndex;
+        m_weightHandle = weight;
+        Int_t nBytes = m_tree->Fill();
+
+        //A BufferMerger file only hands its data to the merger on Write, so it is written out regularly to bound its memory
+        if(m_mergerFile != nullptr && nBytes > 0)
+        {
+            m_unmergedBytes += nBytes;
+            if(m_unmergedBytes >= s_mergerFlushBytes)
+            {
+                m_mergerFile->Write();
+                m_unmergedBytes = 0;
+            }
+        }
+    }
+}
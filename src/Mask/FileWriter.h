@@ -2,16 +2,58 @@
 #define FILE_WRITER_H
 
 #include "Nucleus.h"
+#include "EventQueue.h"
 
 #include "TFile.h"
 #include "TTree.h"
+#include "RVersion.h"
+#include "ROOT/TBufferMerger.hxx"
 
-#include <queue>
-#include <mutex>
-#include <atomic>
+#include <string>
+#include <memory>
 
 namespace Mask {
 
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,26,0)
+    using BufferMerger = ROOT::TBufferMerger;
+    using BufferMergerFile = ROOT::TBufferMergerFile;
+#else
+    using BufferMerger = ROOT::Experimental::TBufferMerger;
+    using BufferMergerFile = ROOT::Experimental::TBufferMergerFile;
+#endif
+
+    /*
+        Queue: the worker threads queue their events for a single writer thread. Shards: each worker thread fills its own file.
+        BufferMerger: each worker thread fills its own in-memory file, whose compressed baskets are merged into the one output file
+    */
+    enum class WriterMode
+    {
+        Queue,
+        Shards,
+        BufferMerger
+    };
+
+    static WriterMode StringToWriterMode(const std::string& mode)
+    {
+        if(mode == "Shards")
+            return WriterMode::Shards;
+        else if(mode == "BufferMerger")
+            return WriterMode::BufferMerger;
+        else
+            return WriterMode::Queue;
+    }
+
+    static std::string WriterModeToString(WriterMode mode)
+    {
+        switch(mode)
+        {
+            case WriterMode::Queue: return "Queue";
+            case WriterMode::Shards: return "Shards";
+            case WriterMode::BufferMerger: return "BufferMerger";
+            default: return "Queue";
+        }
+    }
+
     class FileWriter
     {
     public:
@@ -19,26 +61,47 @@ namespace Mask {
         FileWriter(const std::string& filename, const std::string& treename);
         ~FileWriter();
 
-        bool IsOpen() const { return m_file == nullptr ? false : m_file->IsOpen(); }
+        bool IsOpen() const { return m_mergerFile != nullptr || (m_file == nullptr ? false : m_file->IsOpen()); }
         bool IsTree() const { return m_tree == nullptr ? false : true; }
 
-        std::size_t GetQueueSize() const { return m_queueSize; } //Implicitly thread-safe
+        std::size_t GetQueueSize() const { return m_queue.GetSize(); } //Implicitly thread-safe
+        std::size_t GetQueueCapacity() const { return m_queue.GetCapacity(); }
+        std::size_t GetPeakQueueSize() const { return m_queue.GetPeakSize(); } //Should only be used by main application loop
+        uint64_t GetNumberOfFullPushes() const { return m_queue.GetNumberOfFullPushes(); } //Pushes which had to wait for the writer
+
+        //Capacity of the queue in events, further limited to maxMemory (in MB, 0 for no limit) of queued events like sampleEvent
+        std::size_t SetQueueCapacity(uint64_t maxEvents, double maxMemory, const std::vector<Nucleus>& sampleEvent); //Not thread safe!
+        void PrintQueueStatistics() const; //Should only be used by main application loop, after the writing
 
-        void PushData(const std::vector<Nucleus>& data); //Thread-safe
-        bool Write(); //Not completely thread-safe, should only be used by main application loop (acess to queue is safe, but all else not)
+        //Each producer calls FinishProducer once when it has pushed all of its events
+        void SetNumberOfProducers(std::size_t nProducers) { m_queue.SetNumberOfProducers(nProducers); } //Not thread safe!
+        void FinishProducer() { m_queue.FinishProducer(); } //Thread-safe
+
+        void PushData(const std::vector<Nucleus>& data, uint64_t eventIndex, double weight); //Thread-safe, lock-free; after SetQueueCapacity
+        //Should only be used by main application loop. Sleeps until an event is queued; returns false once all producers are finished and the queue is empty
+        bool Write();
+        void Fill(const std::vector<Nucleus>& data, uint64_t eventIndex, double weight); //Not thread safe! Writes without the queue, for a writer owned by one thread
 
         void Open(const std::string& filename, const std::string& treename); //Not thread safe!
+        void Open(BufferMerger& merger, const std::string& treename); //Not thread safe! Should be called by the thread which fills the writer
         void Close(); //Not thread safe!
 
     private:
+        void CreateTree(const std::string& treename);
+
         TFile* m_file;
+        std::shared_ptr<BufferMergerFile> m_mergerFile; //BufferMerger mode, instead of the file
         TTree* m_tree;
 
         std::vector<Nucleus> m_dataHandle;
+        ULong64_t m_eventHandle; //Entries are filled in the order they are pushed; the event index identifies them
+        Double_t m_weightHandle; //Importance sampling weight; 1 unless the generation was biased
+        std::size_t m_unmergedBytes; //BufferMerger mode: bytes filled since the file was last handed to the merger
+
+        EventQueue m_queue; //Slots allocated by SetQueueCapacity only, so writers which are filled directly never allocate them
 
-        std::mutex m_queueMutex;
-        std::atomic<std::size_t> m_queueSize;
-        std::queue<std::vector<Nucleus>> m_queue;
+        static constexpr double s_bytesPerMB = 1.0e6;
+        static constexpr std::size_t s_mergerFlushBytes = 32000000; //Uncompressed bytes filled into a BufferMerger file before it is written to the merger
     };
 }
 
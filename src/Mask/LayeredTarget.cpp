@@ -12,11 +12,13 @@ Written by G.W. McCann Aug. 2020
 */
 #include "LayeredTarget.h"
 #include <iostream>
+#include <algorithm>
+#include <limits>
 
 namespace Mask {
 
 	LayeredTarget::LayeredTarget() :
-		m_name("")
+		m_name(""), m_elossMode(EnergyLossMode::Tabulated), m_elossCacheDirectory("")
 	{
 	}
 	
@@ -26,6 +28,30 @@ namespace Mask {
 	void LayeredTarget::AddLayer(const std::vector<int>& Z, const std::vector<int>& A, const std::vector<int>& stoich, double thickness)
 	{
 		m_layers.emplace_back(Z, A, stoich, thickness);
+		m_layers.back().SetEnergyLossMode(m_elossMode);
+		m_layers.back().SetEnergyLossCacheDirectory(m_elossCacheDirectory);
+	}
+
+	/*Precompute the range tables of a projectile species for every layer. Must be called before the target is shared with the reaction systems*/
+	void LayeredTarget::BuildEnergyLossTables(const Species& species)
+	{
+		for(auto& layer : m_layers)
+			layer.BuildEnergyLossTable(species);
+	}
+
+	void LayeredTarget::SetEnergyLossMode(EnergyLossMode mode)
+	{
+		m_elossMode = mode;
+		for(auto& layer : m_layers)
+			layer.SetEnergyLossMode(mode);
+	}
+
+	/*Directory where range tables are stored between runs. An empty directory disables the cache*/
+	void LayeredTarget::SetEnergyLossCacheDirectory(const std::string& directory)
+	{
+		m_elossCacheDirectory = directory;
+		for(auto& layer : m_layers)
+			layer.SetEnergyLossCacheDirectory(directory);
 	}
 	
 	/*
@@ -33,7 +59,7 @@ namespace Mask {
 	  Calculates energy loss assuming that the reaction occurs in the middle of the target layer
 	  Note that the layer order can matter!
 	*/
-	double LayeredTarget::GetProjectileEnergyLoss(int zp, int ap, double startEnergy, std::size_t rxnLayer, double angle, double rxnDepth)
+	double LayeredTarget::GetProjectileEnergyLoss(const Species& projectile, double startEnergy, std::size_t rxnLayer, double angle, double rxnDepth) const
 	{
 		if(rxnLayer > m_layers.size())
 		{
@@ -48,12 +74,12 @@ namespace Mask {
 		{
 			if(i == rxnLayer)
 			{
-				eloss += m_layers[i].GetEnergyLossFractionalDepth(zp, ap, newEnergy, angle, rxnDepth);
+				eloss += m_layers[i].GetEnergyLossFractionalDepth(projectile, newEnergy, angle, rxnDepth);
 				newEnergy = startEnergy - eloss;
 			}
 			else
 			{
-				eloss += m_layers[i].GetEnergyLossTotal(zp, ap, newEnergy, angle);
+				eloss += m_layers[i].GetEnergyLossTotal(projectile, newEnergy, angle);
 				newEnergy = startEnergy-eloss;
 			}
 		}
@@ -66,7 +92,7 @@ namespace Mask {
 	  Calculates energy loss assuming that the reaction occurs in the middle of the target
 	  Note that the layer order can matter!
 	*/
-	double LayeredTarget::GetEjectileEnergyLoss(int ze, int ae, double startEnergy, std::size_t rxnLayer, double angle, double rxnDepth) {
+	double LayeredTarget::GetEjectileEnergyLoss(const Species& ejectile, double startEnergy, std::size_t rxnLayer, double angle, double rxnDepth) const {
 	
 		if(rxnLayer > m_layers.size())
 		{
@@ -78,39 +104,104 @@ namespace Mask {
 		if(angle < M_PI/2.0)
 		{
 			double newEnergy = startEnergy;
-			eloss += m_layers[rxnLayer].GetEnergyLossFractionalDepth(ze, ae, newEnergy, angle, (1.0 - rxnDepth));
+			eloss += m_layers[rxnLayer].GetEnergyLossFractionalDepth(ejectile, newEnergy, angle, (1.0 - rxnDepth));
 			newEnergy = startEnergy - eloss;
 			if(rxnLayer == m_layers.size())
 				return eloss;
 
 			for(std::size_t i=(rxnLayer+1); i<m_layers.size(); i++)
 			{
-				eloss += m_layers[i].GetEnergyLossTotal(ze, ae, newEnergy, angle);
+				eloss += m_layers[i].GetEnergyLossTotal(ejectile, newEnergy, angle);
 				newEnergy = startEnergy - eloss;
 			}
 		}
 		else
 		{ //Travelling backwards through target
 			double newEnergy = startEnergy;
-			eloss += m_layers[rxnLayer].GetEnergyLossFractionalDepth(ze, ae, newEnergy, angle, rxnDepth);
+			eloss += m_layers[rxnLayer].GetEnergyLossFractionalDepth(ejectile, newEnergy, angle, rxnDepth);
 			newEnergy = startEnergy - eloss;
 			if(rxnLayer == 0)
 				return eloss;
 
 			for(std::size_t i=rxnLayer-1; i>0; i--) //unsigned ints cant be less than 0
 			{
-				eloss += m_layers[i].GetEnergyLossTotal(ze, ae, newEnergy, angle);
+				eloss += m_layers[i].GetEnergyLossTotal(ejectile, newEnergy, angle);
 				newEnergy = startEnergy - eloss;
 			}
-			eloss += m_layers[0].GetEnergyLossTotal(ze, ae, newEnergy, angle);
+			eloss += m_layers[0].GetEnergyLossTotal(ejectile, newEnergy, angle);
 			newEnergy = startEnergy - eloss;
 		}
 	
 		return eloss;
 	}
 	
+	/*
+	  Batched version of GetEjectileEnergyLoss for n particles of one species created in rxnLayer.
+	  All particles first cross their part of the reaction layer. Then, stepping outward from the reaction layer, the forward
+	  going particles are packed into one batch for layer rxnLayer+d and the backward going particles into one for layer rxnLayer-d.
+	*/
+	void LayeredTarget::GetEjectileEnergyLoss(const Species& ejectile, const double* startEnergies, const double* angles, const double* rxnDepths,
+											  std::size_t rxnLayer, double* elosses, std::size_t n) const
+	{
+		if(rxnLayer >= m_layers.size())
+		{
+			std::cerr<<"Reaction layer in eloss calculation is not in range! Returning 0"<<std::endl;
+			std::fill(elosses, elosses + n, 0.0);
+			return;
+		}
+
+		//Path length is thickness*secant; a particle parallel to the target loses all of its energy
+		auto getPathThickness = [](double thickness, double secant)
+		{
+			return std::isinf(secant) ? secant : thickness*secant;
+		};
+
+		std::vector<double> secants(n), energies(n), thicknesses(n), layerLoss(n);
+		std::vector<std::size_t> forward, backward;
+		forward.reserve(n);
+		backward.reserve(n);
+		double rxnThickness = m_layers[rxnLayer].GetThickness_gcm2();
+		for(std::size_t i=0; i<n; i++)
+		{
+			double theta = angles[i] > M_PI/2.0 ? M_PI - angles[i] : angles[i];
+			secants[i] = angles[i] == M_PI/2.0 ? std::numeric_limits<double>::infinity() : 1.0/std::fabs(std::cos(theta));
+			if(angles[i] < M_PI/2.0)
+			{
+				forward.push_back(i);
+				thicknesses[i] = getPathThickness(rxnThickness*(1.0 - rxnDepths[i]), secants[i]);
+			}
+			else
+			{
+				backward.push_back(i);
+				thicknesses[i] = getPathThickness(rxnThickness*rxnDepths[i], secants[i]);
+			}
+		}
+		m_layers[rxnLayer].GetEnergyLoss(ejectile, startEnergies, thicknesses.data(), elosses, n);
+
+		auto crossLayer = [&](const Target& layer, const std::vector<std::size_t>& members)
+		{
+			double layerThickness = layer.GetThickness_gcm2();
+			for(std::size_t j=0; j<members.size(); j++)
+			{
+				energies[j] = startEnergies[members[j]] - elosses[members[j]];
+				thicknesses[j] = getPathThickness(layerThickness, secants[members[j]]);
+			}
+			layer.GetEnergyLoss(ejectile, energies.data(), thicknesses.data(), layerLoss.data(), members.size());
+			for(std::size_t j=0; j<members.size(); j++)
+				elosses[members[j]] += layerLoss[j];
+		};
+
+		for(std::size_t step=1; step<m_layers.size(); step++)
+		{
+			if(rxnLayer + step < m_layers.size() && !forward.empty())
+				crossLayer(m_layers[rxnLayer + step], forward);
+			if(step <= rxnLayer && !backward.empty())
+				crossLayer(m_layers[rxnLayer - step], backward);
+		}
+	}
+	
 	/*ReverseEnergyLoss version of GetEjectileEnergyLoss*/
-	double LayeredTarget::GetEjectileReverseEnergyLoss(int ze, int ae, double startEnergy, std::size_t rxnLayer, double angle, double rxnDepth)
+	double LayeredTarget::GetEjectileReverseEnergyLoss(const Species& ejectile, double startEnergy, std::size_t rxnLayer, double angle, double rxnDepth) const
 	{
 		if(rxnLayer > m_layers.size())
 		{
@@ -125,10 +216,10 @@ namespace Mask {
 			double newEnergy = startEnergy;
 			for(std::size_t i=(m_layers.size()-1); i>rxnLayer; i--)
 			{
-				eloss += m_layers[i].GetReverseEnergyLossTotal(ze, ae, newEnergy, angle);
+				eloss += m_layers[i].GetReverseEnergyLossTotal(ejectile, newEnergy, angle);
 				newEnergy = startEnergy + eloss;
 			}
-			eloss += m_layers[rxnLayer].GetReverseEnergyLossFractionalDepth(ze, ae, newEnergy, angle, rxnDepth);
+			eloss += m_layers[rxnLayer].GetReverseEnergyLossFractionalDepth(ejectile, newEnergy, angle, rxnDepth);
 			newEnergy = startEnergy + eloss;
 		}
 		else
@@ -136,17 +227,17 @@ namespace Mask {
 			double newEnergy = startEnergy;
 			for(std::size_t i=0; i < rxnLayer; i++)
 			{
-				eloss += m_layers[i].GetReverseEnergyLossTotal(ze, ae, newEnergy, angle);
+				eloss += m_layers[i].GetReverseEnergyLossTotal(ejectile, newEnergy, angle);
 				newEnergy = startEnergy + eloss;
 			}
-			eloss += m_layers[rxnLayer].GetReverseEnergyLossFractionalDepth(ze, ae, newEnergy, angle, rxnDepth);
+			eloss += m_layers[rxnLayer].GetReverseEnergyLossFractionalDepth(ejectile, newEnergy, angle, rxnDepth);
 			newEnergy = startEnergy + eloss;
 		}
 	
 		return eloss;
 	}
 	
-	std::size_t LayeredTarget::FindLayerContaining(int Z, int A)
+	std::size_t LayeredTarget::FindLayerContaining(int Z, int A) const
 	{
 		for(std::size_t i=0; i<m_layers.size(); i++)
 		{
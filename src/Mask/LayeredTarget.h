@@ -5,6 +5,9 @@ Functional unit for targets in the Mask environment. Contains a
 set (read: vector) of Targets for use in reaction calculations. In this
 way handles situations such as carbon backed targets
 
+All energy loss methods are const; once the layers and tables are built a single
+LayeredTarget is shared read-only by every ReactionSystem (and thread).
+
 Based on code by D.W. Visser written at Yale for the original SPANC
 
 Written by G.W. McCann Aug. 2020
@@ -27,18 +30,27 @@ namespace Mask {
 		LayeredTarget();
 		~LayeredTarget();
 		void AddLayer(const std::vector<int>& Z, const std::vector<int>& A, const std::vector<int>& stoich, double thickness);
-		double GetProjectileEnergyLoss(int zp, int ap, double startEnergy, std::size_t rxnLayer, double angle, double rxnDepth);
-		double GetEjectileEnergyLoss(int ze, int ae, double startEnergy, std::size_t rxnLayer, double angle, double rxnDepth);
-		double GetEjectileReverseEnergyLoss(int ze, int ae, double startEnergy, std::size_t rxnLayer, double angle, double rxnDepth);
-		std::size_t FindLayerContaining(int Z, int A);
+		double GetProjectileEnergyLoss(const Species& projectile, double startEnergy, std::size_t rxnLayer, double angle, double rxnDepth) const;
+		double GetEjectileEnergyLoss(const Species& ejectile, double startEnergy, std::size_t rxnLayer, double angle, double rxnDepth) const;
+		double GetEjectileReverseEnergyLoss(const Species& ejectile, double startEnergy, std::size_t rxnLayer, double angle, double rxnDepth) const;
+		void GetEjectileEnergyLoss(const Species& ejectile, const double* startEnergies, const double* angles, const double* rxnDepths,
+								   std::size_t rxnLayer, double* elosses, std::size_t n) const;
+		std::size_t FindLayerContaining(int Z, int A) const;
+		void BuildEnergyLossTables(const Species& species);
+		void SetEnergyLossMode(EnergyLossMode mode);
+		EnergyLossMode GetEnergyLossMode() const { return m_elossMode; }
+		void SetEnergyLossCacheDirectory(const std::string& directory);
+		const std::string& GetEnergyLossCacheDirectory() const { return m_elossCacheDirectory; }
 		std::size_t GetNumberOfLayers() const { return m_layers.size(); }
 		void SetName(std::string& n) { m_name = n; }
 		const Target& GetLayerInfo(int index) const { return m_layers[index]; }
-		const std::string& GetName() { return m_name; }
+		const std::string& GetName() const { return m_name; }
 	
 	private:
 		std::vector<Target> m_layers;
 		std::string m_name;
+		EnergyLossMode m_elossMode;
+		std::string m_elossCacheDirectory;
 	};
 
 }
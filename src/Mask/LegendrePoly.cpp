@@ -3,14 +3,22 @@
 
 namespace Mask {
 
+	//Bonnet recursion, evaluated upward from P_0 and P_1
 	double P_l(int l, double x)
 	{
 		if(l == 0)
 			return 1.0;
-		else if (l == 1)
-			return x;
-		else
-			return (2.0*l - 1.0)/l*x*P_l(l-1, x) - (l-1.0)/l*P_l(l-2, x);
+
+		double previous = 1.0;
+		double current = x;
+		double next;
+		for(int n=2; n<=l; n++)
+		{
+			next = ((2.0*n - 1.0)*x*current - (n - 1.0)*previous)/n;
+			previous = current;
+			current = next;
+		}
+		return current;
 	}
 	
 	double Normed_P_l_sq(int l, double x)
@@ -1,17 +1,20 @@
 #include "MaskApp.h"
 #include "ConfigSerializer.h"
+#include "RandomGenerator.h"
 #include <fstream>
 #include <iostream>
+#include <algorithm>
 
 #include "TFile.h"
 #include "TTree.h"
+#include "TROOT.h"
 
 #include "yaml-cpp/yaml.h"
 
 namespace Mask {
 
 	MaskApp::MaskApp() :
-		m_resources(nullptr)
+		m_nextEvent(0), m_eventsPerRange(s_eventsPerRange), m_resources(nullptr)
 	{
 		std::cout<<"----------Monte Carlo Simulation of Kinematics----------"<<std::endl;
 	}
@@ -41,26 +44,80 @@ namespace Mask {
 				std::cerr<<"Failure to parse reaction system... configuration not loaded."<<std::endl;
 				return false;
 			}
+			m_systemList.back()->SetAngularSamplingMode(m_params.angularSamplingMode);
 		}
-		//Link the target
+		//Build the energy loss tables once, before the target is shared with the systems
+		for(auto& nucleus : *(m_systemList[0]->GetNuclei()))
+			m_params.target.BuildEnergyLossTables(SpeciesLookup::GetInstance().FindSpecies(nucleus.Z, nucleus.A));
+		//The beam energy loss map is the same for every system, so it is built once as well
+		m_systemList[0]->BuildBeamEnergyLossMap(m_params.target, m_beamElossMap);
+		//Link the target. Every system (thread) reads from the same target and map; they are not modified after this point
 		for(auto system : m_systemList)
 		{
-			system->SetLayeredTarget(m_params.target);
+			system->SetLayeredTarget(m_params.target, &m_beamElossMap);
 		}
+		//Bias the angles of one step towards the detectors. The map is shared read-only, like the target
+		if(!m_params.acceptanceMapFile.empty())
+		{
+			//The map is of lab directions, so it can only bias a step whose angles are sampled in the lab
+			std::size_t biasStep = m_params.acceptanceBiasStep - 1;
+			if(biasStep >= m_params.chainParams.size() || m_params.chainParams[biasStep].rxnType != RxnType::Reaction ||
+			   m_params.chainParams[biasStep].thetaType != RxnThetaType::Lab)
+			{
+				std::cerr << "Acceptance biasing requires AcceptanceBiasStep to be a reaction with ThetaType Lab -> step: "
+						  << m_params.acceptanceBiasStep << std::endl;
+				return false;
+			}
+			if(!m_acceptanceMap.ReadMapFile(m_params.acceptanceMapFile))
+				return false;
+			for(auto system : m_systemList)
+			{
+				if(!system->SetAcceptanceBias(&m_acceptanceMap, m_params.acceptanceBiasStep - 1, m_params.acceptanceBiasFloor))
+					return false;
+			}
+		}
+		//Every event draws from its own stream of this seed, so the output does not depend on the number of threads
+		RandomGenerator::SetSeed(m_params.seed);
+		RandomGenerator::SetSamplingMode(m_params.samplingMode);
 		//Setup threading
-		m_resources = std::make_unique<ThreadPool<ReactionSystem*, uint64_t>>(m_params.nThreads);
-		//Little bit of integer division mangling to make sure we do the total number of samples
-    	uint64_t quotient = m_params.nSamples / m_params.nThreads;
-    	uint64_t remainder = m_params.nSamples % m_params.nThreads;
-    	m_chunkSamples.push_back(quotient + remainder);
-    	for(uint64_t i=1; i<m_params.nThreads; i++)
-        	m_chunkSamples.push_back(quotient);
-		m_fileWriter.Open(m_params.outputFileName, "SimTree");
-
+		m_resources = std::make_unique<ThreadPool<ReactionSystem*>>(m_params.nThreads);
+		//Ranges hold whole batches, so only the last range of the run ends in a partial batch
+		m_eventsPerRange = s_eventsPerRange;
+		if(m_params.batchSize > 0)
+			m_eventsPerRange = (s_eventsPerRange + m_params.batchSize - 1)/m_params.batchSize*m_params.batchSize;
+		if(m_params.writerMode != WriterMode::Queue)
+		{
+			//Every thread fills its own file, on disk or in memory for the merger
+			ROOT::EnableThreadSafety();
+			if(!m_shardWriter.Open(m_params.outputFileName, "SimTree", m_params.nThreads, m_params.writerMode))
+				return false;
+		}
+		else
+		{
+			m_fileWriter.Open(m_params.outputFileName, "SimTree");
+			m_fileWriter.SetQueueCapacity(m_params.writerQueueCapacity, m_params.writerQueueMemory, *(m_systemList[0]->GetNuclei()));
+		}
 
 		std::cout << "Reaction equation: " << m_systemList[0]->GetSystemEquation() << std::endl;
 		std::cout << "Number of samples: " << m_params.nSamples << std::endl;
 		std::cout << "Number of threads: " << m_params.nThreads << std::endl;
+		std::cout << "Random seed: " << m_params.seed << std::endl;
+		std::cout << "Sampling mode: " << SamplingModeToString(m_params.samplingMode) << std::endl;
+		std::cout << "Batch size: " << m_params.batchSize << std::endl;
+		std::cout << "Writer mode: " << WriterModeToString(m_params.writerMode) << std::endl;
+		if(m_params.writerMode == WriterMode::BufferMerger)
+			std::cout << "Output merged from per-thread buffers" << std::endl;
+		else if(m_params.writerMode == WriterMode::Shards)
+			std::cout << "Output shards: " << ShardedFileWriter::GetShardFileName(m_params.outputFileName, 0) << " ... (" << (m_params.mergeShards ? "merged" : "chained") << " at the end)" << std::endl;
+		else
+			std::cout << "Writer queue capacity: " << m_fileWriter.GetQueueCapacity() << " events" << std::endl;
+		std::cout << "Angular sampling mode: " << AngularSamplingModeToString(m_params.angularSamplingMode) << std::endl;
+		if(!m_params.acceptanceMapFile.empty())
+			std::cout << "Acceptance map: " << m_params.acceptanceMapFile << " (biasing step " << m_params.acceptanceBiasStep << ", mean acceptance "
+					  << m_acceptanceMap.GetMeanAcceptance() << ", floor " << m_params.acceptanceBiasFloor << ")" << std::endl;
+		std::cout << "Energy loss mode: " << EnergyLossModeToString(m_params.target.GetEnergyLossMode()) << std::endl;
+		if(!m_params.target.GetEnergyLossCacheDirectory().empty())
+			std::cout << "Energy loss table cache: " << m_params.target.GetEnergyLossCacheDirectory() << std::endl;
 		std::cout << "Outputing data to file: " << m_params.outputFileName << std::endl;
 		return true;
 	}
@@ -71,6 +128,58 @@ namespace Mask {
 		return ConfigSerializer::SerializeConfig(filename, m_params);
 	}
 	
+	//Events go to the thread's own shard if it has one, otherwise to the writer queue
+	void MaskApp::WriteEvent(FileWriter* shard, const std::vector<Nucleus>& nuclei, uint64_t eventIndex, double weight)
+	{
+		if(shard != nullptr)
+			shard->Fill(nuclei, eventIndex, weight);
+		else
+			m_fileWriter.PushData(nuclei, eventIndex, weight);
+	}
+
+	/*
+		Work of one thread: ranges of events are taken from the shared counter until none are left, so threads which get slower
+		events (rejection loops, long chains) simply take fewer ranges. Each event draws from its own random stream, so which
+		thread runs it does not change it.
+	*/
+	void MaskApp::RunWorker(ReactionSystem* system, FileWriter* shard)
+	{
+		if(system == nullptr)
+			return;
+
+		//Nuclei are only assembled from the batch columns when handed to the writer
+		EventBatch batch;
+		std::vector<Nucleus> nuclei = *(system->GetNuclei());
+		uint64_t rangeStart, rangeEnd;
+		while((rangeStart = m_nextEvent.fetch_add(m_eventsPerRange, std::memory_order_relaxed)) < m_params.nSamples)
+		{
+			rangeEnd = std::min(rangeStart + m_eventsPerRange, m_params.nSamples);
+			if(m_params.batchSize == 0)
+			{
+				for(uint64_t i=rangeStart; i<rangeEnd; i++)
+				{
+					//Events which fail the kinematics are counted by the system and not written
+					if(system->RunEvent(i) == ReactionStatus::Success)
+						WriteEvent(shard, *(system->GetNuclei()), i, system->GetEventWeight());
+				}
+				continue;
+			}
+
+			for(uint64_t first=rangeStart; first<rangeEnd; first+=m_params.batchSize)
+			{
+				std::size_t size = std::min<uint64_t>(m_params.batchSize, rangeEnd - first);
+				system->RunBatch(batch, first, size);
+				for(std::size_t i=0; i<size; i++)
+				{
+					if(batch.GetStatus(i) != ReactionStatus::Success)
+						continue;
+					batch.FillNuclei(i, nuclei);
+					WriteEvent(shard, nuclei, first + i, batch.GetWeight(i));
+				}
+			}
+		}
+	}
+
 	void MaskApp::Run()
 	{
 		std::cout<<"Running simulation..."<<std::endl;
@@ -80,45 +189,110 @@ namespace Mask {
 			return;
 		}
 
-		//Give our thread pool some tasks
+		//Give our thread pool some tasks: one per thread, which takes ranges of events until all are taken. The writer sleeps until
+		//events are queued, and stops once every job has finished
+		m_nextEvent.store(0);
+		m_workerException = nullptr;
+		m_fileWriter.SetNumberOfProducers(m_systemList.size());
 		for(std::size_t i=0; i<m_systemList.size(); i++)
 		{
 			//bind a lambda to the job, taking in a ReactionSystem, and then provide a reaction system as the tuple arguments.
-			m_resources->PushJob({[this](ReactionSystem* system, uint64_t chunkSamples) 
+			m_resources->PushJob({[this, i](ReactionSystem* system) 
 				{
-					if(system == nullptr)
-						return;
-
-					for(uint64_t i=0; i<chunkSamples; i++)
+					FileWriter* shard = nullptr;
+					try
+					{
+						if(m_shardWriter.IsOpen())
+						{
+							m_shardWriter.StartShard(i);
+							shard = &m_shardWriter.GetShard(i);
+						}
+						RunWorker(system, shard);
+					}
+					catch(...)
 					{
-						system->RunSystem();
-						m_fileWriter.PushData(*(system->GetNuclei()));
+						//The job must still finish, or the writer waits for it forever. The other jobs stop after their current
+						//range, and the exception is rethrown on the main thread
+						m_nextEvent.store(m_params.nSamples);
+						std::scoped_lock<std::mutex> guard(m_workerExceptionMutex);
+						if(!m_workerException)
+							m_workerException = std::current_exception();
 					}
+					if(shard != nullptr)
+						m_shardWriter.FinishShard(i);
+					m_fileWriter.FinishProducer();
 				}, 
-			{m_systemList[i], m_chunkSamples[i]}});
+			{m_systemList[i]}});
 		}
 
 		uint64_t count = 0;
 		double percent = 0.05;
 		uint64_t flushVal = m_params.nSamples*percent;
 		uint64_t flushCount = 0;
-		while(true)
+		//With shards nothing is queued, and this only waits for the jobs to finish
+		while(m_fileWriter.Write())
 		{
+			++count;
 			if(count == flushVal)
 			{
 				count = 0;
 				++flushCount;
 				std::cout<<"\rPercent of data written to disk: "<<percent*flushCount*100<<"%"<<std::flush;
 			}
-
-			if(m_resources->IsFinished() && m_fileWriter.GetQueueSize() == 0)
-				break;
-			else if(m_fileWriter.Write())
-				++count;
 		}
 
 		std::cout<<std::endl;
+		if(m_workerException)
+			std::rethrow_exception(m_workerException);
+		if(m_params.writerMode == WriterMode::BufferMerger)
+		{
+			std::cout<<"Writing the merged output..."<<std::endl;
+			m_shardWriter.Close(false);
+		}
+		else if(m_params.writerMode == WriterMode::Shards)
+		{
+			std::cout<<(m_params.mergeShards ? "Merging the output shards..." : "Writing the chain of the output shards...")<<std::endl;
+			m_shardWriter.Close(m_params.mergeShards);
+		}
 		std::cout<<"Complete."<<std::endl;
+		if(m_params.writerMode == WriterMode::Queue)
+			m_fileWriter.PrintQueueStatistics();
+
+		//Fraction of the excitation draws which would have been accepted had they not been truncated
+		SamplingStatistics stats;
+		for(ReactionSystem* system : m_systemList)
+		{
+			stats.draws += system->GetSamplingStatistics().draws;
+			stats.allowedFraction += system->GetSamplingStatistics().allowedFraction;
+			stats.redraws += system->GetSamplingStatistics().redraws;
+			stats.directionDraws += system->GetSamplingStatistics().directionDraws;
+		}
+		if(stats.draws != 0)
+		{
+			std::cout<<"Kinematically allowed fraction of excitation draws: "<<stats.allowedFraction/stats.draws<<std::endl;
+			std::cout<<"Truncated draws: "<<stats.draws<<" Events redrawn: "<<stats.redraws<<std::endl;
+		}
+		//Events are written with weights; their sum estimates the number of unbiased draws they stand for
+		if(stats.directionDraws != 0)
+			std::cout<<"Acceptance-biased direction draws: "<<stats.directionDraws<<" (per event: "<<double(stats.directionDraws)/m_params.nSamples<<")"<<std::endl;
+
+		//Each thread counts the events its system rejected, by reason
+		StatusCounts counts = {};
+		for(ReactionSystem* system : m_systemList)
+		{
+			const StatusCounts& systemCounts = system->GetStatusCounts();
+			for(std::size_t i=0; i<counts.size(); i++)
+				counts[i] += systemCounts[i];
+		}
+		uint64_t nFailed = 0;
+		for(std::size_t i=static_cast<std::size_t>(ReactionStatus::Success) + 1; i<counts.size(); i++)
+			nFailed += counts[i];
+		std::cout<<"Events written: "<<counts[static_cast<std::size_t>(ReactionStatus::Success)]<<" Events rejected: "<<nFailed<<std::endl;
+		for(std::size_t i=static_cast<std::size_t>(ReactionStatus::Success) + 1; i<counts.size(); i++)
+		{
+			if(counts[i] != 0)
+				std::cout<<"\t"<<ReactionStatusToString(static_cast<ReactionStatus>(i))<<": "<<counts[i]<<std::endl;
+		}
 		std::cout<<"---------------------------------------------"<<std::endl;
 	}
 	
@@ -9,8 +9,13 @@
 #include "RxnType.h"
 #include "ThreadPool.h"
 #include "FileWriter.h"
+#include "ShardedFileWriter.h"
+#include "RandomGenerator.h"
 
 #include <memory>
+#include <atomic>
+#include <mutex>
+#include <exception>
 
 namespace Mask {
 
@@ -19,6 +24,17 @@ namespace Mask {
 		std::string outputFileName = "";
 		uint64_t nSamples = 0;
 		uint32_t nThreads = 1;
+		uint64_t seed = 0;
+		uint32_t batchSize = 256; //Events per batch; 0 runs the scalar path, one event at a time
+		AngularSamplingMode angularSamplingMode = AngularSamplingMode::Tabulated;
+		SamplingMode samplingMode = SamplingMode::PseudoRandom;
+		std::string acceptanceMapFile = ""; //Empty for unbiased sampling
+		uint32_t acceptanceBiasStep = 1; //Step of the chain (from 1) whose angles are biased by the acceptance map
+		double acceptanceBiasFloor = 0.01; //Probability of keeping a direction outside of the acceptance
+		WriterMode writerMode = WriterMode::Queue;
+		bool mergeShards = false; //Shards mode: merge the shards into the output file, rather than writing a chain of them to it
+		uint64_t writerQueueCapacity = EventQueue::s_defaultCapacity; //Events held between the workers and the writer
+		double writerQueueMemory = 0.0; //Limit on the memory of the queued events, in MB; 0 for no limit
 		std::vector<StepParameters> chainParams;
 		LayeredTarget target;
 	};
@@ -34,13 +50,23 @@ namespace Mask {
 		void Run();
 
 	private:
+		void RunWorker(ReactionSystem* system, FileWriter* shard);
+		void WriteEvent(FileWriter* shard, const std::vector<Nucleus>& nuclei, uint64_t eventIndex, double weight);
+
 		AppParameters m_params;
 
 		std::vector<ReactionSystem*> m_systemList; //One system for each thread
-		std::vector<uint64_t> m_chunkSamples;
+		std::atomic<uint64_t> m_nextEvent; //First event of the next range handed out to a thread
+		uint64_t m_eventsPerRange;
 		FileWriter m_fileWriter;
-		std::unique_ptr<ThreadPool<ReactionSystem*, uint64_t>> m_resources;
-	
+		ShardedFileWriter m_shardWriter; //Shards and BufferMerger modes only
+		AcceptanceMap m_acceptanceMap; //Shared read-only by the systems
+		BeamEnergyLossMap m_beamElossMap; //Shared read-only by the systems
+		std::unique_ptr<ThreadPool<ReactionSystem*>> m_resources;
+		std::exception_ptr m_workerException; //First exception thrown by a job, rethrown by Run
+		std::mutex m_workerExceptionMutex;
+
+		static constexpr uint64_t s_eventsPerRange = 1024; //At least; rounded up to a whole number of batches
 	};
 
 }
@@ -41,21 +41,23 @@ namespace Mask {
 
 		//Set sampling parameters
 
-		AddBeamDistribution(step1Params.meanBeamEnergy, step1Params.sigmaBeamEnergy);
+		AddBeamDistribution(step1Params.meanBeamEnergy, step1Params.sigmaBeamEnergy, step1Params.beamEnergyFile);
 		m_step1.SetEjectileThetaType(step1Params.thetaType);
 		AddThetaRange(step1Params.thetaMin, step1Params.thetaMax);
 		AddPhiRange(step1Params.phiMin, step1Params.phiMax);
-		AddExcitationDistribution(step1Params.meanResidualEx, step1Params.sigmaResidualEx);
+		FixReactionDirection(m_step1);
+		AddExcitationDistribution(step1Params.meanResidualEx, step1Params.sigmaResidualEx, step1Params.residualExFile);
 	}
 	
-	void OneStepSystem::SetLayeredTarget(const LayeredTarget& target)
+	void OneStepSystem::SetLayeredTarget(const LayeredTarget& target, const BeamEnergyLossMap* beamElossMap)
 	{
-		m_target = target;
-		m_rxnLayer = m_target.FindLayerContaining(m_nuclei[0].Z, m_nuclei[0].A);
-		if(m_rxnLayer != m_target.GetNumberOfLayers())
+		m_target = &target;
+		m_rxnLayer = m_target->FindLayerContaining(m_nuclei[0].Z, m_nuclei[0].A);
+		if(m_rxnLayer != m_target->GetNumberOfLayers())
 		{
-			m_step1.SetLayeredTarget(&m_target);
+			m_step1.SetLayeredTarget(m_target);
 			m_step1.SetRxnLayer(m_rxnLayer);
+			m_step1.SetBeamEnergyLossMap(beamElossMap);
 			m_isTargetSet = true;
 		}
 		else
@@ -72,24 +74,64 @@ namespace Mask {
 		m_sysEquation = stream.str();
 	}
 	
-	void OneStepSystem::RunSystem()
+	OneStepParameters OneStepSystem::SampleParameters()
 	{
-		//Sample parameters
-		std::mt19937& gen = RandomGenerator::GetInstance().GetGenerator();
-		double bke = (m_beamDistributions[0])(gen);
-		double rxnTheta = std::acos((m_thetaRanges[0])(gen));
-		double rxnPhi = (m_phiRanges[0])(gen);
-		double residEx = (m_exDistributions[0])(gen);
-		double rxnDepth = (m_rxnDepthDist(gen));
+		OneStepParameters params;
+		double cosTheta;
+		SampleDirection(0, m_thetaRanges[0], m_phiRanges[0], cosTheta, params.rxnPhi);
+		params.rxnTheta = std::acos(cosTheta);
+		params.rxnDepth = SampleDepth();
+		//Residual excitation truncated to the region allowed by the beam energy
+		StartExcitations();
+		while(true)
+		{
+			params.beamEnergy = SampleBeamEnergy();
+			if(SampleExcitation(0, m_step1.GetReactionExcitationLimit(params.beamEnergy), params.residEx))
+				break;
+			RedrawExcitations();
+		}
+		return params;
+	}
+
+	ReactionStatus OneStepSystem::RunSystem()
+	{
+		OneStepParameters params = SampleParameters();
 		
-		m_step1.SetReactionDepth(rxnDepth);
-		m_step1.SetBeamKE(bke);
-		m_step1.SetPolarRxnAngle(rxnTheta);
-		m_step1.SetAzimRxnAngle(rxnPhi);
-		m_step1.SetExcitation(residEx);
+		m_step1.SetReactionDepth(params.rxnDepth);
+		m_step1.SetBeamKE(params.beamEnergy);
+		m_step1.SetPolarRxnAngle(params.rxnTheta);
+		m_step1.SetAzimRxnAngle(params.rxnPhi);
+		m_step1.SetExcitation(params.residEx);
 		
 		m_step1.SetResidualEnergyLoss(true);
-		m_step1.Calculate();
+		return m_step1.Calculate();
+	}
+
+	//Parameters are sampled event by event (each event has its own random stream), then the kinematics run over the whole batch
+	void OneStepSystem::RunBatch(EventBatch& batch, uint64_t firstEvent, std::size_t size)
+	{
+		batch.Resize(m_nuclei.size(), size);
+		batch.SetFirstEvent(firstEvent);
+		m_stepColumns.resize(1);
+		StepColumns& step1 = m_stepColumns[0];
+		step1.Resize(size);
+
+		OneStepParameters params;
+		for(std::size_t i=0; i<size; i++)
+		{
+			StartEvent(firstEvent + i);
+			params = SampleParameters();
+			batch.SetWeight(i, m_eventWeight);
+			step1.beamEnergy[i] = params.beamEnergy;
+			step1.theta[i] = params.rxnTheta;
+			step1.phi[i] = params.rxnPhi;
+			step1.ex[i] = params.residEx;
+			step1.rxnDepth[i] = params.rxnDepth;
+		}
+
+		m_step1.SetResidualEnergyLoss(true);
+		m_step1.CalculateBatch(batch, {0, 1, 2, 3}, step1);
+		CountStatus(batch);
 	}
 
 }
\ No newline at end of file
@@ -5,18 +5,29 @@
 
 namespace Mask {
 
+	struct OneStepParameters
+	{
+		double beamEnergy = 0.;
+		double rxnTheta = 0.;
+		double rxnPhi = 0.;
+		double residEx = 0.;
+		double rxnDepth = 0.;
+	};
+
 	class OneStepSystem: public ReactionSystem
 	{
 	public:
 		OneStepSystem(const std::vector<StepParameters>& params);
 		~OneStepSystem();
 	
-		virtual void SetLayeredTarget(const LayeredTarget& target) override;
-		void RunSystem() override;
+		virtual void SetLayeredTarget(const LayeredTarget& target, const BeamEnergyLossMap* beamElossMap) override;
+		ReactionStatus RunSystem() override;
+		void RunBatch(EventBatch& batch, uint64_t firstEvent, std::size_t size) override;
 	
 	private:
 		void Init(const std::vector<StepParameters>& params);
 		void SetSystemEquation() override;
+		OneStepParameters SampleParameters();
 	
 		Reaction m_step1;
 	};
@@ -0,0 +1,235 @@
+#include "PhaseSpaceDecay.h"
+#include "RandomGenerator.h"
+
+#include <algorithm>
+
+namespace Mask {
+
+	std::map<std::vector<double>, double> PhaseSpaceDecay::s_envelopes;
+	std::mutex PhaseSpaceDecay::s_envelopeMutex;
+
+	PhaseSpaceDecay::PhaseSpaceDecay() :
+		m_parent(nullptr), m_massSum(0.0), m_layeredTarget(nullptr), m_rxnLayer(0), m_rxnDepth(0.0), m_mode(PhaseSpaceMode::Weighted),
+		m_maxWeightParentMass(-1.0), m_maxWeight(1.0), m_envelope(1.0), m_isInit(false)
+	{
+	}
+
+	PhaseSpaceDecay::~PhaseSpaceDecay() {}
+
+	void PhaseSpaceDecay::BindNuclei(Nucleus* parent, const std::vector<Nucleus*>& products)
+	{
+		m_parent = parent;
+		m_products = products;
+		m_isInit = m_parent != nullptr && m_products.size() >= 2 &&
+				   std::find(m_products.begin(), m_products.end(), nullptr) == m_products.end();
+		if(!m_isInit)
+			return;
+
+		//Resolve the species and masses once here rather than on every event
+		SpeciesLookup& species = SpeciesLookup::GetInstance();
+		std::size_t nProducts = m_products.size();
+		m_productSpecies.resize(nProducts);
+		m_masses.resize(nProducts);
+		m_massSum = 0.0;
+		for(std::size_t i=0; i<nProducts; i++)
+		{
+			m_productSpecies[i] = &species.FindSpecies(m_products[i]->Z, m_products[i]->A);
+			m_masses[i] = m_products[i]->groundStateMass;
+			m_massSum += m_masses[i];
+		}
+
+		m_momenta.resize(nProducts);
+		m_invariantMasses.resize(nProducts);
+		m_uniforms.resize(3*nProducts - 4); //N-2 intermediate masses, and two angles for each of the N-1 breakups
+		m_maxWeightParentMass = -1.0;
+	}
+
+	/*
+		Products of the breakup of the parent (its four-vector as set by the step before, or at rest), with energy loss. In Unweighted
+		mode the phase space is redrawn until an event is accepted; the parent is never changed, so every parent mass is kept. In Sobol
+		mode the first attempt takes GetNumberOfDimensions dimensions from the one set by the caller, and redraws come from the Philox stream.
+	*/
+	ReactionStatus PhaseSpaceDecay::Calculate(double& weight)
+	{
+		weight = 1.0;
+		if(!m_isInit)
+			return ReactionStatus::NotInitialized;
+
+		Vec4 parent = FromROOT(m_parent->vec4);
+		double parentMass = parent.M();
+		if(parentMass <= m_massSum)
+			return ReactionStatus::NegativeQValue;
+
+		RandomGenerator& rng = RandomGenerator::GetInstance();
+		double phaseSpaceWeight;
+		while(true)
+		{
+			for(auto& uniform : m_uniforms)
+				uniform = rng.Uniform();
+			phaseSpaceWeight = GenerateEvent(parentMass, m_uniforms.data());
+			if(m_mode == PhaseSpaceMode::Weighted)
+			{
+				weight = phaseSpaceWeight;
+				break;
+			}
+			else if(rng.Uniform()*m_envelope < phaseSpaceWeight)
+			{
+				weight = std::max(1.0, phaseSpaceWeight/m_envelope);
+				break;
+			}
+			rng.StartRedraw();
+		}
+
+		LorentzBoost toLab(parent.BoostVector());
+		for(std::size_t i=0; i<m_products.size(); i++)
+		{
+			m_products[i]->thetaCM = m_momenta[i].Theta();
+			ApplyEnergyLoss(i, toLab(m_momenta[i]));
+		}
+		return ReactionStatus::Success;
+	}
+
+	/*
+		Raubold-Lynch generation of one event in the rest frame of the parent, from 3N - 4 uniform numbers. Returns the weight
+		divided by its bound (in (0, 1]).
+	*/
+	double PhaseSpaceDecay::GenerateEvent(double parentMass, const double* uniforms)
+	{
+		std::size_t nProducts = m_masses.size();
+		double kineticEnergy = parentMass - m_massSum;
+
+		//Sorted uniform numbers (insertion sort; N is small), then the invariant masses of products 0 ... i
+		m_invariantMasses[0] = 0.0;
+		m_invariantMasses[nProducts - 1] = 1.0;
+		for(std::size_t i=1; i<nProducts-1; i++)
+		{
+			double value = uniforms[i-1];
+			std::size_t j = i;
+			while(j > 1 && m_invariantMasses[j-1] > value)
+			{
+				m_invariantMasses[j] = m_invariantMasses[j-1];
+				j--;
+			}
+			m_invariantMasses[j] = value;
+		}
+		double massSum = 0.0;
+		for(std::size_t i=0; i<nProducts; i++)
+		{
+			massSum += m_masses[i];
+			m_invariantMasses[i] = massSum + m_invariantMasses[i]*kineticEnergy;
+		}
+
+		//Breakup i of the chain: the system of products 0 ... i-1 recoils against product i, isotropically in their rest frame
+		const double* angles = uniforms + (nProducts - 2);
+		double weight = 1.0;
+		double momentum, cosTheta, sinTheta, phi, subsystemMass;
+		for(std::size_t i=1; i<nProducts; i++)
+		{
+			momentum = BreakupMomentum(m_invariantMasses[i], m_invariantMasses[i-1], m_masses[i]);
+			weight *= momentum;
+			cosTheta = 2.0*angles[2*(i-1)] - 1.0;
+			sinTheta = std::sqrt(std::max(1.0 - cosTheta*cosTheta, 0.0));
+			phi = 2.0*M_PI*angles[2*(i-1) + 1];
+			Vec3 axis(sinTheta*std::cos(phi), sinTheta*std::sin(phi), cosTheta);
+			if(i == 1)
+				m_momenta[0] = Vec4::FromDirection(-axis, momentum, std::sqrt(momentum*momentum + m_masses[0]*m_masses[0]));
+			else
+			{
+				subsystemMass = m_invariantMasses[i-1];
+				LorentzBoost toFrame(axis*(-momentum/std::sqrt(momentum*momentum + subsystemMass*subsystemMass)));
+				for(std::size_t j=0; j<i; j++)
+					m_momenta[j] = toFrame(m_momenta[j]);
+			}
+			m_momenta[i] = Vec4::FromDirection(axis, momentum, std::sqrt(momentum*momentum + m_masses[i]*m_masses[i]));
+		}
+
+		return weight/GetMaximumWeight(parentMass);
+	}
+
+	/*
+		Bound on the product of the breakup momenta: each is largest when its own invariant mass takes all of the kinetic energy
+		and the subsystem before it none. Kept for the last parent mass, so a fixed parent excitation only calculates it once.
+	*/
+	double PhaseSpaceDecay::GetMaximumWeight(double parentMass)
+	{
+		if(parentMass != m_maxWeightParentMass)
+		{
+			double kineticEnergy = parentMass - m_massSum;
+			double upper = kineticEnergy + m_masses[0];
+			double lower = 0.0;
+			m_maxWeight = 1.0;
+			for(std::size_t i=1; i<m_masses.size(); i++)
+			{
+				lower += m_masses[i-1];
+				upper += m_masses[i];
+				m_maxWeight *= BreakupMomentum(upper, lower, m_masses[i]);
+			}
+			m_maxWeightParentMass = parentMass;
+		}
+		return m_maxWeight;
+	}
+
+	/*
+		Envelope for Unweighted mode: the largest weight of a pilot run at the given parent mass, with a margin. The pilot has its
+		own fixed stream, so the envelope (and with it the events) does not depend on the seed of the run or on the thread. It only
+		depends on the masses, so the pilot is run once for them and the systems of the other threads take the kept envelope.
+	*/
+	void PhaseSpaceDecay::BuildEnvelope(double parentMass)
+	{
+		m_envelope = 1.0;
+		if(!m_isInit || parentMass <= m_massSum)
+			return;
+
+		std::vector<double> key(m_masses);
+		key.push_back(parentMass);
+		std::scoped_lock<std::mutex> guard(s_envelopeMutex);
+		auto iter = s_envelopes.find(key);
+		if(iter != s_envelopes.end())
+		{
+			m_envelope = iter->second;
+			return;
+		}
+
+		Philox4x32 engine(s_pilotSeed, 0);
+		std::uniform_real_distribution<double> uniformDist(0.0, 1.0);
+		std::vector<double> uniforms(m_uniforms.size());
+		double largest = 0.0;
+		for(std::size_t event=0; event<s_nPilotEvents; event++)
+		{
+			for(auto& uniform : uniforms)
+				uniform = uniformDist(engine);
+			largest = std::max(largest, GenerateEvent(parentMass, uniforms.data()));
+		}
+		m_envelope = std::min(1.0, s_envelopeMargin*largest);
+		s_envelopes[key] = m_envelope;
+	}
+
+	//Energy loss of a product on the way out of the target. The momentum is rescaled along its direction (see Reaction)
+	void PhaseSpaceDecay::ApplyEnergyLoss(std::size_t product, const Vec4& vec)
+	{
+		Nucleus* nucleus = m_products[product];
+		if(m_layeredTarget == nullptr)
+		{
+			nucleus->vec4 = ToROOT(vec);
+			return;
+		}
+
+		double mass = m_masses[product];
+		double startKE = vec.E - mass;
+		double finalKE = startKE - m_layeredTarget->GetEjectileEnergyLoss(*m_productSpecies[product], startKE, m_rxnLayer, vec.Theta(), m_rxnDepth);
+		if(finalKE > 0.0)
+			nucleus->vec4 = ToROOT(vec.Rescaled(std::sqrt(finalKE*(finalKE + 2.0*mass)), finalKE + mass));
+		else
+			nucleus->vec4 = ToROOT(vec.Rescaled(0.0, mass));
+	}
+
+	//Momentum of either product in the rest frame of a two body breakup of mass into mass1 and mass2
+	double PhaseSpaceDecay::BreakupMomentum(double mass, double mass1, double mass2)
+	{
+		double sum = mass1 + mass2;
+		double difference = mass1 - mass2;
+		double value = (mass*mass - sum*sum)*(mass*mass - difference*difference);
+		return value > 0.0 ? std::sqrt(value)/(2.0*mass) : 0.0;
+	}
+
+}
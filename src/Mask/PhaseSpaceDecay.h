@@ -0,0 +1,117 @@
+/*
+	PhaseSpaceDecay.h
+	Breakup of a parent nucleus into N >= 2 products distributed by phase space alone, for breakups which do not go through real
+	intermediate states. Events are generated with the Raubold-Lynch method (F. James, "Monte Carlo phase space", CERN 68-15
+	(1968)): the N-2 intermediate invariant masses are set from sorted uniform numbers, each two body breakup of the chain is
+	isotropic in its own rest frame, and the event has the weight of the product of the breakup momenta. Weights are divided by
+	their largest possible value, which is calculated once for each parent mass.
+
+	In Weighted mode every event is kept with its phase space weight. The weights are relative to the bound at the parent mass
+	of the event, so they are only on one scale for a fixed parent mass; PhaseSpaceSystem refuses Weighted mode with a varying
+	parent excitation. In Unweighted mode events are redrawn until one is kept with probability weight/envelope, so every parent
+	mass is kept as sampled. The envelope is the largest weight found in a pilot run at the nominal parent mass (BuildEnvelope)
+	plus a margin, which is much tighter than the analytic bound for more than three products. The pilot is run once for each
+	set of masses and shared by every thread. A kept event with a weight above the envelope keeps the excess as its event
+	weight, so the distributions stay exact.
+
+	Like Reaction, PhaseSpaceDecay does not own its nuclei or the LayeredTarget. The energy loss of every product is calculated.
+*/
+#ifndef PHASESPACEDECAY_H
+#define PHASESPACEDECAY_H
+
+#include "Nucleus.h"
+#include "LayeredTarget.h"
+#include "Vec4.h"
+#include "RxnType.h"
+#include <vector>
+#include <string>
+#include <map>
+#include <mutex>
+
+namespace Mask {
+
+	enum class PhaseSpaceMode
+	{
+		Weighted, //Keep every event, with its phase space weight
+		Unweighted //Accept events against the envelope; the event weights stay 1 (up to rare overweight events)
+	};
+
+	static PhaseSpaceMode StringToPhaseSpaceMode(const std::string& mode)
+	{
+		if(mode == "Unweighted")
+			return PhaseSpaceMode::Unweighted;
+		else
+			return PhaseSpaceMode::Weighted;
+	}
+
+	static std::string PhaseSpaceModeToString(PhaseSpaceMode mode)
+	{
+		switch(mode)
+		{
+			case PhaseSpaceMode::Weighted: return "Weighted";
+			case PhaseSpaceMode::Unweighted: return "Unweighted";
+			default: return "Weighted";
+		}
+	}
+
+	class PhaseSpaceDecay
+	{
+	public:
+		PhaseSpaceDecay();
+		~PhaseSpaceDecay();
+
+		ReactionStatus Calculate(double& weight); //do sim; weight is the phase space weight of the event
+
+		void BindNuclei(Nucleus* parent, const std::vector<Nucleus*>& products);
+		void SetLayeredTarget(const LayeredTarget* targ) { m_layeredTarget = targ; }
+		void SetRxnLayer(std::size_t layer) { m_rxnLayer = layer; }
+		void SetReactionDepth(double depth) { m_rxnDepth = depth; }
+		void SetMode(PhaseSpaceMode mode) { m_mode = mode; }
+		void BuildEnvelope(double parentMass);
+
+		PhaseSpaceMode GetMode() const { return m_mode; }
+		double GetEnvelope() const { return m_envelope; }
+		double GetProductMassSum() const { return m_massSum; }
+		std::size_t GetNumberOfProducts() const { return m_products.size(); }
+		std::size_t GetNumberOfDimensions() const { return m_uniforms.size() + (m_mode == PhaseSpaceMode::Unweighted ? 1 : 0); } //Sobol dimensions of one Calculate
+
+	private:
+		double GenerateEvent(double parentMass, const double* uniforms);
+		double GetMaximumWeight(double parentMass);
+		void ApplyEnergyLoss(std::size_t product, const Vec4& vec);
+		static double BreakupMomentum(double mass, double mass1, double mass2);
+
+		//Reactants -> NOT OWNED
+		Nucleus* m_parent;
+		std::vector<Nucleus*> m_products;
+		std::vector<const Species*> m_productSpecies;
+		std::vector<double> m_masses;
+		double m_massSum;
+
+		const LayeredTarget* m_layeredTarget; //not owned
+		std::size_t m_rxnLayer;
+		double m_rxnDepth;
+
+		PhaseSpaceMode m_mode;
+		double m_maxWeightParentMass, m_maxWeight; //Bound on the weight, for the last parent mass
+		double m_envelope; //Fraction of the bound above which events are overweight (Unweighted mode)
+
+		//Work space for one event, in the parent rest frame
+		std::vector<Vec4> m_momenta;
+		std::vector<double> m_invariantMasses;
+		std::vector<double> m_uniforms;
+
+		bool m_isInit;
+
+		static constexpr std::size_t s_nPilotEvents = 20000;
+		static constexpr double s_envelopeMargin = 1.1;
+		static constexpr uint64_t s_pilotSeed = 0x5EED0F9A5E5BACE;
+
+		//Envelopes of the pilot runs so far, by product masses and parent mass
+		static std::map<std::vector<double>, double> s_envelopes;
+		static std::mutex s_envelopeMutex;
+	};
+
+}
+
+#endif
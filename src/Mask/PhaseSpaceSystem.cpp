@@ -0,0 +1,207 @@
+#include "PhaseSpaceSystem.h"
+#include "RandomGenerator.h"
+#include "KinematicsExceptions.h"
+
+#include <sstream>
+#include <limits>
+
+namespace Mask {
+
+	PhaseSpaceSystem::PhaseSpaceSystem(const std::vector<StepParameters>& params) :
+		ReactionSystem(), m_isReactionFirst(false), m_parentSlot(0)
+	{
+		Init(params);
+	}
+
+	PhaseSpaceSystem::~PhaseSpaceSystem() {}
+
+	void PhaseSpaceSystem::Init(const std::vector<StepParameters>& params)
+	{
+		m_isReactionFirst = params.size() == 2 && params[0].rxnType == RxnType::Reaction;
+		if(params.empty() || (params.size() != 1 && !m_isReactionFirst) || params.back().rxnType != RxnType::PhaseSpace ||
+		   params.back().Z.size() < 2 || params.back().Z.size() != params.back().A.size() ||
+		   (m_isReactionFirst && (params[0].Z.size() != 3 || params[0].A.size() != 3)))
+		{
+			m_isValid = false;
+			std::cerr << "Invalid parameters at PhaseSpaceSystem::Init(), does not match PhaseSpace signature!" << std::endl;
+			return;
+		}
+
+		const StepParameters& breakupParams = params.back();
+		std::size_t nProducts = breakupParams.Z.size();
+		std::size_t firstProduct;
+
+		//Setup nuclei
+		if(m_isReactionFirst)
+		{
+			const StepParameters& step1Params = params[0];
+			int zr = step1Params.Z[0] + step1Params.Z[1] - step1Params.Z[2];
+			int ar = step1Params.A[0] + step1Params.A[1] - step1Params.A[2];
+			if(zr != breakupParams.Z[0] || ar != breakupParams.A[0])
+			{
+				m_isValid = false;
+				std::cerr << "Invalid parameters at PhaseSpaceSystem::Init(), step one and step two are not sequential! Step one recoil (Z,A): ("
+						  << zr << "," << ar << ") Step two parent (Z,A): (" << breakupParams.Z[0] << "," << breakupParams.A[0] << ")" <<std::endl;
+				return;
+			}
+
+			m_nuclei.resize(4 + nProducts);
+			m_nuclei[0] = CreateNucleus(step1Params.Z[0], step1Params.A[0]); //target
+			m_nuclei[1] = CreateNucleus(step1Params.Z[1], step1Params.A[1]); //projectile
+			m_nuclei[2] = CreateNucleus(step1Params.Z[2], step1Params.A[2]); //ejectile
+			m_nuclei[3] = CreateNucleus(zr, ar); //residual, the parent of the breakup
+			m_parentSlot = 3;
+			firstProduct = 4;
+		}
+		else
+		{
+			m_nuclei.resize(1 + nProducts);
+			m_nuclei[0] = CreateNucleus(breakupParams.Z[0], breakupParams.A[0]); //parent
+			m_parentSlot = 0;
+			firstProduct = 1;
+		}
+
+		int zLast = breakupParams.Z[0];
+		int aLast = breakupParams.A[0];
+		for(std::size_t i=1; i<nProducts; i++)
+		{
+			m_nuclei[firstProduct + i - 1] = CreateNucleus(breakupParams.Z[i], breakupParams.A[i]);
+			zLast -= breakupParams.Z[i];
+			aLast -= breakupParams.A[i];
+		}
+		if(zLast < 0 || aLast <= 0)
+		{
+			m_isValid = false;
+			std::cerr << "Invalid parameters at PhaseSpaceSystem::Init(), the products outweigh the parent!" << std::endl;
+			return;
+		}
+		m_nuclei[firstProduct + nProducts - 1] = CreateNucleus(zLast, aLast);
+
+		std::vector<Nucleus*> products;
+		for(std::size_t i=0; i<nProducts; i++)
+			products.push_back(&(m_nuclei[firstProduct + i]));
+		if(m_isReactionFirst)
+			m_step1.BindNuclei(&(m_nuclei[0]), &(m_nuclei[1]), &(m_nuclei[2]), &(m_nuclei[3]));
+		m_breakup.BindNuclei(&(m_nuclei[m_parentSlot]), products);
+		m_breakup.SetMode(breakupParams.phaseSpaceMode);
+		SetSystemEquation();
+
+		//Set sampling parameters. The only excitation is that of the parent of the breakup
+		if(m_isReactionFirst)
+		{
+			const StepParameters& step1Params = params[0];
+			AddBeamDistribution(step1Params.meanBeamEnergy, step1Params.sigmaBeamEnergy, step1Params.beamEnergyFile);
+			m_step1.SetEjectileThetaType(step1Params.thetaType);
+			AddThetaRange(step1Params.thetaMin, step1Params.thetaMax);
+			AddPhiRange(step1Params.phiMin, step1Params.phiMax);
+			FixReactionDirection(m_step1);
+			AddExcitationDistribution(step1Params.meanResidualEx, step1Params.sigmaResidualEx, step1Params.residualExFile);
+		}
+		else
+			AddExcitationDistribution(breakupParams.meanResidualEx, breakupParams.sigmaResidualEx, breakupParams.residualExFile);
+
+		if(!m_isValid)
+			return;
+		//Weighted mode divides by the bound at the parent mass of the event, so the weights are only comparable for one parent mass
+		if(m_breakup.GetMode() == PhaseSpaceMode::Weighted && (m_exTables[0].IsValid() || m_exDistributions[0].stddev() != 0.0))
+		{
+			m_isValid = false;
+			std::cerr << "Invalid parameters at PhaseSpaceSystem::Init(), PhaseSpaceMode Weighted requires a fixed parent excitation;"
+					  << " use PhaseSpaceMode Unweighted with an excitation sigma or file" << std::endl;
+			return;
+		}
+		if(m_breakup.GetMode() == PhaseSpaceMode::Unweighted)
+			m_breakup.BuildEnvelope(m_nuclei[m_parentSlot].groundStateMass + m_exDistributions[0].mean());
+	}
+
+	void PhaseSpaceSystem::SetLayeredTarget(const LayeredTarget& target, const BeamEnergyLossMap* beamElossMap)
+	{
+		m_target = &target;
+		m_rxnLayer = m_target->FindLayerContaining(m_nuclei[0].Z, m_nuclei[0].A);
+		if(m_rxnLayer != m_target->GetNumberOfLayers())
+		{
+			if(m_isReactionFirst)
+			{
+				m_step1.SetLayeredTarget(m_target);
+				m_step1.SetRxnLayer(m_rxnLayer);
+				m_step1.SetBeamEnergyLossMap(beamElossMap);
+			}
+			m_breakup.SetLayeredTarget(m_target);
+			m_breakup.SetRxnLayer(m_rxnLayer);
+			m_isTargetSet = true;
+		}
+		else
+			throw ReactionLayerException();
+	}
+
+	void PhaseSpaceSystem::SetSystemEquation()
+	{
+		std::stringstream stream;
+		if(m_isReactionFirst)
+		{
+			stream << m_nuclei[0].isotopicSymbol << "("
+				   << m_nuclei[1].isotopicSymbol << ", "
+				   << m_nuclei[2].isotopicSymbol << ")";
+		}
+		stream << m_nuclei[m_parentSlot].isotopicSymbol << "->";
+		for(std::size_t i=m_parentSlot+1; i<m_nuclei.size(); i++)
+			stream << m_nuclei[i].isotopicSymbol << (i == m_nuclei.size() - 1 ? "" : "+");
+		m_sysEquation = stream.str();
+	}
+
+	PhaseSpaceParameters PhaseSpaceSystem::SampleParameters()
+	{
+		PhaseSpaceParameters params;
+		if(m_isReactionFirst)
+		{
+			double cosTheta;
+			SampleDirection(0, m_thetaRanges[0], m_phiRanges[0], cosTheta, params.rxnPhi);
+			params.rxnTheta = std::acos(cosTheta);
+		}
+		params.rxnDepth = SampleDepth();
+
+		//Residual excitation truncated to the region allowed by the beam energy. Below the breakup threshold the event fails
+		//with a NegativeQValue status
+		StartExcitations();
+		if(m_isReactionFirst)
+		{
+			while(true)
+			{
+				params.beamEnergy = SampleBeamEnergy();
+				if(SampleExcitation(0, m_step1.GetReactionExcitationLimit(params.beamEnergy), params.ex))
+					break;
+				RedrawExcitations();
+			}
+		}
+		else
+			SampleExcitation(0, std::numeric_limits<double>::max(), params.ex);
+		return params;
+	}
+
+	ReactionStatus PhaseSpaceSystem::RunSystem()
+	{
+		PhaseSpaceParameters params = SampleParameters();
+
+		if(m_isReactionFirst)
+		{
+			m_step1.SetReactionDepth(params.rxnDepth);
+			m_step1.SetBeamKE(params.beamEnergy);
+			m_step1.SetPolarRxnAngle(params.rxnTheta);
+			m_step1.SetAzimRxnAngle(params.rxnPhi);
+			m_step1.SetExcitation(params.ex);
+			ReactionStatus status = m_step1.Calculate();
+			if(status != ReactionStatus::Success)
+				return status;
+		}
+		else
+			m_nuclei[0].vec4.SetPxPyPzE(0., 0., 0., m_nuclei[0].groundStateMass + params.ex);
+
+		m_breakup.SetReactionDepth(params.rxnDepth);
+		RandomGenerator::GetInstance().SetDimension(ReserveDimensions(m_breakup.GetNumberOfDimensions()));
+		double weight;
+		ReactionStatus status = m_breakup.Calculate(weight);
+		m_eventWeight *= weight;
+		return status;
+	}
+
+}
@@ -0,0 +1,50 @@
+/*
+	PhaseSpaceSystem.h
+	System ending in an N-body phase space breakup (see PhaseSpaceDecay). The chain is either a single PhaseSpace step, the breakup
+	of an excited parent at rest, or a Reaction followed by the PhaseSpace breakup of its residual. The reactants of a PhaseSpace
+	step are the parent and all but one of the products; the last product is given by conservation of Z and A.
+
+	Nucleus slots: a PhaseSpace first step uses parent (0) and products 1 ... N. A Reaction first step uses target (0), projectile (1),
+	ejectile (2) and residual (3), and the products of the breakup of the residual follow at 4 ... N + 3. The breakup happens
+	inside the target, so the residual has no energy loss; every product does.
+*/
+#ifndef PHASESPACESYSTEM_H
+#define PHASESPACESYSTEM_H
+
+#include "ReactionSystem.h"
+#include "PhaseSpaceDecay.h"
+
+namespace Mask {
+
+	struct PhaseSpaceParameters
+	{
+		double beamEnergy = 0.;
+		double rxnTheta = 0.;
+		double rxnPhi = 0.;
+		double ex = 0.; //Excitation of the residual of the reaction, or of the parent of a breakup at rest
+		double rxnDepth = 0.;
+	};
+
+	class PhaseSpaceSystem : public ReactionSystem
+	{
+	public:
+		PhaseSpaceSystem(const std::vector<StepParameters>& params);
+		~PhaseSpaceSystem();
+
+		virtual void SetLayeredTarget(const LayeredTarget& target, const BeamEnergyLossMap* beamElossMap) override;
+		virtual ReactionStatus RunSystem() override;
+
+	private:
+		void Init(const std::vector<StepParameters>& params);
+		void SetSystemEquation() override;
+		PhaseSpaceParameters SampleParameters();
+
+		Reaction m_step1;
+		PhaseSpaceDecay m_breakup;
+		bool m_isReactionFirst;
+		std::size_t m_parentSlot;
+	};
+
+}
+
+#endif
@@ -1,12 +1,136 @@
 #include "RandomGenerator.h"
+#include "SobolSequence.h"
+
+#include <cmath>
 
 namespace Mask {
-	
-	RandomGenerator::RandomGenerator()
+
+	std::atomic<uint64_t> RandomGenerator::s_seed(RandomGenerator::GenerateSeed());
+	std::atomic<SamplingMode> RandomGenerator::s_samplingMode(SamplingMode::PseudoRandom);
+
+	void Philox4x32::GenerateBlock()
+	{
+		static constexpr uint64_t multiplier0 = 0xD2511F53;
+		static constexpr uint64_t multiplier1 = 0xCD9E8D57;
+		static constexpr uint32_t weyl0 = 0x9E3779B9;
+		static constexpr uint32_t weyl1 = 0xBB67AE85;
+
+		std::array<uint32_t, 4> x = m_counter;
+		std::array<uint32_t, 2> key = m_key;
+		uint64_t product0, product1;
+		for(int round=0; round<10; round++)
+		{
+			if(round != 0)
+			{
+				key[0] += weyl0;
+				key[1] += weyl1;
+			}
+			product0 = multiplier0 * x[0];
+			product1 = multiplier1 * x[2];
+			x = {(uint32_t)(product1 >> 32) ^ x[1] ^ key[0], (uint32_t)product1, (uint32_t)(product0 >> 32) ^ x[3] ^ key[1], (uint32_t)product0};
+		}
+		m_block = x;
+
+		//Advance the 64-bit block counter; the stream half of the counter is never touched
+		if(++m_counter[0] == 0)
+			++m_counter[1];
+	}
+
+	/*Until a stream is selected, each thread draws from a random one*/
+	RandomGenerator::RandomGenerator() :
+		m_eventIndex(0), m_dimension(0), m_isRedraw(false), m_isEventSet(false)
 	{
 		std::random_device rd;
-		rng.seed(rd());
+		uint64_t stream = ((uint64_t)rd() << 32) | rd();
+		rng.Seed(s_seed, stream);
 	}
 
 	RandomGenerator::~RandomGenerator() {}
-}
\ No newline at end of file
+
+	/*Draw a seed from the system entropy source, for runs where no seed is given*/
+	uint64_t RandomGenerator::GenerateSeed()
+	{
+		std::random_device rd;
+		return ((uint64_t)rd() << 32) | rd();
+	}
+
+	bool RandomGenerator::IsQuasiRandom() const
+	{
+		return s_samplingMode == SamplingMode::Sobol && m_isEventSet && !m_isRedraw && m_dimension < SobolSequence::s_maxDimensions;
+	}
+
+	double RandomGenerator::Uniform()
+	{
+		if(IsQuasiRandom())
+			return SobolSequence::GetCoordinate(m_eventIndex, m_dimension++, s_seed);
+
+		//53 random bits, offset by half a step so that the value is never 0
+		uint64_t bits = ((uint64_t)rng() << 32) | rng();
+		return ((bits >> 11) + 0.5)*(1.0/9007199254740992.0);
+	}
+
+	/*
+		Zero width distributions (a fixed angle, beam energy or excitation in the config) are constants: they are returned without a
+		draw, so they take no values from the stream and no dimension of the Sobol point.
+	*/
+	double RandomGenerator::Sample(std::uniform_real_distribution<double>& distribution)
+	{
+		if(distribution.a() == distribution.b())
+			return distribution.a();
+		if(s_samplingMode == SamplingMode::PseudoRandom || !m_isEventSet)
+			return distribution(rng);
+		return distribution.a() + (distribution.b() - distribution.a())*Uniform();
+	}
+
+	double RandomGenerator::Sample(std::normal_distribution<double>& distribution)
+	{
+		if(distribution.stddev() == 0.0)
+			return distribution.mean();
+		if(s_samplingMode == SamplingMode::PseudoRandom || !m_isEventSet)
+			return distribution(rng);
+		return distribution.mean() + distribution.stddev()*InverseNormalCDF(Uniform());
+	}
+
+	/*
+		Inverse of the standard normal cumulative distribution. Rational approximation of P. J. Acklam (relative error 1.15e-9),
+		refined by one step of Halley's method against erfc.
+	*/
+	double RandomGenerator::InverseNormalCDF(double probability)
+	{
+		static constexpr double a[6] = {-3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02, 1.383577518672690e+02,
+										-3.066479806614716e+01, 2.506628277459239e+00};
+		static constexpr double b[5] = {-5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02, 6.680131188771972e+01,
+										-1.328068155288572e+01};
+		static constexpr double c[6] = {-7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00, -2.549732539343734e+00,
+										4.374664141464968e+00, 2.938163982698783e+00};
+		static constexpr double d[4] = {7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00, 3.754408661907416e+00};
+		static constexpr double lowRegion = 0.02425;
+
+		if(probability <= 0.0)
+			return -HUGE_VAL;
+		else if(probability >= 1.0)
+			return HUGE_VAL;
+
+		double x, q, r;
+		if(probability < lowRegion)
+		{
+			q = std::sqrt(-2.0*std::log(probability));
+			x = (((((c[0]*q + c[1])*q + c[2])*q + c[3])*q + c[4])*q + c[5])/((((d[0]*q + d[1])*q + d[2])*q + d[3])*q + 1.0);
+		}
+		else if(probability <= 1.0 - lowRegion)
+		{
+			q = probability - 0.5;
+			r = q*q;
+			x = (((((a[0]*r + a[1])*r + a[2])*r + a[3])*r + a[4])*r + a[5])*q/(((((b[0]*r + b[1])*r + b[2])*r + b[3])*r + b[4])*r + 1.0);
+		}
+		else
+		{
+			q = std::sqrt(-2.0*std::log(1.0 - probability));
+			x = -(((((c[0]*q + c[1])*q + c[2])*q + c[3])*q + c[4])*q + c[5])/((((d[0]*q + d[1])*q + d[2])*q + d[3])*q + 1.0);
+		}
+
+		double error = 0.5*std::erfc(-x/std::sqrt(2.0)) - probability;
+		double u = error*std::sqrt(2.0*M_PI)*std::exp(0.5*x*x);
+		return x - u/(1.0 + 0.5*x*u);
+	}
+}
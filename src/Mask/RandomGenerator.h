@@ -1,27 +1,155 @@
+/*
+	RandomGenerator.h
+	Thread-local random number generation for Mask. The engine is Philox4x32-10 (Salmon et al., "Parallel random numbers:
+	as easy as 1, 2, 3", SC11), a counter-based generator: each output block is a keyed bijection of a 128-bit counter.
+	The key is the global seed, and the upper half of the counter selects an independent stream. The kinematics simulation
+	gives each event its own stream (the event index), so the events generated for a given seed do not depend on the number
+	of threads or on how the events are split between them.
+
+	Streams which are not selected explicitly (i.e. the detector simulation) start from a random position, as before.
+
+	In Sobol sampling mode the draws of an event are instead the coordinates of its point (the event index) of a scrambled Sobol
+	sequence. Each sampled quantity of an event is given its own fixed dimensions with SetDimension, and its draws take them
+	in order. Only the first attempt at a quantity does so: a redraw after a rejection comes from the Philox stream, so the
+	dimensions of a quantity never depend on how many times another one was redrawn. Draws must then go through Uniform or
+	Sample, which transform a single coordinate; draws beyond the dimensions of the sequence, and any draw made before an event
+	is selected, also come from the Philox stream.
+*/
 #ifndef RANDOMGENERATOR_H
 #define RANDOMGENERATOR_H
 
 #include <random>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
 
 namespace Mask {
 
+	enum class SamplingMode
+	{
+		PseudoRandom,
+		Sobol
+	};
+
+	static SamplingMode StringToSamplingMode(const std::string& mode)
+	{
+		if(mode == "Sobol")
+			return SamplingMode::Sobol;
+		else
+			return SamplingMode::PseudoRandom;
+	}
+
+	static std::string SamplingModeToString(SamplingMode mode)
+	{
+		switch(mode)
+		{
+			case SamplingMode::PseudoRandom: return "PseudoRandom";
+			case SamplingMode::Sobol: return "Sobol";
+			default: return "PseudoRandom";
+		}
+	}
+
+	//Philox4x32-10; satisfies the UniformRandomBitGenerator requirements, so it can drive the std distributions
+	class Philox4x32
+	{
+	public:
+		using result_type = uint32_t;
+
+		Philox4x32(uint64_t seed = 0, uint64_t stream = 0) { Seed(seed, stream); }
+
+		//Select the stream of a given seed, starting at its first value
+		void Seed(uint64_t seed, uint64_t stream)
+		{
+			m_key = {(uint32_t)seed, (uint32_t)(seed >> 32)};
+			m_counter = {0, 0, (uint32_t)stream, (uint32_t)(stream >> 32)};
+			m_blockIndex = 4;
+		}
+
+		result_type operator()()
+		{
+			if(m_blockIndex == 4)
+			{
+				GenerateBlock();
+				m_blockIndex = 0;
+			}
+			return m_block[m_blockIndex++];
+		}
+
+		static constexpr result_type min() { return 0; }
+		static constexpr result_type max() { return UINT32_MAX; }
+
+	private:
+		void GenerateBlock();
+
+		std::array<uint32_t, 2> m_key;
+		std::array<uint32_t, 4> m_counter; //Lower 64 bits count blocks within a stream, upper 64 bits are the stream
+		std::array<uint32_t, 4> m_block;
+		int m_blockIndex;
+	};
+
 	class RandomGenerator
 	{
 	public:
+		using Engine = Philox4x32;
+
 		~RandomGenerator();
-		std::mt19937& GetGenerator() { return rng; }
+		Engine& GetGenerator() { return rng; }
+
+		//Restart this thread's generator on the stream of a given event
+		void SetEvent(uint64_t eventIndex)
+		{
+			rng.Seed(s_seed, eventIndex);
+			m_eventIndex = eventIndex;
+			m_dimension = 0;
+			m_isRedraw = false;
+			m_isEventSet = true;
+		}
+
+		//Sobol mode: the draws which follow take the coordinates of the event's point from the given dimension on, or come from
+		//the Philox stream if they redraw a rejected value. Draws made under StartRedraw come from the Philox stream until the next SetDimension
+		void SetDimension(std::size_t dimension, bool isRedraw = false) { m_dimension = dimension; m_isRedraw = isRedraw; }
+		void StartRedraw() { m_isRedraw = true; }
+
+		//Next draw of the event, uniform on (0, 1)
+		double Uniform();
+		//Draw from a distribution. In PseudoRandom mode the distribution draws from the engine as usual; in Sobol mode the next
+		//coordinate is transformed by the inverse of its cumulative distribution. Zero width distributions return their value without a draw
+		double Sample(std::uniform_real_distribution<double>& distribution);
+		double Sample(std::normal_distribution<double>& distribution);
+
 		static RandomGenerator& GetInstance()
 		{
 			static thread_local RandomGenerator s_instance;
 			return s_instance;
 		}
 
+		//Global seed, shared by every thread. Set before any events are generated
+		static void SetSeed(uint64_t seed) { s_seed = seed; }
+		static uint64_t GetSeed() { return s_seed; }
+		static uint64_t GenerateSeed();
+
+		//Global sampling mode, shared by every thread. Set before any events are generated
+		static void SetSamplingMode(SamplingMode mode) { s_samplingMode = mode; }
+		static SamplingMode GetSamplingMode() { return s_samplingMode; }
+
+		static double InverseNormalCDF(double probability);
+
 	private:
 		RandomGenerator();
-		
-		std::mt19937 rng;
+
+		bool IsQuasiRandom() const;
+
+		Engine rng;
+		uint64_t m_eventIndex;
+		std::size_t m_dimension; //Dimension of the event's point taken by the next draw
+		bool m_isRedraw;
+		bool m_isEventSet;
+
+		static std::atomic<uint64_t> s_seed;
+		static std::atomic<SamplingMode> s_samplingMode;
 	};
 
 }
 
-#endif
\ No newline at end of file
+#endif
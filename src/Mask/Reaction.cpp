@@ -7,21 +7,25 @@
 	--GWM Jan. 2021
 */
 #include "Reaction.h"
-#include "KinematicsExceptions.h"
 
-#include "Math/Boost.h"
+#include <algorithm>
+
 
 namespace Mask {
 
 	Reaction::Reaction() :
-		m_target(nullptr), m_projectile(nullptr), m_ejectile(nullptr), m_residual(nullptr), m_layeredTarget(nullptr), 
-		m_bke(0), m_theta(0), m_phi(0), m_ex(0), m_rxnLayer(0), m_rxnDepth(0.0), m_ejectThetaType(RxnThetaType::None), m_isInit(false), m_isResidEloss(false)
+		m_target(nullptr), m_projectile(nullptr), m_ejectile(nullptr), m_residual(nullptr), m_projectileSpecies(nullptr), m_ejectileSpecies(nullptr),
+		m_residualSpecies(nullptr), m_layeredTarget(nullptr), m_beamElossMap(nullptr), 
+		m_bke(0), m_theta(0), m_phi(0), m_ex(0), m_rxnLayer(0), m_rxnDepth(0.0), m_cmParentMass(-1.0), m_cmResidualMass(-1.0),
+		m_cmEnergy(0.0), m_cmMomentum(0.0), m_ejectThetaType(RxnThetaType::None), m_isInit(false), m_isResidEloss(false),
+		m_isDirectionFixed(false)
 	{
 	}
 	
 	Reaction::Reaction(Nucleus* target, Nucleus* projectile, Nucleus* ejectile, Nucleus* residual) :
-		m_target(nullptr), m_projectile(nullptr), m_ejectile(nullptr), m_residual(nullptr),
-		m_layeredTarget(nullptr), m_bke(0), m_theta(0), m_phi(0), m_ex(0), m_rxnLayer(0), m_rxnDepth(0.0), m_ejectThetaType(RxnThetaType::None), m_isResidEloss(false)
+		m_target(nullptr), m_projectile(nullptr), m_ejectile(nullptr), m_residual(nullptr), m_projectileSpecies(nullptr),
+		m_ejectileSpecies(nullptr), m_residualSpecies(nullptr), m_layeredTarget(nullptr), m_beamElossMap(nullptr), m_bke(0), m_theta(0), m_phi(0), m_ex(0), m_rxnLayer(0), m_rxnDepth(0.0), m_cmParentMass(-1.0), m_cmResidualMass(-1.0),
+		m_cmEnergy(0.0), m_cmMomentum(0.0), m_ejectThetaType(RxnThetaType::None), m_isResidEloss(false), m_isDirectionFixed(false)
 	{
 		BindNuclei(target, projectile, ejectile, residual);
 	}
@@ -30,18 +34,19 @@ namespace Mask {
 	{
 	}
 	
-	bool Reaction::Calculate()
+	/*
+		Failures (an event below threshold, or a decay without enough energy) are returned as a status rather than thrown, so that
+		they can be counted and the event dropped without unwinding the worker thread. The nuclei of a failed event are not valid.
+	*/
+	ReactionStatus Reaction::Calculate()
 	{
 		if(!m_isInit) 
-			return false;
+			return ReactionStatus::NotInitialized;
 	
-		if(m_isDecay) {
-			CalculateDecay();
-			return true;
-		} else {
-			CalculateReaction();
-			return true;
-		}
+		if(m_isDecay)
+			return CalculateDecay();
+		else
+			return CalculateReaction();
 	}
 	
 	void Reaction::BindNuclei(Nucleus* target, Nucleus* projectile, Nucleus* ejectile, Nucleus* residual)
@@ -60,6 +65,12 @@ namespace Mask {
 			m_isInit = false;
 		else
 			m_isInit = true;
+
+		//Resolve the species once here rather than on every energy loss call
+		SpeciesLookup& species = SpeciesLookup::GetInstance();
+		m_projectileSpecies = m_projectile == nullptr ? nullptr : &species.FindSpecies(m_projectile->Z, m_projectile->A);
+		m_ejectileSpecies = m_ejectile == nullptr ? nullptr : &species.FindSpecies(m_ejectile->Z, m_ejectile->A);
+		m_residualSpecies = m_residual == nullptr ? nullptr : &species.FindSpecies(m_residual->Z, m_residual->A);
 	}
 	
 	void Reaction::SetBeamKE(double bke)
@@ -67,9 +78,42 @@ namespace Mask {
 		if(!m_isInit || m_isDecay) 
 			return;
 	
-		m_bke = bke - m_layeredTarget->GetProjectileEnergyLoss(m_projectile->Z, m_projectile->A, bke, m_rxnLayer, 0, m_rxnDepth);
+		if(m_beamElossMap != nullptr && m_beamElossMap->IsEnergyInRange(bke))
+			m_bke = bke - m_beamElossMap->GetEnergyLoss(bke, m_rxnDepth);
+		else
+			m_bke = bke - m_layeredTarget->GetProjectileEnergyLoss(*m_projectileSpecies, bke, m_rxnLayer, 0, m_rxnDepth);
 	}
 	
+	/*
+		Declare the ejectile angles of this step fixed for every event (zero width ranges in the config). The direction is then
+		computed once here instead of per event; the angles given to SetPolarRxnAngle/SetAzimRxnAngle must be the same.
+	*/
+	void Reaction::SetFixedDirection(double theta, double phi)
+	{
+		m_fixedDirection = Vec3::FromSpherical(theta, phi);
+		m_isDirectionFixed = true;
+	}
+
+	/*
+		Ejectile energy and momentum in the rest frame of a two body breakup of parentMass into the ejectile and a residual of
+		residualMass. The last result is kept, so that steps whose masses do not change from event to event (a parent at rest with
+		a fixed excitation) only calculate it once. Used by CalculateDecay only: the reaction path (whose parent mass changes every
+		event) and CalculateDecayBatch (to keep its loop vectorizable) write the formula out.
+	*/
+	void Reaction::GetTwoBodyMomentum(double parentMass, double residualMass, double& energy, double& momentum)
+	{
+		if(parentMass != m_cmParentMass || residualMass != m_cmResidualMass)
+		{
+			double ejectMass = m_ejectile->groundStateMass;
+			m_cmEnergy = (ejectMass*ejectMass - residualMass*residualMass + parentMass*parentMass)/(2.0*parentMass);
+			m_cmMomentum = std::sqrt(std::max(m_cmEnergy*m_cmEnergy - ejectMass*ejectMass, 0.0));
+			m_cmParentMass = parentMass;
+			m_cmResidualMass = residualMass;
+		}
+		energy = m_cmEnergy;
+		momentum = m_cmMomentum;
+	}
+
 	void Reaction::SetEjectileThetaType(RxnThetaType type)
 	{
 		if(m_isDecay)
@@ -78,24 +122,42 @@ namespace Mask {
 		m_ejectThetaType = type;
 	}
 	
+	/*
+		Energy loss of a product on the way out of the target, at polar angle angle. The momentum is rescaled along its direction,
+		so the angles are never recomputed from the four-vector. mass is the rest mass of the product.
+	*/
+	void Reaction::ApplyEnergyLoss(Nucleus* nucleus, Vec4& vec, const Species& species, double angle, double mass)
+	{
+		double startKE = vec.E - mass;
+		double finalKE = startKE - m_layeredTarget->GetEjectileEnergyLoss(species, startKE, m_rxnLayer, angle, m_rxnDepth);
+		if(finalKE > 0.0)
+			vec = vec.Rescaled(std::sqrt(finalKE*(finalKE + 2.0*mass)), finalKE + mass);
+		else
+			vec = vec.Rescaled(0.0, mass);
+		nucleus->vec4 = ToROOT(vec);
+	}
+
 	//Methods given by Iliadis in Nuclear Physics of Stars, Appendix C
 	//For use with lab frame restricted angles. May not give appropriate disribution for ejectile
-	void Reaction::CalculateReactionThetaLab()
+	ReactionStatus Reaction::CalculateReactionThetaLab()
 	{
-		m_target->vec4.SetPxPyPzE(0.,0.,0.,m_target->groundStateMass);
+		Vec4 target(0., 0., 0., m_target->groundStateMass);
 		double beam_pz = std::sqrt(m_bke*(m_bke + 2.0 * m_projectile->groundStateMass));
 		double beam_E = m_bke + m_projectile->groundStateMass;
-		m_projectile->vec4.SetPxPyPzE(0.,0.,beam_pz,beam_E);
+		Vec4 beam(0., 0., beam_pz, beam_E);
+		m_target->vec4 = ToROOT(target);
+		m_projectile->vec4 = ToROOT(beam);
 	
 		double Q = m_target->groundStateMass + m_projectile->groundStateMass - (m_ejectile->groundStateMass + m_residual->groundStateMass + m_ex);
 	
 		double Ethresh = -Q*(m_ejectile->groundStateMass+m_residual->groundStateMass) / 
 						 (m_ejectile->groundStateMass + m_residual->groundStateMass - m_projectile->groundStateMass);
 		if(m_bke < Ethresh)
-			throw EnergyThresholdException();
+			return ReactionStatus::BelowThreshold;
 	
+		Vec3 direction = GetDirection();
 		double term1 = std::sqrt(m_projectile->groundStateMass * m_ejectile->groundStateMass * m_bke)/
-					   (m_ejectile->groundStateMass + m_residual->groundStateMass) * std::cos(m_theta);
+					   (m_ejectile->groundStateMass + m_residual->groundStateMass) * direction.z;
 		double term2 = (m_bke * (m_residual->groundStateMass - m_projectile->groundStateMass) + m_residual->groundStateMass*Q) / 
 					   (m_residual->groundStateMass + m_ejectile->groundStateMass);
 		double sqrt_pos_ejectKE = term1 + std::sqrt(term1*term1 + term2);
@@ -109,153 +171,354 @@ namespace Mask {
 		double ejectP = std::sqrt(ejectKE * (ejectKE + 2.0 * m_ejectile->groundStateMass));
 		double ejectE = ejectKE + m_ejectile->groundStateMass;
 	
-		m_ejectile->SetVec4Spherical(m_theta, m_phi, ejectP, ejectE);
-	
-		m_residual->vec4 = m_target->vec4 + m_projectile->vec4 - m_ejectile->vec4;
-	
-		ejectKE -= m_layeredTarget->GetEjectileEnergyLoss(m_ejectile->Z, m_ejectile->A, ejectKE, m_rxnLayer, m_theta, m_rxnDepth);
-		if(ejectKE > 0.0)
-		{
-			double ejectP = std::sqrt(ejectKE*(ejectKE + 2.0*m_ejectile->groundStateMass));
-			double ejectE = ejectKE + m_ejectile->groundStateMass;
-			m_ejectile->SetVec4Spherical(m_ejectile->vec4.Theta(), m_ejectile->vec4.Phi(), ejectP, ejectE);
-		}
-		else
-			m_ejectile->SetVec4Spherical(m_ejectile->vec4.Theta(), m_ejectile->vec4.Phi(), 0.0, m_ejectile->groundStateMass);
+		Vec4 ejectile = Vec4::FromDirection(direction, ejectP, ejectE);
+		Vec4 residual = target + beam - ejectile;
+		m_residual->vec4 = ToROOT(residual);
 	
-		if(m_isResidEloss) {
-			double residKE = m_residual->GetKE() - m_layeredTarget->GetEjectileEnergyLoss(m_residual->Z, m_residual->A, m_residual->GetKE(), 
-																						  m_rxnLayer, m_residual->vec4.Theta(), m_rxnDepth);
-			if(residKE > 0.0)
-			{
-				double residP = std::sqrt(residKE*(residKE + 2.0*m_residual->vec4.M()));
-				double residE = residKE + m_residual->vec4.M();
-				m_residual->SetVec4Spherical(m_residual->vec4.Theta(), m_residual->vec4.Phi(), residP, residE);
-			}
-			else
-				m_residual->SetVec4Spherical(m_residual->vec4.Theta(), m_residual->vec4.Phi(), 0.0, m_residual->vec4.M());
-		}
+		ApplyEnergyLoss(m_ejectile, ejectile, *m_ejectileSpecies, m_theta, m_ejectile->groundStateMass);
+		if(m_isResidEloss)
+			ApplyEnergyLoss(m_residual, residual, *m_residualSpecies, residual.Theta(), residual.M());
+		return ReactionStatus::Success;
 	}
 	
 	//Methods from original ANASEN. Gives proper distribution for inverse kinematics.
-	void Reaction::CalculateReactionThetaCM()
+	ReactionStatus Reaction::CalculateReactionThetaCM()
 	{
 		//Target assumed at rest, with 0 excitation energy
-		m_target->vec4.SetPxPyPzE(0.,0.,0.,m_target->groundStateMass);
+		Vec4 target(0., 0., 0., m_target->groundStateMass);
 		double beam_pz = std::sqrt(m_bke*(m_bke + 2.0 * m_projectile->groundStateMass));
 		double beam_E = m_bke + m_projectile->groundStateMass;
-		m_projectile->vec4.SetPxPyPzE(0.,0.,beam_pz,beam_E);
+		Vec4 beam(0., 0., beam_pz, beam_E);
+		m_target->vec4 = ToROOT(target);
+		m_projectile->vec4 = ToROOT(beam);
 	
 		double Q = m_target->groundStateMass + m_projectile->groundStateMass - (m_ejectile->groundStateMass + m_residual->groundStateMass + m_ex);
 	
 		double Ethresh = -Q*(m_ejectile->groundStateMass + m_residual->groundStateMass) / 
 						 (m_ejectile->groundStateMass + m_residual->groundStateMass - m_projectile->groundStateMass);
 		if(m_bke < Ethresh)
-			throw EnergyThresholdException();
+			return ReactionStatus::BelowThreshold;
 		
-		ROOT::Math::PxPyPzEVector parent = m_target->vec4 + m_projectile->vec4;
-		ROOT::Math::Boost boost(parent.BoostToCM());
-		parent = boost*parent;
-		double ejectE_cm = (std::pow(m_ejectile->groundStateMass, 2.0) - 
-							std::pow(m_residual->groundStateMass + m_ex, 2.0) + std::pow(parent.E(),2.0))/
-							(2.0*parent.E());
-		double ejectP_cm = std::sqrt(ejectE_cm*ejectE_cm - std::pow(m_ejectile->groundStateMass, 2.0));
-		m_ejectile->SetVec4Spherical(m_theta, m_phi, ejectP_cm, ejectE_cm);
-		m_ejectile->vec4 = boost.Inverse() * m_ejectile->vec4;
-		m_residual->vec4 = m_target->vec4 + m_projectile->vec4 - m_ejectile->vec4;
+		Vec4 parent = target + beam;
+		double parentMass = parent.M(); //Energy of the parent in its rest frame
+		double residualMass = m_residual->groundStateMass + m_ex;
+		//The parent mass follows the beam energy at the sampled depth, so it changes every event and is not memoized
+		double ejectMass = m_ejectile->groundStateMass;
+		double ejectE_cm = (ejectMass*ejectMass - residualMass*residualMass + parentMass*parentMass)/(2.0*parentMass);
+		double ejectP_cm = std::sqrt(std::max(ejectE_cm*ejectE_cm - ejectMass*ejectMass, 0.0));
+		LorentzBoost toLab(parent.BoostVector());
+		Vec4 ejectile = toLab(Vec4::FromDirection(GetDirection(), ejectP_cm, ejectE_cm));
+		Vec4 residual = parent - ejectile;
+		m_residual->vec4 = ToROOT(residual);
 	
-		double ejectKE = m_ejectile->GetKE();
-		double ejectP = m_ejectile->vec4.P();
-		double ejectE = m_ejectile->vec4.E();
 		//energy loss for ejectile (after reaction!)
-		ejectKE -= m_layeredTarget->GetEjectileEnergyLoss(m_ejectile->Z, m_ejectile->A, ejectKE, m_rxnLayer, m_ejectile->vec4.Theta(), m_rxnDepth);
-		if(ejectKE > 0.0)
-		{
-			double ejectP = std::sqrt(ejectKE*(ejectKE + 2.0*m_ejectile->groundStateMass));
-			double ejectE = ejectKE + m_ejectile->groundStateMass;
-			m_ejectile->SetVec4Spherical(m_ejectile->vec4.Theta(), m_ejectile->vec4.Phi(), ejectP, ejectE);
-		}
-		else
-			m_ejectile->SetVec4Spherical(m_ejectile->vec4.Theta(), m_ejectile->vec4.Phi(), 0.0, m_ejectile->groundStateMass);
-
-	
+		ApplyEnergyLoss(m_ejectile, ejectile, *m_ejectileSpecies, ejectile.Theta(), m_ejectile->groundStateMass);
 		//if on, get eloss for residual (after reaction!)
 		if(m_isResidEloss)
-		{
-			double residKE = m_residual->GetKE() - 
-					m_layeredTarget->GetEjectileEnergyLoss(m_residual->Z, m_residual->A, m_residual->GetKE(), m_rxnLayer, m_residual->vec4.Theta(), m_rxnDepth);
-			if(residKE > 0.0)
-			{
-				double residP = std::sqrt(residKE*(residKE + 2.0*m_residual->vec4.M()));
-				double residE = residKE + m_residual->vec4.M();
-				m_residual->SetVec4Spherical(m_residual->vec4.Theta(), m_residual->vec4.Phi(), residP, residE);
-			}
-			else
-				m_residual->SetVec4Spherical(m_residual->vec4.Theta(), m_residual->vec4.Phi(), 0.0, m_residual->vec4.M());
-		}
+			ApplyEnergyLoss(m_residual, residual, *m_residualSpecies, residual.Theta(), residual.M());
+		return ReactionStatus::Success;
 	}
 	
-	void Reaction::CalculateReaction()
+	ReactionStatus Reaction::CalculateReaction()
 	{
 		switch(m_ejectThetaType)
 		{
-			case RxnThetaType::CenterOfMass: CalculateReactionThetaCM(); break;
-			case RxnThetaType::Lab: CalculateReactionThetaLab(); break;
-			case RxnThetaType::None: CalculateReactionThetaCM(); break; //default behavior
+			case RxnThetaType::CenterOfMass: return CalculateReactionThetaCM();
+			case RxnThetaType::Lab: return CalculateReactionThetaLab();
+			case RxnThetaType::None: return CalculateReactionThetaCM(); //default behavior
 		}
+		return CalculateReactionThetaCM();
 	}
 	
 	//Calculate in CM, where decay is isotropic
-	void Reaction::CalculateDecay()
+	ReactionStatus Reaction::CalculateDecay()
 	{
+		Vec4 parent = FromROOT(m_target->vec4);
+		double parentMass = parent.M();
 		double residualMass = m_residual->groundStateMass + m_ex;
-		double Q = m_target->vec4.M() - m_ejectile->groundStateMass - residualMass;
+		double Q = parentMass - m_ejectile->groundStateMass - residualMass;
 		if(Q < 0)
-			throw QValueException();
+			return ReactionStatus::NegativeQValue;
 	
-		ROOT::Math::Boost boost(m_target->vec4.BoostToCM());
-		m_target->vec4 = boost*m_target->vec4;
-		double ejectE_cm = (m_ejectile->groundStateMass*m_ejectile->groundStateMass - 
-						   residualMass*residualMass + m_target->vec4.E()*m_target->vec4.E()) /
-					       (2.0*m_target->vec4.E());
-		double ejectP_cm = std::sqrt(ejectE_cm*ejectE_cm - m_ejectile->groundStateMass*m_ejectile->groundStateMass);
+		double ejectE_cm, ejectP_cm;
+		GetTwoBodyMomentum(parentMass, residualMass, ejectE_cm, ejectP_cm);
 	
-		m_ejectile->SetVec4Spherical(m_theta, m_phi, ejectP_cm, ejectE_cm);
+		LorentzBoost toLab(parent.BoostVector());
+		Vec4 ejectile = toLab(Vec4::FromDirection(GetDirection(), ejectP_cm, ejectE_cm));
 		m_ejectile->thetaCM = m_theta;
-	
-		m_target->vec4 = boost.Inverse() * m_target->vec4;
-		m_ejectile->vec4 = boost.Inverse() * m_ejectile->vec4;
-	
-		m_residual->vec4 = m_target->vec4 - m_ejectile->vec4;
+		Vec4 residual = parent - ejectile;
+		m_residual->vec4 = ToROOT(residual);
 	
 		//energy loss for the *light* break up nucleus
-		double ejectKE = m_ejectile->GetKE() - 
-					m_layeredTarget->GetEjectileEnergyLoss(m_ejectile->Z, m_ejectile->A, m_ejectile->GetKE(), m_rxnLayer, m_ejectile->vec4.Theta(), m_rxnDepth);
-		if(ejectKE > 0.0)
+		ApplyEnergyLoss(m_ejectile, ejectile, *m_ejectileSpecies, ejectile.Theta(), m_ejectile->groundStateMass);
+		//if on, get eloss for *heavy* break up nucleus
+		if(m_isResidEloss)
+			ApplyEnergyLoss(m_residual, residual, *m_residualSpecies, residual.Theta(), residual.M());
+		return ReactionStatus::Success;
+	}
+
+	/*
+		Batched version of Calculate. The reactants of each event are in the given slots of the batch, and the sampled parameters
+		in step. Gives the same results as calling Calculate for each event (up to round-off), but each stage is a loop over the
+		batch: the kinematics are branch-free arithmetic which the compiler can vectorize, and the energy losses go through the
+		batched LayeredTarget method. Events which fail are marked with the same status Calculate would return; their products are
+		left at rest, and they are skipped by any later step.
+	*/
+	void Reaction::CalculateBatch(EventBatch& batch, const ReactionSlots& slots, StepColumns& step)
+	{
+		if(!m_isInit)
+		{
+			for(std::size_t i=0; i<batch.GetSize(); i++)
+				batch.SetStatus(i, ReactionStatus::NotInitialized);
+			return;
+		}
+
+		for(std::size_t i=0; i<batch.GetSize(); i++)
 		{
-			double ejectP = std::sqrt(ejectKE*(ejectKE + 2.0*m_ejectile->groundStateMass));
-			double ejectE = ejectKE + m_ejectile->groundStateMass;
-			m_ejectile->SetVec4Spherical(m_ejectile->vec4.Theta(), m_ejectile->vec4.Phi(), ejectP, ejectE);
+			if(batch.GetStatus(i) != ReactionStatus::Success)
+				step.isActive[i] = 0;
 		}
+
+		if(m_isDecay)
+			CalculateDecayBatch(batch, slots, step);
 		else
-			m_ejectile->SetVec4Spherical(m_ejectile->vec4.Theta(), m_ejectile->vec4.Phi(), 0.0, m_ejectile->groundStateMass);
+			CalculateReactionBatch(batch, slots, step);
+	}
 
-		//if on, get eloss for *heavy* break up nucleus
-		if(m_isResidEloss)
+	//Unit vectors along (theta, phi) of each event, written into the momentum columns. The trigonometry is kept out of the kinematics loops
+	void Reaction::SetDirectionBatch(FourVectorColumns& columns, const StepColumns& step, std::size_t size)
+	{
+		if(m_isDirectionFixed)
+		{
+			std::fill_n(columns.px.begin(), size, m_fixedDirection.x);
+			std::fill_n(columns.py.begin(), size, m_fixedDirection.y);
+			std::fill_n(columns.pz.begin(), size, m_fixedDirection.z);
+			return;
+		}
+
+		double sinTheta;
+		for(std::size_t i=0; i<size; i++)
 		{
-			double residKE = m_residual->GetKE() - 
-					m_layeredTarget->GetEjectileEnergyLoss(m_residual->Z, m_residual->A, m_residual->GetKE(), m_rxnLayer, m_residual->vec4.Theta(), m_rxnDepth);
-			if(residKE > 0.0)
+			sinTheta = std::sin(step.theta[i]);
+			columns.px[i] = sinTheta*std::cos(step.phi[i]);
+			columns.py[i] = sinTheta*std::sin(step.phi[i]);
+			columns.pz[i] = std::cos(step.theta[i]);
+		}
+	}
+
+	/*
+		Energy loss of a product on the way out of the target. The momentum is rescaled along its direction, so the angles are never
+		recomputed from the vector. The invariant mass of each event is kept, as in the scalar path.
+	*/
+	void Reaction::ApplyEnergyLossBatch(FourVectorColumns& columns, const Species& species, StepColumns& step, std::size_t size)
+	{
+		double* px = columns.px.data();
+		double* py = columns.py.data();
+		double* pz = columns.pz.data();
+		double* E = columns.E.data();
+		double* kineticEnergy = step.kineticEnergy.data();
+		double* mass = step.mass.data();
+		double* angle = step.angle.data();
+		double p2, p;
+		for(std::size_t i=0; i<size; i++)
+		{
+			p2 = px[i]*px[i] + py[i]*py[i] + pz[i]*pz[i];
+			p = std::sqrt(p2);
+			mass[i] = std::sqrt(std::max(E[i]*E[i] - p2, 0.0));
+			kineticEnergy[i] = E[i] - mass[i];
+			angle[i] = p > 0.0 ? std::acos(pz[i]/p) : 0.0;
+		}
+
+		m_layeredTarget->GetEjectileEnergyLoss(species, kineticEnergy, angle, step.rxnDepth.data(), m_rxnLayer, step.eloss.data(), size);
+
+		double finalKE, finalP, scale;
+		for(std::size_t i=0; i<size; i++)
+		{
+			if(!step.isActive[i])
+				continue;
+
+			finalKE = std::max(kineticEnergy[i] - step.eloss[i], 0.0);
+			finalP = std::sqrt(finalKE*(finalKE + 2.0*mass[i]));
+			p = std::sqrt(px[i]*px[i] + py[i]*py[i] + pz[i]*pz[i]);
+			if(p > 0.0)
 			{
-				double residP = std::sqrt(residKE*(residKE + 2.0*m_residual->vec4.M()));
-				double residE = residKE + m_residual->vec4.M();
-				m_residual->SetVec4Spherical(m_residual->vec4.Theta(), m_residual->vec4.Phi(), residP, residE);
+				scale = finalP/p;
+				px[i] *= scale;
+				py[i] *= scale;
+				pz[i] *= scale;
 			}
 			else
-				m_residual->SetVec4Spherical(m_residual->vec4.Theta(), m_residual->vec4.Phi(), 0.0, m_residual->vec4.M());
+				pz[i] = finalP;
+			E[i] = finalKE + mass[i];
 		}
 	}
 
+	void Reaction::CalculateReactionBatch(EventBatch& batch, const ReactionSlots& slots, StepColumns& step)
+	{
+		std::size_t size = batch.GetSize();
+		FourVectorColumns& target = batch.GetSlot(slots.target);
+		FourVectorColumns& projectile = batch.GetSlot(slots.projectile);
+		FourVectorColumns& ejectile = batch.GetSlot(slots.ejectile);
+		FourVectorColumns& residual = batch.GetSlot(slots.residual);
+
+		//Beam energy at the reaction point
+		double* bke = step.kineticEnergy.data();
+		for(std::size_t i=0; i<size; i++)
+		{
+			if(m_beamElossMap != nullptr && m_beamElossMap->IsEnergyInRange(step.beamEnergy[i]))
+				bke[i] = step.beamEnergy[i] - m_beamElossMap->GetEnergyLoss(step.beamEnergy[i], step.rxnDepth[i]);
+			else
+				bke[i] = step.beamEnergy[i] - m_layeredTarget->GetProjectileEnergyLoss(*m_projectileSpecies, step.beamEnergy[i], m_rxnLayer, 0,
+																						step.rxnDepth[i]);
+		}
+
+		SetDirectionBatch(ejectile, step, size);
+
+		const double mt = m_target->groundStateMass;
+		const double mp = m_projectile->groundStateMass;
+		const double me = m_ejectile->groundStateMass;
+		const double mr = m_residual->groundStateMass;
+		const bool isLab = m_ejectThetaType == RxnThetaType::Lab;
+		double* tpx = target.px.data(); double* tpy = target.py.data(); double* tpz = target.pz.data(); double* tE = target.E.data();
+		double* bpx = projectile.px.data(); double* bpy = projectile.py.data(); double* bpz = projectile.pz.data(); double* bE = projectile.E.data();
+		double* epx = ejectile.px.data(); double* epy = ejectile.py.data(); double* epz = ejectile.pz.data(); double* eE = ejectile.E.data();
+		double* rpx = residual.px.data(); double* rpy = residual.py.data(); double* rpz = residual.pz.data(); double* rE = residual.E.data();
+		const double* ex = step.ex.data();
+		uint8_t* isValid = step.isValid.data();
+		for(std::size_t i=0; i<size; i++)
+		{
+			//Target at rest, with 0 excitation energy
+			tpx[i] = 0.0; tpy[i] = 0.0; tpz[i] = 0.0; tE[i] = mt;
+			double beamP = std::sqrt(bke[i]*(bke[i] + 2.0*mp));
+			double beamE = bke[i] + mp;
+			bpx[i] = 0.0; bpy[i] = 0.0; bpz[i] = beamP; bE[i] = beamE;
+
+			double residualMass = mr + ex[i];
+			double Q = mt + mp - (me + residualMass);
+			double Ethresh = -Q*(me + mr)/(me + mr - mp);
+			isValid[i] = bke[i] >= Ethresh;
+
+			double ejectP, ejectE;
+			if(isLab)
+			{
+				//Iliadis, Nuclear Physics of Stars, Appendix C (see CalculateReactionThetaLab)
+				double term1 = std::sqrt(mp*me*bke[i])/(me + mr)*epz[i];
+				double term2 = (bke[i]*(mr - mp) + mr*Q)/(mr + me);
+				double root = std::sqrt(term1*term1 + term2);
+				double sqrtKE = term1 + root > 0.0 ? term1 + root : term1 - root;
+				double ejectKE = sqrtKE*sqrtKE;
+				ejectP = std::sqrt(ejectKE*(ejectKE + 2.0*me));
+				ejectE = ejectKE + me;
+				epx[i] *= ejectP;
+				epy[i] *= ejectP;
+				epz[i] *= ejectP;
+			}
+			else
+			{
+				//Two body decay of the compound system in its rest frame, then boost along the beam axis (see CalculateReactionThetaCM)
+				double parentE = mt + beamE;
+				double beta = beamP/parentE;
+				double gamma = 1.0/std::sqrt(1.0 - beta*beta);
+				double parentMass = std::sqrt(parentE*parentE - beamP*beamP);
+				double ejectE_cm = (me*me - residualMass*residualMass + parentMass*parentMass)/(2.0*parentMass);
+				double ejectP_cm = std::sqrt(ejectE_cm*ejectE_cm - me*me);
+				double pz_cm = epz[i]*ejectP_cm;
+				epx[i] *= ejectP_cm;
+				epy[i] *= ejectP_cm;
+				epz[i] = gamma*(pz_cm + beta*ejectE_cm);
+				ejectE = gamma*(ejectE_cm + beta*pz_cm);
+			}
+			eE[i] = ejectE;
+
+			rpx[i] = -epx[i];
+			rpy[i] = -epy[i];
+			rpz[i] = beamP - epz[i];
+			rE[i] = mt + beamE - ejectE;
+		}
+
+		for(std::size_t i=0; i<size; i++)
+		{
+			if(!isValid[i])
+			{
+				batch.SetStatus(i, ReactionStatus::BelowThreshold);
+				batch.SetAtRest(slots.ejectile, i, me);
+				batch.SetAtRest(slots.residual, i, mr);
+				step.isActive[i] = 0;
+			}
+		}
+
+		//energy loss for ejectile (after reaction!)
+		ApplyEnergyLossBatch(ejectile, *m_ejectileSpecies, step, size);
+		//if on, get eloss for residual (after reaction!)
+		if(m_isResidEloss)
+			ApplyEnergyLossBatch(residual, *m_residualSpecies, step, size);
+	}
+
+	//Decay of the target in its rest frame, where the ejectile angles are sampled, then boosted to the lab (see CalculateDecay)
+	void Reaction::CalculateDecayBatch(EventBatch& batch, const ReactionSlots& slots, StepColumns& step)
+	{
+		std::size_t size = batch.GetSize();
+		FourVectorColumns& target = batch.GetSlot(slots.target);
+		FourVectorColumns& ejectile = batch.GetSlot(slots.ejectile);
+		FourVectorColumns& residual = batch.GetSlot(slots.residual);
+
+		SetDirectionBatch(ejectile, step, size);
+
+		const double me = m_ejectile->groundStateMass;
+		const double mr = m_residual->groundStateMass;
+		const double* tpx = target.px.data(); const double* tpy = target.py.data(); const double* tpz = target.pz.data(); const double* tE = target.E.data();
+		double* epx = ejectile.px.data(); double* epy = ejectile.py.data(); double* epz = ejectile.pz.data(); double* eE = ejectile.E.data();
+		double* rpx = residual.px.data(); double* rpy = residual.py.data(); double* rpz = residual.pz.data(); double* rE = residual.E.data();
+		const double* ex = step.ex.data();
+		const uint8_t* isActive = step.isActive.data();
+		uint8_t* isValid = step.isValid.data();
+		for(std::size_t i=0; i<size; i++)
+		{
+			double parentMass = std::sqrt(tE[i]*tE[i] - (tpx[i]*tpx[i] + tpy[i]*tpy[i] + tpz[i]*tpz[i]));
+			double residualMass = mr + ex[i];
+			double Q = parentMass - me - residualMass;
+			isValid[i] = !isActive[i] || Q >= 0.0;
+			bool isDecayed = isActive[i] && Q >= 0.0;
+
+			//Same as GetTwoBodyMomentum, written out: its memo would be a branch and a store on every event of the loop
+			double ejectE_cm = (me*me - residualMass*residualMass + parentMass*parentMass)/(2.0*parentMass);
+			double ejectP_cm = std::sqrt(std::max(ejectE_cm*ejectE_cm - me*me, 0.0));
+			Vec4 parent(tpx[i], tpy[i], tpz[i], tE[i]);
+			LorentzBoost toLab(parent.BoostVector());
+			Vec4 ejectile = toLab(Vec4::FromDirection(Vec3(epx[i], epy[i], epz[i]), ejectP_cm, ejectE_cm));
+			Vec4 residual = parent - ejectile;
+
+			//Products of a decay which did not happen (or failed) are left at rest (their sampled angles are not valid)
+			epx[i] = isDecayed ? ejectile.p.x : 0.0;
+			epy[i] = isDecayed ? ejectile.p.y : 0.0;
+			epz[i] = isDecayed ? ejectile.p.z : 0.0;
+			eE[i] = isDecayed ? ejectile.E : me;
+			rpx[i] = isDecayed ? residual.p.x : 0.0;
+			rpy[i] = isDecayed ? residual.p.y : 0.0;
+			rpz[i] = isDecayed ? residual.p.z : 0.0;
+			rE[i] = isDecayed ? residual.E : mr;
+		}
+
+		for(std::size_t i=0; i<size; i++)
+		{
+			if(!isValid[i])
+			{
+				batch.SetStatus(i, ReactionStatus::NegativeQValue);
+				step.isActive[i] = 0;
+			}
+		}
+
+		for(std::size_t i=0; i<size; i++)
+			if(isActive[i])
+				ejectile.thetaCM[i] = step.theta[i];
+
+		//energy loss for the *light* break up nucleus
+		ApplyEnergyLossBatch(ejectile, *m_ejectileSpecies, step, size);
+		//if on, get eloss for *heavy* break up nucleus
+		if(m_isResidEloss)
+			ApplyEnergyLossBatch(residual, *m_residualSpecies, step, size);
+	}
+
 	bool Reaction::CheckReactionThreshold(double beamEnergy, double residEx)
 	{
 		double Q = m_target->groundStateMass + m_projectile->groundStateMass -
@@ -268,6 +531,20 @@ namespace Mask {
 			return true;
 	}
 
+	//Largest residual excitation for which beamEnergy is above the reaction threshold (see CheckReactionThreshold)
+	double Reaction::GetReactionExcitationLimit(double beamEnergy)
+	{
+		double massSum = m_ejectile->groundStateMass + m_residual->groundStateMass;
+		double Q = m_target->groundStateMass + m_projectile->groundStateMass - massSum;
+		return Q + beamEnergy*(massSum - m_projectile->groundStateMass)/massSum;
+	}
+
+	//Largest residual excitation for which the decay of a target with excitation targetEx is allowed (see CheckDecayThreshold)
+	double Reaction::GetDecayExcitationLimit(double targetEx)
+	{
+		return m_target->groundStateMass + targetEx - (m_ejectile->groundStateMass + m_residual->groundStateMass);
+	}
+
 	bool Reaction::CheckDecayThreshold(double targetEx, double residEx)
 	{
 		double Q = m_target->groundStateMass + targetEx - 
@@ -11,6 +11,9 @@
 
 #include "Nucleus.h"
 #include "LayeredTarget.h"
+#include "BeamEnergyLossMap.h"
+#include "EventBatch.h"
+#include "Vec4.h"
 #include "RxnType.h"
 
 namespace Mask {
@@ -21,39 +24,51 @@ namespace Mask {
 		Reaction();
 		Reaction(Nucleus* target, Nucleus* projectile, Nucleus* ejectile, Nucleus* residual);
 		~Reaction();
-		bool Calculate(); //do sim
+		ReactionStatus Calculate(); //do sim
+		void CalculateBatch(EventBatch& batch, const ReactionSlots& slots, StepColumns& step); //do sim for a batch of events
 
 		void BindNuclei(Nucleus* target, Nucleus* projectile, Nucleus* ejectile, Nucleus* residual);
 		void SetBeamKE(double bke);
 		void SetEjectileThetaType(RxnThetaType type);
 	
-		void SetLayeredTarget(LayeredTarget* targ) { m_layeredTarget = targ; };
+		void SetLayeredTarget(const LayeredTarget* targ) { m_layeredTarget = targ; };
+		void SetBeamEnergyLossMap(const BeamEnergyLossMap* map) { m_beamElossMap = map; }
 
 		void SetPolarRxnAngle(double theta) { m_theta = theta; };
 		void SetAzimRxnAngle(double phi) { m_phi = phi; };
 		void SetExcitation(double ex) { m_ex = ex; };
 		void SetReactionDepth(double depth) { m_rxnDepth = depth; }
+		void SetFixedDirection(double theta, double phi);
 
-		void BindTarget(Nucleus* nuc) { m_target = nuc; };
-		void BindProjectile(Nucleus* nuc) { m_projectile = nuc; };
-		void BindEjectile(Nucleus* nuc) { m_ejectile = nuc; };
-		void BindResidual(Nucleus* nuc) { m_residual = nuc; };
+		void BindTarget(Nucleus* nuc) { BindNuclei(nuc, m_projectile, m_ejectile, m_residual); };
+		void BindProjectile(Nucleus* nuc) { BindNuclei(m_target, nuc, m_ejectile, m_residual); };
+		void BindEjectile(Nucleus* nuc) { BindNuclei(m_target, m_projectile, nuc, m_residual); };
+		void BindResidual(Nucleus* nuc) { BindNuclei(m_target, m_projectile, m_ejectile, nuc); };
 
 		void SetRxnLayer(std::size_t layer) { m_rxnLayer = layer; };
 		void SetResidualEnergyLoss(bool isEloss) { m_isResidEloss = isEloss; };
 
 		bool CheckReactionThreshold(double beamEnergy, double residualEx);
 		bool CheckDecayThreshold(double targetEx, double residualEx);
+		double GetReactionExcitationLimit(double beamEnergy);
+		double GetDecayExcitationLimit(double targetEx);
 
 		bool IsDecay() const { return m_isDecay; };
 
 		std::size_t GetRxnLayer() const { return m_rxnLayer; };
 	
 	private:
-		void CalculateDecay(); //target -> light_decay (eject) + heavy_decay(resid)
-		void CalculateReaction(); //target + project -> eject + resid
-		void CalculateReactionThetaLab();
-		void CalculateReactionThetaCM();
+		ReactionStatus CalculateDecay(); //target -> light_decay (eject) + heavy_decay(resid)
+		ReactionStatus CalculateReaction(); //target + project -> eject + resid
+		ReactionStatus CalculateReactionThetaLab();
+		ReactionStatus CalculateReactionThetaCM();
+		void ApplyEnergyLoss(Nucleus* nucleus, Vec4& vec, const Species& species, double angle, double mass);
+		Vec3 GetDirection() const { return m_isDirectionFixed ? m_fixedDirection : Vec3::FromSpherical(m_theta, m_phi); }
+		void GetTwoBodyMomentum(double parentMass, double residualMass, double& energy, double& momentum);
+		void CalculateDecayBatch(EventBatch& batch, const ReactionSlots& slots, StepColumns& step);
+		void CalculateReactionBatch(EventBatch& batch, const ReactionSlots& slots, StepColumns& step);
+		void SetDirectionBatch(FourVectorColumns& columns, const StepColumns& step, std::size_t size);
+		void ApplyEnergyLossBatch(FourVectorColumns& columns, const Species& species, StepColumns& step, std::size_t size);
 	
 		//Reactants -> NOT OWNED BY RXN
 		Nucleus* m_target;
@@ -61,14 +76,24 @@ namespace Mask {
 		Nucleus* m_ejectile;
 		Nucleus* m_residual;
 
-		LayeredTarget* m_layeredTarget; //not owned by Reaction
+		//Energy loss species of the reactants, resolved when the nuclei are bound
+		const Species* m_projectileSpecies;
+		const Species* m_ejectileSpecies;
+		const Species* m_residualSpecies;
+
+		const LayeredTarget* m_layeredTarget; //not owned by Reaction
+		const BeamEnergyLossMap* m_beamElossMap; //not owned by Reaction, optional
 	
 		double m_bke, m_theta, m_phi, m_ex, m_rxnDepth;
+
+		//Invariants of the step: the ejectile direction when the angles are fixed, and the last two body breakup (see GetTwoBodyMomentum)
+		Vec3 m_fixedDirection;
+		double m_cmParentMass, m_cmResidualMass, m_cmEnergy, m_cmMomentum;
 	
 		int m_rxnLayer;
 		RxnThetaType m_ejectThetaType; 
 	
-		bool m_isDecay, m_isInit, m_isResidEloss;
+		bool m_isDecay, m_isInit, m_isResidEloss, m_isDirectionFixed;
 	};
 
 }
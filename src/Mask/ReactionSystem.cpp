@@ -6,20 +6,84 @@
 #include "OneStepSystem.h"
 #include "TwoStepSystem.h"
 #include "ThreeStepSystem.h"
+#include "ChainSystem.h"
+#include "PhaseSpaceSystem.h"
+#include "RandomGenerator.h"
+
+#include <cmath>
 
 namespace Mask {
 
 	ReactionSystem::ReactionSystem() :
-		m_isTargetSet(false), m_isValid(true), m_rxnLayer(0), m_sysEquation(""), m_rxnDepthDist(0.0, 1.0)
+		m_target(nullptr), m_rxnDepthDist(0.0, 1.0), m_acceptanceMap(nullptr), m_biasStep(0), m_biasFloor(1.0), m_eventWeight(1.0),
+		m_biasDist(0.0, 1.0), m_nextDimension(0), m_excitationDimension(0), m_isExcitationRedraw(false), m_weightBeforeExcitations(1.0),
+		m_isTargetSet(false), m_isValid(true), m_rxnLayer(0), m_sysEquation("")
 	{
+		m_statusCounts.fill(0);
 	}
 	
 	ReactionSystem::~ReactionSystem()
 	{
 	}
 
+	/*
+		Select the random stream of an event. The normal distributions cache a second value between calls, so they are reset to
+		keep each event independent of the one before it on this thread.
+	*/
+	void ReactionSystem::StartEvent(uint64_t eventIndex)
+	{
+		RandomGenerator::GetInstance().SetEvent(eventIndex);
+		m_nextDimension = 0;
+		m_eventWeight = 1.0;
+		for(auto& distribution : m_beamDistributions)
+			distribution.reset();
+		for(auto& distribution : m_exDistributions)
+			distribution.reset();
+	}
+
+	ReactionStatus ReactionSystem::RunEvent(uint64_t eventIndex)
+	{
+		StartEvent(eventIndex);
+		ReactionStatus status = RunSystem();
+		m_statusCounts[static_cast<std::size_t>(status)]++;
+		return status;
+	}
+
+	void ReactionSystem::CountStatus(const EventBatch& batch)
+	{
+		for(std::size_t i=0; i<batch.GetSize(); i++)
+			m_statusCounts[static_cast<std::size_t>(batch.GetStatus(i))]++;
+	}
+
+	/*
+		Run events firstEvent to firstEvent + size - 1 into a batch. Systems which implement the batched kinematics override this;
+		the default runs the scalar path event by event and copies the nuclei into the batch.
+	*/
+	void ReactionSystem::RunBatch(EventBatch& batch, uint64_t firstEvent, std::size_t size)
+	{
+		batch.Resize(m_nuclei.size(), size);
+		batch.SetFirstEvent(firstEvent);
+		for(std::size_t i=0; i<size; i++)
+		{
+			batch.SetStatus(i, RunEvent(firstEvent + i));
+			batch.SetWeight(i, m_eventWeight);
+			batch.StoreNuclei(i, m_nuclei);
+		}
+	}
+
 	ReactionSystem* CreateSystem(const std::vector<StepParameters>& params)
 	{
+		if(params.empty())
+			return nullptr;
+
+		for(const auto& step : params)
+		{
+			if(step.rxnType == RxnType::PhaseSpace)
+				return new PhaseSpaceSystem(params);
+		}
+
+		//The hand-written systems cover the common chains; any other chain goes to the generic executor
+		bool isReactionFirst = params[0].rxnType == RxnType::Reaction;
 		switch(params.size())
 		{
 			case 1:
@@ -28,18 +92,33 @@ namespace Mask {
 					return new DecaySystem(params);
 				else if (params[0].rxnType == RxnType::Reaction)
 					return new OneStepSystem(params);
+				break;
 			}
-			case 2: return new TwoStepSystem(params);
-			case 3: return new ThreeStepSystem(params);
+			case 2: if(isReactionFirst) return new TwoStepSystem(params); break;
+			case 3: if(isReactionFirst) return new ThreeStepSystem(params); break;
 		}
 
-		return nullptr;
+		return CreateChainSystem(params);
 	}
 
 	/*Set sampling parameters*/
 	//Should only ever really be one of these, but they cannot be set a priori
-	void ReactionSystem::AddBeamDistribution(double mean, double sigma)
+	void ReactionSystem::AddBeamDistribution(double mean, double sigma, const std::string& filename)
 	{
+		if(!filename.empty())
+		{
+			//The normal distribution is kept with the moments of the table, which set the range of the beam energy loss map
+			m_beamTables.emplace_back();
+			if(!m_beamTables.back().ReadDistributionFile(filename))
+			{
+				m_isValid = false;
+				std::cerr << "Invalid beam energy distribution file at ReactionSystem::AddBeamDistribution() -> " << filename << std::endl;
+				return;
+			}
+			m_beamDistributions.emplace_back(m_beamTables.back().GetMean(), m_beamTables.back().GetStdDev());
+			return;
+		}
+
 		if(mean == -1.0 || sigma == -1.0)
 		{
 			m_isValid = false;
@@ -48,6 +127,7 @@ namespace Mask {
 			return;
 		}
 		m_beamDistributions.emplace_back(mean, sigma);
+		m_beamTables.emplace_back();
 	}
 
 	//Again only really one of these, but same issue as beam. This is the sampling of the primary reaction/decay (step 1)
@@ -75,10 +155,38 @@ namespace Mask {
 		m_phiRanges.emplace_back(min*s_deg2rad, max*s_deg2rad);
 	}
 
+	/*
+		Called after the angle ranges of the first (reaction) step are added. If the config fixes both angles (ThetaMin = ThetaMax,
+		PhiMin = PhiMax), the ejectile direction is precomputed once in the step instead of per event.
+	*/
+	void ReactionSystem::FixReactionDirection(Reaction& step)
+	{
+		if(m_thetaRanges.empty() || m_phiRanges.empty())
+			return;
+
+		const std::uniform_real_distribution<double>& theta = m_thetaRanges[0];
+		const std::uniform_real_distribution<double>& phi = m_phiRanges[0];
+		if(theta.a() == theta.b() && phi.a() == phi.b())
+			step.SetFixedDirection(std::acos(theta.a()), phi.a());
+	}
+
 	//Each reaction step can generate an excited nucleus (for a reaction can make an excited residual, decay can make an excited
 	//breakup2 or "heavy")
-	void ReactionSystem::AddExcitationDistribution(double mean, double sigma)
+	void ReactionSystem::AddExcitationDistribution(double mean, double sigma, const std::string& filename)
 	{
+		if(!filename.empty())
+		{
+			m_exTables.emplace_back();
+			if(!m_exTables.back().ReadDistributionFile(filename))
+			{
+				m_isValid = false;
+				std::cerr << "Invalid excitation distribution file at ReactionSystem::AddExcitationDistribution() -> " << filename << std::endl;
+				return;
+			}
+			m_exDistributions.emplace_back(m_exTables.back().GetMean(), m_exTables.back().GetStdDev());
+			return;
+		}
+
 		if(mean == -1.0 || sigma == -1.0)
 		{
 			m_isValid = false;
@@ -87,6 +195,211 @@ namespace Mask {
 			return;
 		}
 		m_exDistributions.emplace_back(mean, sigma);
+		m_exTables.emplace_back();
+	}
+
+	/*
+		Sobol mode: each sampled quantity of an event takes its own dimensions of the event's point, reserved here in the order the
+		quantities are sampled. The order and number are fixed by the configuration, so a quantity always has the same dimensions.
+		Only the first attempt at a quantity uses them; redraws after a rejection come from the Philox stream, so rejections do not
+		move the dimensions of the quantities sampled after them.
+	*/
+	std::size_t ReactionSystem::ReserveDimensions(std::size_t nDimensions)
+	{
+		std::size_t first = m_nextDimension;
+		m_nextDimension += nDimensions;
+		return first;
+	}
+
+	//The dimensions of a direction are those of cos(theta), then phi, then the acceptance test if the step is biased
+	template<typename CosThetaSampler>
+	void ReactionSystem::SampleDirection(std::size_t step, std::size_t nCosThetaDimensions, CosThetaSampler&& sampleCosTheta,
+										 std::uniform_real_distribution<double>& phiRange, double& cosTheta, double& phi)
+	{
+		RandomGenerator& rng = RandomGenerator::GetInstance();
+		bool isBiased = m_acceptanceMap != nullptr && step == m_biasStep;
+		std::size_t dimension = ReserveDimensions(nCosThetaDimensions + (isBiased ? 2 : 1));
+		bool isRedraw = false;
+		do
+		{
+			rng.SetDimension(dimension, isRedraw);
+			cosTheta = sampleCosTheta();
+			rng.SetDimension(dimension + nCosThetaDimensions, isRedraw);
+			phi = rng.Sample(phiRange);
+			rng.SetDimension(dimension + nCosThetaDimensions + 1, isRedraw);
+			isRedraw = true;
+		}
+		while(!AcceptDirection(step, cosTheta, phi));
+	}
+
+	void ReactionSystem::SampleDirection(std::size_t step, std::uniform_real_distribution<double>& cosThetaRange,
+										 std::uniform_real_distribution<double>& phiRange, double& cosTheta, double& phi)
+	{
+		RandomGenerator& rng = RandomGenerator::GetInstance();
+		SampleDirection(step, 1, [&rng, &cosThetaRange]() { return rng.Sample(cosThetaRange); }, phiRange, cosTheta, phi);
+	}
+
+	void ReactionSystem::SampleDirection(std::size_t step, AngularDistribution& cosThetaDistribution,
+										 std::uniform_real_distribution<double>& phiRange, double& cosTheta, double& phi)
+	{
+		SampleDirection(step, cosThetaDistribution.GetNumberOfDimensions(), [&cosThetaDistribution]() { return cosThetaDistribution.GetRandomCosTheta(); },
+						phiRange, cosTheta, phi);
+	}
+
+	double ReactionSystem::SampleDepth()
+	{
+		RandomGenerator& rng = RandomGenerator::GetInstance();
+		rng.SetDimension(ReserveDimensions(1));
+		return rng.Sample(m_rxnDepthDist);
+	}
+
+	/*
+		The beam energy and the excitations are redrawn together, and take one dimension each: the beam energy, then excitation i.
+		Each excitation is drawn from its distribution truncated to the limit set by the draws before it, so on its own the set
+		would favour the beam energies and excitations which leave more of the later distributions allowed less than plain
+		sampling plus rejection of the whole set does. The event is therefore weighted by the product of the allowed fractions,
+		which makes the weighted distribution of the set exactly that of joint rejection. The weight is 1 for events far from
+		any threshold.
+	*/
+	void ReactionSystem::StartExcitations()
+	{
+		m_excitationDimension = ReserveDimensions(1 + m_exDistributions.size());
+		m_isExcitationRedraw = false;
+		m_weightBeforeExcitations = m_eventWeight;
+	}
+
+	void ReactionSystem::RedrawExcitations()
+	{
+		m_samplingStats.redraws++;
+		m_isExcitationRedraw = true;
+		m_eventWeight = m_weightBeforeExcitations;
+	}
+
+	/*
+		Draw from a normal distribution truncated to values <= upper, without rejecting whole events. When at least half of the
+		distribution is allowed, plain draws are repeated until one is allowed (at most two expected). Otherwise the
+		value is drawn from the tail with the exponential proposal of C.P. Robert, Stat. Comput. 5, 121 (1995), which accepts
+		more than 75% of the time however far into the tail the limit is. Returns false if no value is allowed (zero width
+		and the mean above the limit).
+	*/
+	bool ReactionSystem::SampleTruncatedNormal(std::normal_distribution<double>& distribution, double upper, double& value)
+	{
+		double mean = distribution.mean();
+		double sigma = distribution.stddev();
+		m_samplingStats.draws++;
+		if(sigma <= 0.0)
+		{
+			value = mean;
+			if(mean > upper)
+				return false;
+			m_samplingStats.allowedFraction += 1.0;
+			return true;
+		}
+
+		RandomGenerator& rng = RandomGenerator::GetInstance();
+		double limit = (upper - mean)/sigma;
+		double allowedFraction = 0.5*std::erfc(-limit/std::sqrt(2.0));
+		m_samplingStats.allowedFraction += allowedFraction;
+		m_eventWeight *= allowedFraction;
+		//Quasi-random draws must use exactly one coordinate, so the allowed part of the distribution is inverted directly
+		if(RandomGenerator::GetSamplingMode() == SamplingMode::Sobol && allowedFraction > 0.0)
+		{
+			value = mean + sigma*RandomGenerator::InverseNormalCDF(rng.Uniform()*allowedFraction);
+			return true;
+		}
+
+		RandomGenerator::Engine& gen = rng.GetGenerator();
+		if(limit >= 0.0)
+		{
+			do
+			{
+				value = distribution(gen);
+			}
+			while(value > upper);
+			return true;
+		}
+
+		//Sample z >= tail from the standard normal tail, then reflect; value = mean - sigma*z <= upper
+		double tail = -limit;
+		double rate = 0.5*(tail + std::sqrt(tail*tail + 4.0));
+		std::exponential_distribution<double> proposal(rate);
+		std::uniform_real_distribution<double> test(0.0, 1.0);
+		double z;
+		do
+		{
+			z = tail + proposal(gen);
+		}
+		while(test(gen) > std::exp(-0.5*(z - rate)*(z - rate)));
+		value = mean - sigma*z;
+		return true;
+	}
+
+	double ReactionSystem::SampleBeamEnergy()
+	{
+		RandomGenerator::GetInstance().SetDimension(m_excitationDimension, m_isExcitationRedraw);
+		if(m_beamTables[0].IsValid())
+			return m_beamTables[0].Sample();
+		return RandomGenerator::GetInstance().Sample(m_beamDistributions[0]);
+	}
+
+	//Excitation of step index truncated to values <= upper, from its table if one was given (see SampleTruncatedNormal)
+	bool ReactionSystem::SampleExcitation(std::size_t index, double upper, double& value)
+	{
+		RandomGenerator::GetInstance().SetDimension(m_excitationDimension + 1 + index, m_isExcitationRedraw);
+		TabulatedDistribution& table = m_exTables[index];
+		if(!table.IsValid())
+			return SampleTruncatedNormal(m_exDistributions[index], upper, value);
+
+		m_samplingStats.draws++;
+		double allowedFraction = table.GetCumulativeProbability(upper);
+		m_samplingStats.allowedFraction += allowedFraction;
+		m_eventWeight *= std::min(allowedFraction, 1.0);
+		return table.SampleTruncated(upper, value);
+	}
+
+	/*
+		Importance sampling of the angles of the biased step: a direction drawn from the physical distribution is kept with
+		probability g = floor + (1 - floor)*acceptance, and the caller redraws until one is kept. The kept directions follow the
+		physical distribution times g, so the event is weighted by 1/g; the sum of the weights is then the expected number of
+		unbiased draws, and weighted distributions are those of unbiased sampling. The map is of lab directions, so MaskApp only
+		biases a reaction step whose ejectile angles are sampled in the lab (ThetaType Lab). Steps which are not biased always
+		keep the direction.
+	*/
+	bool ReactionSystem::AcceptDirection(std::size_t step, double cosTheta, double phi)
+	{
+		if(m_acceptanceMap == nullptr || step != m_biasStep)
+			return true;
+
+		m_samplingStats.directionDraws++;
+		double probability = m_biasFloor + (1.0 - m_biasFloor)*m_acceptanceMap->GetAcceptance(cosTheta, phi);
+		if(RandomGenerator::GetInstance().Sample(m_biasDist) >= probability)
+			return false;
+		m_eventWeight /= probability;
+		return true;
+	}
+
+	void ReactionSystem::SetAngularSamplingMode(AngularSamplingMode mode)
+	{
+		for(auto& distribution : m_decayAngularDistributions)
+			distribution.SetSamplingMode(mode);
+	}
+
+	/*
+		Bias the sampled angles of a step (index into the reaction chain) towards the accepted regions of a detector array. floor is
+		the acceptance probability given to directions the map does not accept, and must be > 0 so that every direction can still
+		be sampled.
+	*/
+	bool ReactionSystem::SetAcceptanceBias(const AcceptanceMap* map, std::size_t step, double floor)
+	{
+		if(map == nullptr || !map->IsValid() || step >= m_phiRanges.size() || floor <= 0.0 || floor > 1.0)
+		{
+			std::cerr << "Invalid parameters at ReactionSystem::SetAcceptanceBias() -> step: " << step + 1 << " floor: " << floor << std::endl;
+			return false;
+		}
+		m_acceptanceMap = map;
+		m_biasStep = step;
+		m_biasFloor = floor;
+		return true;
 	}
 
 	//Apply angular distributions to decay products. Here apply them to the breakup1 or "light" fragment
@@ -97,4 +410,26 @@ namespace Mask {
 		else
 			m_decayAngularDistributions.emplace_back(filename);
 	}
-}
\ No newline at end of file
+
+	/*
+		Precompute the beam energy loss to the reaction point for the first (reaction) step of target over the beam energy
+		distribution and reaction depth. The map is the same for every system (thread) of a chain, so it is built once, next to
+		the shared target, and given to the systems with SetLayeredTarget. Skipped (map left invalid) in Exact mode, where every
+		event is integrated, and for chains which do not start with a reaction.
+	*/
+	void ReactionSystem::BuildBeamEnergyLossMap(const LayeredTarget& target, BeamEnergyLossMap& map) const
+	{
+		if(m_beamDistributions.empty() || target.GetEnergyLossMode() == EnergyLossMode::Exact)
+			return;
+
+		std::size_t rxnLayer = target.FindLayerContaining(m_nuclei[0].Z, m_nuclei[0].A);
+		if(rxnLayer == target.GetNumberOfLayers())
+			return;
+		const Species& projectile = SpeciesLookup::GetInstance().FindSpecies(m_nuclei[1].Z, m_nuclei[1].A);
+		//A tabulated beam can have any shape, so its map spans the whole table rather than its mean +/- a few sigma
+		if(m_beamTables[0].IsValid())
+			map.BuildRange(target, projectile, rxnLayer, m_beamTables[0].GetMin(), m_beamTables[0].GetMax());
+		else
+			map.Build(target, projectile, rxnLayer, m_beamDistributions[0].mean(), m_beamDistributions[0].stddev());
+	}
+}
@@ -10,10 +10,16 @@
 #define REACTIONSYSTEM_H
 
 #include "Reaction.h"
+#include "EventBatch.h"
+#include "BeamEnergyLossMap.h"
 #include "KinematicsExceptions.h"
 #include "RxnType.h"
 #include "AngularDistribution.h"
+#include "AcceptanceMap.h"
+#include "TabulatedDistribution.h"
+#include "PhaseSpaceDecay.h"
 #include <vector>
+#include <array>
 #include <random>
 
 namespace Mask {
@@ -25,6 +31,7 @@ namespace Mask {
 		std::vector<int> A;
 		double meanBeamEnergy = -1.0;
 		double sigmaBeamEnergy = -1.0;
+		std::string beamEnergyFile; //Tabulated beam energy distribution; replaces the mean and sigma if given
 		RxnThetaType thetaType = RxnThetaType::None;
 		double thetaMin = -1.0;
 		double thetaMax = -1.0;
@@ -32,38 +39,98 @@ namespace Mask {
 		double phiMax = -1.0;
 		double meanResidualEx = -1.0;
 		double sigmaResidualEx = -1.0;
+		std::string residualExFile; //Tabulated excitation distribution; replaces the mean and sigma if given
 		std::string angularDistFile;
+		PhaseSpaceMode phaseSpaceMode = PhaseSpaceMode::Weighted; //PhaseSpace steps only. Their excitation is that of the parent
 	};
 
+	/*
+		Bookkeeping of the threshold-aware sampling. Each excitation is drawn from its distribution truncated to the kinematically
+		allowed region; allowedFraction accumulates the probability inside that region for each draw, i.e. the rate at which
+		plain sampling plus rejection would have been accepted. The event is weighted by the product of the allowed fractions of
+		its draws (see StartExcitations). Events are only redrawn when no value is allowed at all (a fixed excitation above the
+		limit).
+		directionDraws counts the angle draws of an acceptance-biased step, of which one per event is kept.
+	*/
+	struct SamplingStatistics
+	{
+		uint64_t draws = 0;
+		double allowedFraction = 0.0;
+		uint64_t redraws = 0;
+		uint64_t directionDraws = 0;
+	};
+
+	//Number of events with each ReactionStatus, indexed by the status
+	using StatusCounts = std::array<uint64_t, static_cast<std::size_t>(ReactionStatus::Count)>;
+
 	class ReactionSystem
 	{
 	public:
 		ReactionSystem();
 		virtual ~ReactionSystem();
 
-		virtual void SetLayeredTarget(const LayeredTarget& target) = 0;
-		virtual void RunSystem() = 0;
+		virtual void SetLayeredTarget(const LayeredTarget& target, const BeamEnergyLossMap* beamElossMap) = 0; //The map may be nullptr
+		void BuildBeamEnergyLossMap(const LayeredTarget& target, BeamEnergyLossMap& map) const;
+		virtual ReactionStatus RunSystem() = 0;
+		virtual void RunBatch(EventBatch& batch, uint64_t firstEvent, std::size_t size);
+		ReactionStatus RunEvent(uint64_t eventIndex);
+		void SetAngularSamplingMode(AngularSamplingMode mode);
+		bool SetAcceptanceBias(const AcceptanceMap* map, std::size_t step, double floor);
 
 		std::vector<Nucleus>* GetNuclei() { return &m_nuclei; }
 		const std::string& GetSystemEquation() const { return m_sysEquation; }
 		bool IsValid() const { return m_isValid; }
+		double GetEventWeight() const { return m_eventWeight; }
+		const SamplingStatistics& GetSamplingStatistics() const { return m_samplingStats; }
+		const StatusCounts& GetStatusCounts() const { return m_statusCounts; }
 
 	protected:
 		virtual void SetSystemEquation() = 0;
+		void StartEvent(uint64_t eventIndex);
+		void CountStatus(const EventBatch& batch);
 
-		void AddBeamDistribution(double mean, double sigma);
+		void AddBeamDistribution(double mean, double sigma, const std::string& filename);
 		void AddThetaRange(double min, double max);
 		void AddPhiRange(double min, double max);
-		void AddExcitationDistribution(double mean, double sigma);
+		void FixReactionDirection(Reaction& step);
+		void AddExcitationDistribution(double mean, double sigma, const std::string& filename);
 		void AddDecayAngularDistribution(const std::string& filename);
+		std::size_t ReserveDimensions(std::size_t nDimensions);
+		void SampleDirection(std::size_t step, std::uniform_real_distribution<double>& cosThetaRange, std::uniform_real_distribution<double>& phiRange,
+							 double& cosTheta, double& phi);
+		void SampleDirection(std::size_t step, AngularDistribution& cosThetaDistribution, std::uniform_real_distribution<double>& phiRange,
+							 double& cosTheta, double& phi);
+		double SampleDepth();
+		void StartExcitations();
+		void RedrawExcitations();
+		bool SampleTruncatedNormal(std::normal_distribution<double>& distribution, double upper, double& value);
+		double SampleBeamEnergy();
+		bool SampleExcitation(std::size_t index, double upper, double& value);
+		bool AcceptDirection(std::size_t step, double cosTheta, double phi);
 		
-		LayeredTarget m_target;
+		const LayeredTarget* m_target; //Not owned; shared read-only between systems, must outlive the system
 	
 		//Sampling information
 		std::vector<std::normal_distribution<double>> m_beamDistributions, m_exDistributions;
+		std::vector<TabulatedDistribution> m_beamTables, m_exTables; //Used in place of the normal distribution of the same index when valid
 		std::vector<std::uniform_real_distribution<double>> m_thetaRanges, m_phiRanges;
 		std::vector<AngularDistribution> m_decayAngularDistributions;
 		std::uniform_real_distribution<double> m_rxnDepthDist;
+		SamplingStatistics m_samplingStats;
+		StatusCounts m_statusCounts; //Events run by this system (thread), by outcome
+
+		//Acceptance biasing of the sampled angles of one step
+		const AcceptanceMap* m_acceptanceMap; //Not owned; shared read-only between systems, nullptr if not biased
+		std::size_t m_biasStep;
+		double m_biasFloor;
+		double m_eventWeight;
+		std::uniform_real_distribution<double> m_biasDist;
+
+		//Sobol dimensions of the event's point: the next free one, and the first of the beam energy and excitations
+		std::size_t m_nextDimension;
+		std::size_t m_excitationDimension;
+		bool m_isExcitationRedraw;
+		double m_weightBeforeExcitations;
 
 		bool m_isTargetSet;
 		bool m_isValid;
@@ -71,8 +138,14 @@ namespace Mask {
 		std::size_t m_rxnLayer;
 		std::string m_sysEquation;
 		std::vector<Nucleus> m_nuclei;
+		std::vector<StepColumns> m_stepColumns; //Sampled parameters of each step, for batches
 
 		static constexpr double s_deg2rad = M_PI/180.0;
+
+	private:
+		template<typename CosThetaSampler>
+		void SampleDirection(std::size_t step, std::size_t nCosThetaDimensions, CosThetaSampler&& sampleCosTheta,
+							 std::uniform_real_distribution<double>& phiRange, double& cosTheta, double& phi);
 	};
 
 	ReactionSystem* CreateSystem(const std::vector<StepParameters>& params);
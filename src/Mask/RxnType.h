@@ -9,6 +9,7 @@ namespace Mask {
 	{
 		Decay,
 		Reaction,
+		PhaseSpace, //N-body phase space breakup (see PhaseSpaceDecay)
 		None
 	};
 
@@ -19,6 +20,28 @@ namespace Mask {
 		None
 	};
 
+	//Outcome of the kinematics of an event, or of one step of it
+	enum class ReactionStatus
+	{
+		Success,
+		BelowThreshold, //Beam energy below the reaction threshold
+		NegativeQValue, //Not enough energy to create the decay products
+		NotInitialized, //The nuclei of the reaction were never bound
+		Count
+	};
+
+	static std::string ReactionStatusToString(ReactionStatus status)
+	{
+		switch(status)
+		{
+			case ReactionStatus::Success: return "Success";
+			case ReactionStatus::BelowThreshold: return "BelowThreshold";
+			case ReactionStatus::NegativeQValue: return "NegativeQValue";
+			case ReactionStatus::NotInitialized: return "NotInitialized";
+			default: return "None";
+		}
+	}
+
 	enum RxnSize
 	{
 		DecaySize = 2,
@@ -33,6 +56,8 @@ namespace Mask {
 			return RxnType::Decay;
 		else if (type == "Reaction")
 			return RxnType::Reaction;
+		else if (type == "PhaseSpace")
+			return RxnType::PhaseSpace;
 		else
 			return RxnType::None;
 	}
@@ -43,6 +68,7 @@ namespace Mask {
 		{
 			case RxnType::Decay: return "Decay";
 			case RxnType::Reaction: return "Reaction";
+			case RxnType::PhaseSpace: return "PhaseSpace";
 			case RxnType::None: return "None";
 			default: return "None";
 		}
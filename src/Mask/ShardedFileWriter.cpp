@@ -0,0 +1,120 @@
+#include "ShardedFileWriter.h"
+
+#include "TChain.h"
+#include "TFileMerger.h"
+
+#include <iostream>
+#include <cstdio>
+
+namespace Mask {
+
+    ShardedFileWriter::ShardedFileWriter()
+    {
+    }
+
+    ShardedFileWriter::~ShardedFileWriter() {}
+
+    bool ShardedFileWriter::Open(const std::string& filename, const std::string& treename, std::size_t nShards, WriterMode mode)
+    {
+        m_filename = filename;
+        m_treename = treename;
+        m_shards.clear();
+        m_shardFileNames.clear();
+        m_merger.reset();
+        if(mode == WriterMode::BufferMerger)
+        {
+            m_merger = std::make_unique<BufferMerger>(filename.c_str(), "RECREATE");
+            m_merger->SetAutoSave(s_mergerAutoSave);
+            for(std::size_t i=0; i<nShards; i++)
+                m_shards.push_back(std::make_unique<FileWriter>()); //Filled directly, so their queues are never allocated
+            return true;
+        }
+
+        for(std::size_t i=0; i<nShards; i++)
+        {
+            m_shardFileNames.push_back(GetShardFileName(filename, i));
+            m_shards.push_back(std::make_unique<FileWriter>(m_shardFileNames.back(), treename));
+            if(!m_shards.back()->IsOpen() || !m_shards.back()->IsTree())
+            {
+                std::cerr << "Unable to open output shard " << m_shardFileNames.back() << std::endl;
+                m_shards.clear();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool ShardedFileWriter::Close(bool merge)
+    {
+        if(!IsOpen())
+            return false;
+
+        for(auto& shard : m_shards)
+            shard->Close();
+        m_shards.clear();
+
+        //The merger writes out the output file once all of its files are closed
+        if(m_merger != nullptr)
+        {
+            m_merger.reset();
+            return true;
+        }
+
+        if(merge)
+        {
+            TFileMerger merger(false, false);
+            merger.SetFastMethod(true);
+            if(!merger.OutputFile(m_filename.c_str(), "RECREATE"))
+            {
+                std::cerr << "Unable to open output data file " << m_filename << " for merging; the shards are kept" << std::endl;
+                return false;
+            }
+            for(auto& name : m_shardFileNames)
+                merger.AddFile(name.c_str(), false);
+            if(!merger.Merge())
+            {
+                std::cerr << "Merging the output shards into " << m_filename << " failed; the shards are kept" << std::endl;
+                return false;
+            }
+            for(auto& name : m_shardFileNames)
+                std::remove(name.c_str());
+            return true;
+        }
+
+        TFile* index = TFile::Open(m_filename.c_str(), "RECREATE");
+        if(index == nullptr || !index->IsOpen())
+        {
+            std::cerr << "Unable to open output data file " << m_filename << " for the chain of the shards" << std::endl;
+            return false;
+        }
+        TChain chain(m_treename.c_str());
+        for(auto& name : m_shardFileNames)
+            chain.Add(name.c_str());
+        index->cd();
+        chain.Write(m_treename.c_str(), TObject::kOverwrite);
+        index->Close();
+        delete index;
+        return true;
+    }
+
+    void ShardedFileWriter::StartShard(std::size_t shard)
+    {
+        if(m_merger != nullptr)
+            m_shards[shard]->Open(*m_merger, m_treename);
+    }
+
+    void ShardedFileWriter::FinishShard(std::size_t shard)
+    {
+        if(m_merger != nullptr)
+            m_shards[shard]->Close();
+    }
+
+    std::string ShardedFileWriter::GetShardFileName(const std::string& filename, std::size_t shard)
+    {
+        std::size_t directoryEnd = filename.find_last_of('/');
+        std::size_t extensionStart = filename.find_last_of('.');
+        if(extensionStart == std::string::npos || (directoryEnd != std::string::npos && extensionStart < directoryEnd))
+            extensionStart = filename.size();
+        return filename.substr(0, extensionStart) + "_shard" + std::to_string(shard) + filename.substr(extensionStart);
+    }
+}
@@ -0,0 +1,61 @@
+/*
+    ShardedFileWriter.h
+    Output split into one file (shard) per worker thread. Each shard is filled directly by the thread which owns it, so the
+    serialization and compression of the events run in parallel instead of on the single writer thread of the queue. Shard i
+    of output.root is output_shard<i>.root.
+
+    On Close the shards are either merged into the output file, or kept with the output file holding a TChain of them under the
+    tree name. ROOT reads a chain back from a file as a tree, so FileReader and RootPlot take either output as is (the shard
+    paths are stored as given, so a relative output path is resolved from the working directory). The merge copies the
+    compressed baskets without unpacking them, so it costs little more than the I/O.
+
+    With a BufferMerger (WriterMode::BufferMerger) the shards are instead files in memory, which each thread opens with StartShard
+    and closes with FinishShard. A file hands its compressed data to the merger each time it is written, which the FileWriter
+    does every 32 MB of filled (uncompressed) events and on FinishShard, so the memory of a thread stays bounded. The merger
+    merges what it is handed into the one output file, so the output is a single file without a merge at the end, while
+    compression still runs on every thread. For file shards StartShard and FinishShard do nothing.
+
+    ROOT::EnableThreadSafety must be called before the shards are filled from more than one thread.
+*/
+#ifndef SHARDED_FILE_WRITER_H
+#define SHARDED_FILE_WRITER_H
+
+#include "FileWriter.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+
+namespace Mask {
+
+    class ShardedFileWriter
+    {
+    public:
+        ShardedFileWriter();
+        ~ShardedFileWriter();
+
+        bool Open(const std::string& filename, const std::string& treename, std::size_t nShards, WriterMode mode); //Not thread safe!
+        bool Close(bool merge); //Not thread safe! Once every thread is done filling; merge only applies to file shards
+
+        //Called by the thread which fills the shard, before and after filling it
+        void StartShard(std::size_t shard);
+        void FinishShard(std::size_t shard);
+
+        bool IsOpen() const { return !m_shards.empty(); }
+        std::size_t GetNumberOfShards() const { return m_shards.size(); }
+        FileWriter& GetShard(std::size_t shard) { return *m_shards[shard]; } //Each shard should only be filled by one thread
+
+        static std::string GetShardFileName(const std::string& filename, std::size_t shard);
+
+    private:
+        std::string m_filename;
+        std::string m_treename;
+        std::vector<std::unique_ptr<FileWriter>> m_shards;
+        std::vector<std::string> m_shardFileNames;
+        std::unique_ptr<BufferMerger> m_merger; //BufferMerger mode only
+
+        static constexpr std::size_t s_mergerAutoSave = 32000000; //Bytes the merger collects from the files before it writes them to the output file
+    };
+}
+
+#endif
@@ -0,0 +1,125 @@
+#include "SobolSequence.h"
+
+namespace Mask {
+
+	//Degree, interior coefficients of the primitive polynomial, and initial direction numbers m_1 ... m_degree of dimensions 2 - 32
+	struct SobolPolynomial
+	{
+		uint32_t degree;
+		uint32_t coefficients;
+		std::array<uint32_t, 7> m;
+	};
+
+	static constexpr std::array<SobolPolynomial, SobolSequence::s_maxDimensions - 1> s_polynomials = {{
+		{1, 0, {1}},
+		{2, 1, {1, 3}},
+		{3, 1, {1, 3, 1}},
+		{3, 2, {1, 1, 1}},
+		{4, 1, {1, 1, 3, 3}},
+		{4, 4, {1, 3, 5, 13}},
+		{5, 2, {1, 1, 5, 5, 17}},
+		{5, 4, {1, 1, 5, 5, 5}},
+		{5, 7, {1, 1, 7, 11, 19}},
+		{5, 11, {1, 1, 5, 1, 1}},
+		{5, 13, {1, 1, 1, 3, 11}},
+		{5, 14, {1, 3, 5, 5, 31}},
+		{6, 1, {1, 3, 3, 9, 7, 49}},
+		{6, 13, {1, 1, 1, 15, 21, 21}},
+		{6, 16, {1, 3, 1, 13, 27, 49}},
+		{6, 19, {1, 1, 1, 15, 7, 5}},
+		{6, 22, {1, 3, 1, 15, 13, 25}},
+		{6, 25, {1, 1, 5, 5, 19, 61}},
+		{7, 1, {1, 3, 7, 11, 23, 15, 103}},
+		{7, 4, {1, 3, 7, 13, 13, 15, 69}},
+		{7, 7, {1, 1, 3, 13, 7, 35, 63}},
+		{7, 8, {1, 3, 5, 9, 1, 25, 53}},
+		{7, 14, {1, 3, 1, 13, 9, 35, 107}},
+		{7, 19, {1, 3, 1, 5, 27, 61, 31}},
+		{7, 21, {1, 1, 5, 11, 19, 41, 61}},
+		{7, 28, {1, 3, 5, 3, 3, 13, 69}},
+		{7, 31, {1, 1, 7, 13, 1, 19, 1}},
+		{7, 32, {1, 3, 7, 5, 13, 19, 59}},
+		{7, 37, {1, 1, 3, 9, 25, 29, 41}},
+		{7, 41, {1, 3, 5, 13, 23, 1, 55}},
+		{7, 42, {1, 3, 7, 3, 13, 59, 17}}
+	}};
+
+	//Mix the seed, dimension and high bits of the index into a scramble key (splitmix64 finalizer)
+	static uint32_t HashKey(uint64_t seed, uint64_t dimension, uint64_t block)
+	{
+		uint64_t x = seed ^ (dimension*0x9E3779B97F4A7C15) ^ (block*0xD1B54A32D192ED03);
+		x = (x ^ (x >> 30))*0xBF58476D1CE4E5B9;
+		x = (x ^ (x >> 27))*0x94D049BB133111EB;
+		x ^= x >> 31;
+		return (uint32_t)(x ^ (x >> 32));
+	}
+
+	double SobolSequence::GetCoordinate(uint64_t index, std::size_t dimension, uint64_t seed)
+	{
+		const std::array<uint32_t, 32>& directions = GetDirectionNumbers()[dimension];
+		uint32_t point = 0;
+		uint32_t bits = (uint32_t)index;
+		for(std::size_t i=0; bits != 0; i++, bits >>= 1)
+		{
+			if(bits & 1)
+				point ^= directions[i];
+		}
+		point = Scramble(point, HashKey(seed, dimension, index >> 32));
+		return (point + 0.5)*(1.0/4294967296.0);
+	}
+
+	const SobolSequence::DirectionNumbers& SobolSequence::GetDirectionNumbers()
+	{
+		static const DirectionNumbers s_directions = BuildDirectionNumbers();
+		return s_directions;
+	}
+
+	//Direction numbers as 32 bit fractions. The first dimension is the van der Corput sequence
+	SobolSequence::DirectionNumbers SobolSequence::BuildDirectionNumbers()
+	{
+		DirectionNumbers directions;
+		for(uint32_t i=0; i<32; i++)
+			directions[0][i] = 1u << (31 - i);
+
+		for(std::size_t dim=1; dim<s_maxDimensions; dim++)
+		{
+			const SobolPolynomial& polynomial = s_polynomials[dim - 1];
+			std::array<uint32_t, 32>& v = directions[dim];
+			uint32_t s = polynomial.degree;
+			for(uint32_t i=0; i<s; i++)
+				v[i] = polynomial.m[i] << (31 - i);
+			for(uint32_t i=s; i<32; i++)
+			{
+				v[i] = v[i-s] ^ (v[i-s] >> s);
+				for(uint32_t k=1; k<s; k++)
+				{
+					if((polynomial.coefficients >> (s - 1 - k)) & 1)
+						v[i] ^= v[i-k];
+				}
+			}
+		}
+		return directions;
+	}
+
+	//Laine-Karras permutation on the bit-reversed value: each output bit depends only on the more significant input bits
+	uint32_t SobolSequence::Scramble(uint32_t value, uint32_t seed)
+	{
+		value = ReverseBits(value);
+		value += seed;
+		value ^= value*0x6c50b47cu;
+		value ^= value*0xb82f1e52u;
+		value ^= value*0xc7afe638u;
+		value ^= value*0x8d22f6e6u;
+		return ReverseBits(value);
+	}
+
+	uint32_t SobolSequence::ReverseBits(uint32_t value)
+	{
+		value = ((value >> 1) & 0x55555555u) | ((value & 0x55555555u) << 1);
+		value = ((value >> 2) & 0x33333333u) | ((value & 0x33333333u) << 2);
+		value = ((value >> 4) & 0x0F0F0F0Fu) | ((value & 0x0F0F0F0Fu) << 4);
+		value = ((value >> 8) & 0x00FF00FFu) | ((value & 0x00FF00FFu) << 8);
+		return (value >> 16) | (value << 16);
+	}
+
+}
@@ -0,0 +1,39 @@
+/*
+	SobolSequence.h
+	Scrambled Sobol low-discrepancy points, for quasi-Monte Carlo sampling. Coordinates are computed directly from the point
+	index and the dimension (no state), so each event can take the point of its own index on any thread. The primitive
+	polynomials and initial direction numbers are those of S. Joe and F. Y. Kuo, SIAM J. Sci. Comput. 30, 2635 (2008).
+
+	Each dimension is scrambled with a hash-based approximation of Owen's nested uniform scrambling (B. Burley, "Practical
+	Hash-based Owen Scrambling", JCGT 9(4), 2020), keyed by the seed and the dimension. Scrambled points keep the stratification
+	of the sequence, while each point on its own is uniformly distributed, so estimates are unbiased and the spread of
+	independent seeds gives their uncertainty. The sequence is 32 bits deep; the index above 2^32 selects a new scramble.
+*/
+#ifndef SOBOLSEQUENCE_H
+#define SOBOLSEQUENCE_H
+
+#include <array>
+#include <cstdint>
+
+namespace Mask {
+
+	class SobolSequence
+	{
+	public:
+		static constexpr std::size_t s_maxDimensions = 32;
+
+		//Coordinate of point index in the given dimension (< s_maxDimensions), in (0, 1)
+		static double GetCoordinate(uint64_t index, std::size_t dimension, uint64_t seed);
+
+	private:
+		using DirectionNumbers = std::array<std::array<uint32_t, 32>, s_maxDimensions>;
+
+		static const DirectionNumbers& GetDirectionNumbers();
+		static DirectionNumbers BuildDirectionNumbers();
+		static uint32_t Scramble(uint32_t value, uint32_t seed);
+		static uint32_t ReverseBits(uint32_t value);
+	};
+
+}
+
+#endif
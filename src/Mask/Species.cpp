@@ -0,0 +1,49 @@
+/*
+	Species.cpp
+	A resolved particle species for energy loss calculations. See Species.h for details.
+*/
+#include "Species.h"
+#include "MassLookup.h"
+
+namespace Mask {
+
+	SpeciesLookup* SpeciesLookup::s_instance = new SpeciesLookup();
+
+	SpeciesLookup::SpeciesLookup() {}
+
+	SpeciesLookup::~SpeciesLookup() {}
+
+	/*
+		Return the Species for Z, A, resolving it on first use. Lookups of known species only take a shared lock, so this
+		is safe (if not free) to call from many threads; hot loops should hold on to the returned reference instead.
+		Throws MassException if there is no mass for the species.
+	*/
+	const Species& SpeciesLookup::FindSpecies(int Z, int A)
+	{
+		MassLookup::KeyPair key({(uint32_t)Z, (uint32_t)A});
+		std::size_t id = key.GetID();
+		{
+			std::shared_lock<std::shared_mutex> guard(m_mutex);
+			auto iter = m_indexMap.find(id);
+			if(iter != m_indexMap.end())
+				return m_species[iter->second];
+		}
+
+		std::unique_lock<std::shared_mutex> guard(m_mutex);
+		auto iter = m_indexMap.find(id);
+		if(iter != m_indexMap.end())
+			return m_species[iter->second];
+
+		Species species;
+		species.Z = Z;
+		species.A = A;
+		species.massMeV = MassLookup::GetInstance().FindMass(Z, A);
+		species.massU = MassLookup::GetInstance().FindMassU(Z, A);
+		species.index = m_species.size();
+		species.projectile = catima::Projectile(species.massU, Z, 0.0, 0.0);
+		m_species.push_back(species);
+		m_indexMap[id] = species.index;
+		return m_species.back();
+	}
+
+}
@@ -0,0 +1,52 @@
+/*
+	Species.h
+	A resolved particle species for energy loss calculations: Z, A, mass (u and MeV) and a catima projectile prototype.
+	Species are resolved once (typically when a system is set up) through the SpeciesLookup singleton, and the handle
+	is then passed to the Target/LayeredTarget energy loss methods, so that the per-event calculations do not repeat the
+	mass lookup or the construction of the catima projectile.
+
+	Each Species has a dense index, which Targets use to store per-species data (i.e. range tables) in a plain vector.
+	A resolved Species is never moved or modified, so references to it stay valid for the lifetime of the program.
+*/
+#ifndef SPECIES_H
+#define SPECIES_H
+
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include "catima/structures.h"
+
+namespace Mask {
+
+	struct Species
+	{
+		int Z = 0;
+		int A = 0;
+		double massU = 0.0;
+		double massMeV = 0.0;
+		std::size_t index = 0;
+		catima::Projectile projectile; //Prototype with T = 0; copy and set T before use
+	};
+
+	class SpeciesLookup
+	{
+	public:
+		~SpeciesLookup();
+		const Species& FindSpecies(int Z, int A);
+
+		static SpeciesLookup& GetInstance() { return *s_instance; }
+
+	private:
+		SpeciesLookup();
+
+		static SpeciesLookup* s_instance;
+
+		std::shared_mutex m_mutex;
+		std::deque<Species> m_species; //deque keeps references valid as species are added
+		std::unordered_map<std::size_t, std::size_t> m_indexMap;
+	};
+
+}
+
+#endif
@@ -0,0 +1,236 @@
+#include "TabulatedDistribution.h"
+#include "RandomGenerator.h"
+#include <fstream>
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+
+namespace Mask {
+
+	TabulatedDistribution::TabulatedDistribution() :
+		m_mean(0.0), m_stdDev(0.0), m_isValid(false)
+	{
+	}
+
+	TabulatedDistribution::TabulatedDistribution(const std::string& file) :
+		m_mean(0.0), m_stdDev(0.0), m_isValid(false)
+	{
+		ReadDistributionFile(file);
+	}
+
+	TabulatedDistribution::~TabulatedDistribution() {}
+
+	bool TabulatedDistribution::ReadDistributionFile(const std::string& file)
+	{
+		m_isValid = false;
+		std::ifstream input(file);
+		if(!input.is_open())
+		{
+			std::cerr << "Unable to open tabulated distribution file " << file << std::endl;
+			return false;
+		}
+
+		std::string junk;
+		std::size_t nPoints = 0;
+		input >> junk >> nPoints;
+		std::vector<double> values, weights;
+		double value, weight;
+		while(input >> value >> weight)
+		{
+			values.push_back(value);
+			weights.push_back(weight);
+		}
+		input.close();
+
+		if(nPoints < 2 || values.size() != nPoints)
+		{
+			std::cerr << "Unexpected number of points in tabulated distribution file " << file << "! Expected " << nPoints
+					  << " and given " << values.size() << " (at least 2 are needed)" << std::endl;
+			return false;
+		}
+
+		double total = 0.0;
+		for(std::size_t i=0; i<nPoints; i++)
+		{
+			if(weights[i] < 0.0 || (i > 0 && values[i] <= values[i-1]))
+			{
+				std::cerr << "Invalid tabulated distribution file " << file << ": values must increase and weights must not be negative"
+						  << std::endl;
+				return false;
+			}
+			if(i > 0)
+				total += 0.5*(values[i] - values[i-1])*(weights[i] + weights[i-1]);
+		}
+		if(total <= 0.0)
+		{
+			std::cerr << "Tabulated distribution in file " << file << " has no probability" << std::endl;
+			return false;
+		}
+
+		m_values = std::move(values);
+		m_weights = std::move(weights);
+		BuildTables();
+		m_isValid = true;
+		return true;
+	}
+
+	/*
+		Cumulative distribution at the points, the moments, and the alias table over the segments. Vose's construction: segments
+		are scaled so the mean probability is 1, then each underfull segment is topped up from an overfull one, which becomes its alias.
+	*/
+	void TabulatedDistribution::BuildTables()
+	{
+		std::size_t nSegments = m_values.size() - 1;
+		std::vector<double> masses(nSegments);
+		double total = 0.0, firstMoment = 0.0, secondMoment = 0.0;
+		double x0, h, a, b;
+		for(std::size_t i=0; i<nSegments; i++)
+		{
+			//Density a + b*s over x = x0 + h*s, s in [0, 1]
+			x0 = m_values[i];
+			h = m_values[i+1] - x0;
+			a = m_weights[i];
+			b = m_weights[i+1] - a;
+			masses[i] = h*(a + 0.5*b);
+			total += masses[i];
+			firstMoment += h*(x0*(a + 0.5*b) + h*(0.5*a + b/3.0));
+			secondMoment += h*(x0*x0*(a + 0.5*b) + 2.0*x0*h*(0.5*a + b/3.0) + h*h*(a/3.0 + 0.25*b));
+		}
+		m_mean = firstMoment/total;
+		m_stdDev = std::sqrt(std::max(secondMoment/total - m_mean*m_mean, 0.0));
+
+		m_cdfValues.resize(nSegments + 1);
+		m_cdfValues[0] = 0.0;
+		for(std::size_t i=0; i<nSegments; i++)
+			m_cdfValues[i+1] = m_cdfValues[i] + masses[i]/total;
+		m_cdfValues.back() = 1.0;
+
+		m_aliasProbability.resize(nSegments);
+		m_alias.resize(nSegments);
+		std::vector<std::size_t> small, large;
+		for(std::size_t i=0; i<nSegments; i++)
+		{
+			m_aliasProbability[i] = masses[i]*nSegments/total;
+			m_alias[i] = i;
+			if(m_aliasProbability[i] < 1.0)
+				small.push_back(i);
+			else
+				large.push_back(i);
+		}
+
+		std::size_t under, over;
+		while(!small.empty() && !large.empty())
+		{
+			under = small.back();
+			small.pop_back();
+			over = large.back();
+			m_alias[under] = over;
+			m_aliasProbability[over] -= 1.0 - m_aliasProbability[under];
+			if(m_aliasProbability[over] < 1.0)
+			{
+				large.pop_back();
+				small.push_back(over);
+			}
+		}
+		//Whatever is left is full up to round-off
+		for(std::size_t i : small)
+			m_aliasProbability[i] = 1.0;
+		for(std::size_t i : large)
+			m_aliasProbability[i] = 1.0;
+	}
+
+	/*
+		One uniform number picks the segment and decides between it and its alias; what is left of it is the position within the
+		chosen segment's probability.
+	*/
+	double TabulatedDistribution::Sample()
+	{
+		double uniform = RandomGenerator::GetInstance().Uniform();
+		if(RandomGenerator::GetSamplingMode() == SamplingMode::Sobol)
+			return Invert(uniform);
+
+		std::size_t nSegments = m_alias.size();
+		double scaled = uniform*nSegments;
+		std::size_t segment = std::min(static_cast<std::size_t>(scaled), nSegments - 1);
+		double remainder = scaled - segment;
+		double keep = m_aliasProbability[segment];
+		if(remainder < keep)
+			return InvertSegment(segment, remainder/keep);
+		else
+			return InvertSegment(m_alias[segment], (remainder - keep)/(1.0 - keep));
+	}
+
+	/*
+		Draw from the distribution truncated to values <= upper. As for the truncated normal, plain draws are repeated while at least
+		half of the distribution is allowed, and otherwise the allowed part of the cumulative distribution is inverted directly.
+		Returns false if no value is allowed.
+	*/
+	bool TabulatedDistribution::SampleTruncated(double upper, double& value)
+	{
+		double allowedFraction = GetCumulativeProbability(upper);
+		if(allowedFraction <= 0.0)
+		{
+			value = GetMin();
+			return false;
+		}
+		else if(allowedFraction >= 1.0)
+		{
+			value = Sample();
+			return true;
+		}
+
+		if(RandomGenerator::GetSamplingMode() == SamplingMode::Sobol || allowedFraction < 0.5)
+		{
+			value = std::min(Invert(RandomGenerator::GetInstance().Uniform()*allowedFraction), upper);
+			return true;
+		}
+
+		do
+		{
+			value = Sample();
+		}
+		while(value > upper);
+		return true;
+	}
+
+	double TabulatedDistribution::GetCumulativeProbability(double x) const
+	{
+		if(!m_isValid || x <= m_values.front())
+			return 0.0;
+		else if(x >= m_values.back())
+			return 1.0;
+
+		std::size_t segment = std::upper_bound(m_values.begin(), m_values.end(), x) - m_values.begin() - 1;
+		double h = m_values[segment+1] - m_values[segment];
+		double s = (x - m_values[segment])/h;
+		double a = m_weights[segment];
+		double b = m_weights[segment+1] - a;
+		double segmentMass = 0.5*(a + m_weights[segment+1]);
+		double fraction = segmentMass > 0.0 ? (a*s + 0.5*b*s*s)/segmentMass : s;
+		return m_cdfValues[segment] + fraction*(m_cdfValues[segment+1] - m_cdfValues[segment]);
+	}
+
+	//Value at which the cumulative distribution reaches probability
+	double TabulatedDistribution::Invert(double probability) const
+	{
+		std::size_t segment = std::upper_bound(m_cdfValues.begin(), m_cdfValues.end(), probability) - m_cdfValues.begin();
+		segment = std::clamp<std::size_t>(segment, 1, m_cdfValues.size() - 1) - 1;
+		double segmentProbability = m_cdfValues[segment+1] - m_cdfValues[segment];
+		double fraction = segmentProbability > 0.0 ? (probability - m_cdfValues[segment])/segmentProbability : 0.0;
+		return InvertSegment(segment, std::clamp(fraction, 0.0, 1.0));
+	}
+
+	/*
+		Value at a fraction of the probability of a segment, for the density w0 + (w1 - w0)s over s in [0, 1]. The root of the
+		quadratic cumulative distribution is written in the form without cancellation.
+	*/
+	double TabulatedDistribution::InvertSegment(std::size_t segment, double fraction) const
+	{
+		double w0 = m_weights[segment];
+		double w1 = m_weights[segment+1];
+		double denominator = w0 + std::sqrt(w0*w0 + fraction*(w1*w1 - w0*w0));
+		double s = denominator > 0.0 ? fraction*(w0 + w1)/denominator : fraction;
+		return m_values[segment] + s*(m_values[segment+1] - m_values[segment]);
+	}
+
+}
@@ -11,13 +11,18 @@ Written by G.W. McCann Aug. 2020
 
 */
 #include "Target.h"
+#include "EnergyLossCache.h"
 #include "catima/nucdata.h"
 
+#include <unordered_map>
+
 namespace Mask {
 
+	std::atomic<uint64_t> Target::s_nextMaterialId(0);
+
 	/*Targets must be of known thickness*/
 	Target::Target(const std::vector<int>& z, const std::vector<int>& a, const std::vector<int>& stoich, double thick) :
-		m_thickness(thick), m_thickness_gcm2(thick*1.0e-6)
+		m_thickness(thick), m_thickness_gcm2(thick*1.0e-6), m_elossMode(EnergyLossMode::Exact)
 	{
 		Init(z, a, stoich);
 	}
@@ -30,6 +35,7 @@ namespace Mask {
 		m_Z = z;
 		m_A = a;
 		m_stoich = stoich;
+		m_materialId = s_nextMaterialId.fetch_add(1);
 		MassLookup& masses = MassLookup::GetInstance();
 		for(size_t i=0; i<m_Z.size(); i++)
 		{
@@ -37,8 +43,119 @@ namespace Mask {
 		}
 	}
 	
+	/*
+		Build the range table for a projectile in this material. Only done in Tabulated mode, and only once per species;
+		copies of this Target made afterwards share the table. If a cache directory is set, the table is loaded from
+		there when available, and written there after being built otherwise. A table which could not be built is kept
+		too, so that it is not attempted (and reported) again; such species use the catima integration. Neutral species
+		(Z = 0) have no table.
+	*/
+	void Target::BuildEnergyLossTable(const Species& species)
+	{
+		if(m_elossMode == EnergyLossMode::Exact || species.Z == 0)
+			return;
+		else if(species.index < m_elossTables.size() && m_elossTables[species.index] != nullptr)
+			return;
+
+		if(m_elossTables.size() <= species.index)
+			m_elossTables.resize(species.index + 1);
+		auto table = std::make_shared<EnergyLossTable>();
+		uint64_t cacheKey = 0;
+		if(!m_elossCacheDirectory.empty())
+		{
+			cacheKey = EnergyLossCache::GetKey(m_Z, m_A, m_stoich, species.Z, species.A, species.projectile, m_material);
+			if(EnergyLossCache::Load(m_elossCacheDirectory, cacheKey, *table))
+			{
+				m_elossTables[species.index] = table;
+				return;
+			}
+		}
+
+		table->Build(species.projectile, m_material);
+		if(table->IsValid() && !m_elossCacheDirectory.empty())
+			EnergyLossCache::Save(m_elossCacheDirectory, cacheKey, *table);
+		m_elossTables[species.index] = table;
+	}
+
+	const EnergyLossTable* Target::FindEnergyLossTable(const Species& species) const
+	{
+		if(m_elossMode == EnergyLossMode::Exact || species.index >= m_elossTables.size())
+			return nullptr;
+
+		const EnergyLossTable* table = m_elossTables[species.index].get();
+		return table != nullptr && table->IsValid() ? table : nullptr;
+	}
+
+	/*
+		catima takes the path thickness from the material, and the Target is shared by every thread, so the integration runs on a
+		copy of the material. Each thread copies it once per material (the id is shared by copies of the Target, which have the
+		same material) and afterwards only sets the thickness, instead of copying the element list on every call.
+	*/
+	const catima::Material& Target::GetLocalMaterial(double thickness) const
+	{
+		thread_local std::unordered_map<uint64_t, catima::Material> materials;
+		auto iter = materials.find(m_materialId);
+		if(iter == materials.end())
+			iter = materials.emplace(m_materialId, m_material).first;
+		iter->second.thickness(thickness);
+		return iter->second;
+	}
+
+	/*
+		Energy loss through a path of given thickness (g/cm^2). Uses the range table when one exists for the projectile and
+		the energy is inside the table domain, otherwise falls back to full catima integration (see GetLocalMaterial).
+	*/
+	double Target::GetEnergyLoss(const Species& species, double startEnergy, double thickness) const
+	{
+		const EnergyLossTable* table = FindEnergyLossTable(species);
+		if(table != nullptr && table->IsEnergyInRange(startEnergy))
+			return table->GetEnergyLoss(startEnergy, thickness);
+
+		catima::Projectile proj = species.projectile;
+		proj.T = startEnergy/species.massU;
+		return catima::integrate_energyloss(proj, GetLocalMaterial(thickness));
+	}
+
+	/*
+		Reverse energy loss (energy lost by a projectile which exits the path with finalEnergy). Uses the same range table
+		as the forward calculation, falling back to full catima integration outside of the table domain.
+	*/
+	double Target::GetReverseEnergyLoss(const Species& species, double finalEnergy, double thickness) const
+	{
+		const EnergyLossTable* table = FindEnergyLossTable(species);
+		if(table != nullptr && table->IsEnergyInRange(finalEnergy) && table->IsRangeInRange(table->GetRange(finalEnergy) + thickness))
+			return table->GetReverseEnergyLoss(finalEnergy, thickness);
+
+		catima::Projectile proj = species.projectile;
+		proj.T = finalEnergy/species.massU;
+		return catima::reverse_integrate_energyloss(proj, GetLocalMaterial(thickness));
+	}
+
+	/*
+		Batched energy loss for n particles of one species through paths of the given thicknesses (g/cm^2). Elements outside
+		of the table domain (or all elements in Exact mode) are calculated one at a time.
+	*/
+	void Target::GetEnergyLoss(const Species& species, const double* startEnergies, const double* thicknesses, double* elosses, std::size_t n) const
+	{
+		const EnergyLossTable* table = FindEnergyLossTable(species);
+		if(table != nullptr && table->GetEnergyLoss(startEnergies, thicknesses, elosses, n))
+			return;
+
+		for(std::size_t i=0; i<n; i++)
+		{
+			if(table != nullptr && elosses[i] >= 0.0)
+				continue;
+			else if(thicknesses[i] <= 0.0)
+				elosses[i] = 0.0;
+			else if(std::isinf(thicknesses[i]))
+				elosses[i] = startEnergies[i];
+			else
+				elosses[i] = GetEnergyLoss(species, startEnergies[i], thicknesses[i]);
+		}
+	}
+
 	/*Element verification*/
-	bool Target::ContainsElement(int z, int a)
+	bool Target::ContainsElement(int z, int a) const
 	{
 		for(std::size_t i=0; i<m_Z.size(); i++)
 		{
@@ -49,58 +166,46 @@ namespace Mask {
 	}
 	
 	/*Calculates energy loss for travelling all the way through the target*/
-	double Target::GetEnergyLossTotal(int zp, int ap, double startEnergy, double theta)
+	double Target::GetEnergyLossTotal(const Species& species, double startEnergy, double theta) const
 	{
 		if(theta == M_PI/2.) 
 			return startEnergy;
 		else if (theta > M_PI/2.) 
 			theta = M_PI - theta;
 
-		catima::Projectile proj(MassLookup::GetInstance().FindMassU(zp, ap), zp, 0.0, 0.0);
-		proj.T = startEnergy/proj.A;
-		m_material.thickness(m_thickness_gcm2/fabs(cos(theta)));
-		return catima::integrate_energyloss(proj, m_material);
+		return GetEnergyLoss(species, startEnergy, m_thickness_gcm2/fabs(cos(theta)));
 	}
 
 	/*Calculates the energy loss for traveling some fraction through the target*/
-	double Target::GetEnergyLossFractionalDepth(int zp, int ap, double finalEnergy, double theta, double percent_depth)
+	double Target::GetEnergyLossFractionalDepth(const Species& species, double finalEnergy, double theta, double percent_depth) const
 	{
 		if(theta == M_PI/2.)
 			return finalEnergy;
 		else if (theta > M_PI/2.)
 			theta = M_PI-theta;
 
-		catima::Projectile proj(MassLookup::GetInstance().FindMassU(zp, ap), zp, 0.0, 0.0);
-		proj.T = finalEnergy/proj.A;
-		m_material.thickness(m_thickness_gcm2*percent_depth/fabs(cos(theta)));
-		return catima::integrate_energyloss(proj, m_material);
+		return GetEnergyLoss(species, finalEnergy, m_thickness_gcm2*percent_depth/fabs(cos(theta)));
 	}
 	
 	/*Calculates reverse energy loss for travelling all the way through the target*/
-	double Target::GetReverseEnergyLossTotal(int zp, int ap, double finalEnergy, double theta)
+	double Target::GetReverseEnergyLossTotal(const Species& species, double finalEnergy, double theta) const
 	{
 		if(theta == M_PI/2.) 
 			return finalEnergy;
 		else if (theta > M_PI/2.) 
 			theta = M_PI - theta;
 
-		catima::Projectile proj(MassLookup::GetInstance().FindMassU(zp, ap), zp, 0.0, 0.0);
-		proj.T = finalEnergy/proj.A;
-		m_material.thickness(m_thickness_gcm2/fabs(cos(theta)));
-		return catima::reverse_integrate_energyloss(proj, m_material);
+		return GetReverseEnergyLoss(species, finalEnergy, m_thickness_gcm2/fabs(cos(theta)));
 	}
 
 	/*Calculates the reverse energy loss for traveling some fraction through the target*/
-	double Target::GetReverseEnergyLossFractionalDepth(int zp, int ap, double finalEnergy, double theta, double percent_depth)
+	double Target::GetReverseEnergyLossFractionalDepth(const Species& species, double finalEnergy, double theta, double percent_depth) const
 	{
 		if(theta == M_PI/2.)
 			return finalEnergy;
 		else if (theta > M_PI/2.)
 			theta = M_PI-theta;
-		catima::Projectile proj(MassLookup::GetInstance().FindMassU(zp, ap), zp, 0.0, 0.0);
-		proj.T = finalEnergy/proj.A;
-		m_material.thickness(m_thickness_gcm2*percent_depth/fabs(cos(theta)));
-		return catima::reverse_integrate_energyloss(proj, m_material);
+		return GetReverseEnergyLoss(species, finalEnergy, m_thickness_gcm2*percent_depth/fabs(cos(theta)));
 	}
 
 }
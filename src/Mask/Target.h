@@ -5,6 +5,9 @@ A basic target unit for use in the Mask environment. A target
 is defined as a single compound with elements Z,A of a given stoichiometry
 Holds an energy loss class
 
+Once built (elements added, tables computed) a Target is never modified by the
+energy loss calculations, so a single instance can be shared by many threads.
+
 Based on code by D.W. Visser written at Yale for the original SPANC
 
 Written by G.W. McCann Aug. 2020
@@ -16,8 +19,13 @@ Written by G.W. McCann Aug. 2020
 #include <string>
 #include <vector>
 #include <cmath>
+#include <memory>
+#include <atomic>
+#include <cstdint>
 #include "catima/gwm_integrators.h"
 #include "MassLookup.h"
+#include "EnergyLossTable.h"
+#include "Species.h"
 
 namespace Mask {
 
@@ -26,24 +34,44 @@ namespace Mask {
 	public:
 	 	Target(const std::vector<int>& z, const std::vector<int>& a, const std::vector<int>& stoich, double thick);
 	 	~Target();
-	 	bool ContainsElement(int z, int a);
-	 	double GetEnergyLossTotal(int zp, int ap, double startEnergy, double angle);
-	 	double GetReverseEnergyLossTotal(int zp, int ap, double finalEnergy, double angle);
-	 	double GetEnergyLossFractionalDepth(int zp, int ap, double startEnergy, double angle, double percent_depth);
-	 	double GetReverseEnergyLossFractionalDepth(int zp, int ap, double finalEnergy, double angle, double percent_depth);
+	 	bool ContainsElement(int z, int a) const;
+	 	double GetEnergyLoss(const Species& species, double startEnergy, double thickness) const;
+	 	double GetReverseEnergyLoss(const Species& species, double finalEnergy, double thickness) const;
+	 	void GetEnergyLoss(const Species& species, const double* startEnergies, const double* thicknesses, double* elosses, std::size_t n) const;
+	 	double GetEnergyLossTotal(const Species& species, double startEnergy, double angle) const;
+	 	double GetReverseEnergyLossTotal(const Species& species, double finalEnergy, double angle) const;
+	 	double GetEnergyLossFractionalDepth(const Species& species, double startEnergy, double angle, double percent_depth) const;
+	 	double GetReverseEnergyLossFractionalDepth(const Species& species, double finalEnergy, double angle, double percent_depth) const;
 	 	const double& GetThickness() const { return m_thickness; }
+	 	double GetThickness_gcm2() const { return m_thickness_gcm2; }
 	 	int GetNumberOfElements() const { return m_Z.size(); }
 	 	int GetElementZ(int index) const { return m_Z[index]; }
 	 	int GetElementA(int index) const { return m_A[index]; }
 	 	int GetElementStoich(int index) const { return m_stoich[index]; }
 
+		void BuildEnergyLossTable(const Species& species);
+		void SetEnergyLossMode(EnergyLossMode mode) { m_elossMode = mode; }
+		EnergyLossMode GetEnergyLossMode() const { return m_elossMode; }
+		void SetEnergyLossCacheDirectory(const std::string& directory) { m_elossCacheDirectory = directory; }
+		const std::string& GetEnergyLossCacheDirectory() const { return m_elossCacheDirectory; }
+
 	private:
 	 	void Init(const std::vector<int>& z, const std::vector<int>& a, const std::vector<int>& stoich);
+		const EnergyLossTable* FindEnergyLossTable(const Species& species) const;
+		const catima::Material& GetLocalMaterial(double thickness) const;
 		
-		catima::Material m_material;
+		catima::Material m_material; //Never modified after Init; thickness is applied to a thread-local copy
+		uint64_t m_materialId; //Identifies m_material for the thread-local copies; kept by copies of the Target
 		double m_thickness;
 		double m_thickness_gcm2;
 		std::vector<int> m_Z, m_A, m_stoich;
+
+		//Tables are shared between copies of a Target; they are never modified once built
+		EnergyLossMode m_elossMode;
+		std::string m_elossCacheDirectory; //Empty means tables are not cached on disk
+		std::vector<std::shared_ptr<const EnergyLossTable>> m_elossTables; //Indexed by Species::index
+
+		static std::atomic<uint64_t> s_nextMaterialId;
 	
 	};
 
@@ -71,33 +71,35 @@ namespace Mask {
 		SetSystemEquation();
 
 		//Step one sampling parameters
-		AddBeamDistribution(step1Params.meanBeamEnergy, step1Params.sigmaBeamEnergy);
+		AddBeamDistribution(step1Params.meanBeamEnergy, step1Params.sigmaBeamEnergy, step1Params.beamEnergyFile);
 		m_step1.SetEjectileThetaType(step1Params.thetaType);
 		AddThetaRange(step1Params.thetaMin, step1Params.thetaMax);
 		AddPhiRange(step1Params.phiMin, step1Params.phiMax);
-		AddExcitationDistribution(step1Params.meanResidualEx, step1Params.sigmaResidualEx);
+		FixReactionDirection(m_step1);
+		AddExcitationDistribution(step1Params.meanResidualEx, step1Params.sigmaResidualEx, step1Params.residualExFile);
 
 		//Step two sampling parameters
 		AddPhiRange(step2Params.phiMin, step2Params.phiMax);
 		AddDecayAngularDistribution(step2Params.angularDistFile);
-		AddExcitationDistribution(step2Params.meanResidualEx, step2Params.sigmaResidualEx);
+		AddExcitationDistribution(step2Params.meanResidualEx, step2Params.sigmaResidualEx, step2Params.residualExFile);
 
 		//Step three sampling parameters
 		AddPhiRange(step3Params.phiMin, step3Params.phiMax);
 		AddDecayAngularDistribution(step3Params.angularDistFile);
-		AddExcitationDistribution(step3Params.meanResidualEx, step3Params.sigmaResidualEx);
+		AddExcitationDistribution(step3Params.meanResidualEx, step3Params.sigmaResidualEx, step3Params.residualExFile);
 	}
 
-	void ThreeStepSystem::SetLayeredTarget(const LayeredTarget& target)
+	void ThreeStepSystem::SetLayeredTarget(const LayeredTarget& target, const BeamEnergyLossMap* beamElossMap)
 	{
-		m_target = target;
-		m_rxnLayer = m_target.FindLayerContaining(m_nuclei[0].Z, m_nuclei[0].A);
-		if(m_rxnLayer != m_target.GetNumberOfLayers())
+		m_target = &target;
+		m_rxnLayer = m_target->FindLayerContaining(m_nuclei[0].Z, m_nuclei[0].A);
+		if(m_rxnLayer != m_target->GetNumberOfLayers())
 		{
-			m_step1.SetLayeredTarget(&m_target);
-			m_step2.SetLayeredTarget(&m_target);
-			m_step3.SetLayeredTarget(&m_target);
+			m_step1.SetLayeredTarget(m_target);
+			m_step2.SetLayeredTarget(m_target);
+			m_step3.SetLayeredTarget(m_target);
 			m_step1.SetRxnLayer(m_rxnLayer);
+			m_step1.SetBeamEnergyLossMap(beamElossMap);
 			m_step2.SetRxnLayer(m_rxnLayer);
 			m_step3.SetRxnLayer(m_rxnLayer);
 			m_isTargetSet = true;
@@ -123,33 +125,33 @@ namespace Mask {
 	ThreeStepParameters ThreeStepSystem::SampleParameters()
 	{
 		ThreeStepParameters params;
-		std::mt19937& gen = RandomGenerator::GetInstance().GetGenerator();
-		params.beamEnergy = m_beamDistributions[0](gen);
-		params.rxnTheta = std::acos((m_thetaRanges[0])(gen));
-		params.rxnPhi = m_phiRanges[0](gen);
-		params.cosdecay1Theta = m_decayAngularDistributions[0].GetRandomCosTheta();
+		double cosTheta;
+		SampleDirection(0, m_thetaRanges[0], m_phiRanges[0], cosTheta, params.rxnPhi);
+		params.rxnTheta = std::acos(cosTheta);
+		SampleDirection(1, m_decayAngularDistributions[0], m_phiRanges[1], params.cosdecay1Theta, params.decay1Phi);
 		params.decay1Theta = std::acos(params.cosdecay1Theta);
-		params.decay1Phi = m_phiRanges[1](gen);
-		params.cosdecay2Theta = m_decayAngularDistributions[1].GetRandomCosTheta();
+		SampleDirection(2, m_decayAngularDistributions[1], m_phiRanges[1], params.cosdecay2Theta, params.decay2Phi);
 		params.decay2Theta = std::acos(params.cosdecay2Theta);
-		params.decay2Phi = m_phiRanges[1](gen);
-		params.residEx = m_exDistributions[0](gen);
-		params.decay1Ex = m_exDistributions[1](gen);
-		params.decay2Ex = m_exDistributions[2](gen);
-		params.rxnDepth = (m_rxnDepthDist(gen));
+		params.rxnDepth = SampleDepth();
+		StartExcitations();
+		while(!SampleExcitations(params))
+			RedrawExcitations();
 		return params;
 	}
+
+	//Beam energy and excitations, each excitation truncated to the region allowed by the step before it
+	bool ThreeStepSystem::SampleExcitations(ThreeStepParameters& params)
+	{
+		params.beamEnergy = SampleBeamEnergy();
+		return SampleExcitation(0, m_step1.GetReactionExcitationLimit(params.beamEnergy), params.residEx) &&
+			   SampleExcitation(1, m_step2.GetDecayExcitationLimit(params.residEx), params.decay1Ex) &&
+			   SampleExcitation(2, m_step3.GetDecayExcitationLimit(params.decay1Ex), params.decay2Ex);
+	}
 	
-	void ThreeStepSystem::RunSystem()
+	ReactionStatus ThreeStepSystem::RunSystem()
 	{
-		ThreeStepParameters params;
-		do
-		{
-			params = SampleParameters();
-		}
-		while(!(m_step1.CheckReactionThreshold(params.beamEnergy, params.residEx) 
-				&& m_step2.CheckDecayThreshold(params.residEx, params.decay1Ex)
-				&& m_step3.CheckDecayThreshold(params.decay1Ex, params.decay2Ex)));
+		ReactionStatus status;
+		ThreeStepParameters params = SampleParameters();
 		
 		m_step1.SetReactionDepth(params.rxnDepth);
 		m_step1.SetBeamKE(params.beamEnergy);
@@ -168,7 +170,9 @@ namespace Mask {
 		m_step3.SetResidualEnergyLoss(true);
 		m_step3.SetExcitation(params.decay2Ex);
 	
-		m_step1.Calculate();
+		status = m_step1.Calculate();
+		if(status != ReactionStatus::Success)
+			return status;
 	
 		if(params.cosdecay1Theta == -10)
 		{
@@ -176,17 +180,64 @@ namespace Mask {
 			m_nuclei[5].vec4.SetPxPyPzE(0., 0., 0., m_nuclei[5].groundStateMass);
 			m_nuclei[6].vec4.SetPxPyPzE(0., 0., 0., m_nuclei[6].groundStateMass);
 			m_nuclei[7].vec4.SetPxPyPzE(0., 0., 0., m_nuclei[7].groundStateMass);
-			return;
+			return ReactionStatus::Success;
 		}
-		m_step2.Calculate();
+		status = m_step2.Calculate();
+		if(status != ReactionStatus::Success)
+			return status;
 	
 		if(params.cosdecay2Theta == -10)
 		{
 			m_nuclei[6].vec4.SetPxPyPzE(0., 0., 0., m_nuclei[6].groundStateMass);
 			m_nuclei[7].vec4.SetPxPyPzE(0., 0., 0., m_nuclei[7].groundStateMass);
-			return;
+			return ReactionStatus::Success;
 		}
-		m_step3.Calculate();
+		return m_step3.Calculate();
+	}
+
+	//Parameters are sampled event by event (each event has its own random stream), then the kinematics run over the whole batch
+	void ThreeStepSystem::RunBatch(EventBatch& batch, uint64_t firstEvent, std::size_t size)
+	{
+		batch.Resize(m_nuclei.size(), size);
+		batch.SetFirstEvent(firstEvent);
+		m_stepColumns.resize(3);
+		StepColumns& step1 = m_stepColumns[0];
+		StepColumns& step2 = m_stepColumns[1];
+		StepColumns& step3 = m_stepColumns[2];
+		step1.Resize(size);
+		step2.Resize(size);
+		step3.Resize(size);
+
+		ThreeStepParameters params;
+		for(std::size_t i=0; i<size; i++)
+		{
+			StartEvent(firstEvent + i);
+			params = SampleParameters();
+			batch.SetWeight(i, m_eventWeight);
+			step1.beamEnergy[i] = params.beamEnergy;
+			step1.theta[i] = params.rxnTheta;
+			step1.phi[i] = params.rxnPhi;
+			step1.ex[i] = params.residEx;
+			step1.rxnDepth[i] = params.rxnDepth;
+
+			step2.theta[i] = params.decay1Theta;
+			step2.phi[i] = params.decay1Phi;
+			step2.ex[i] = params.decay1Ex;
+			step2.rxnDepth[i] = params.rxnDepth;
+			step2.isActive[i] = params.cosdecay1Theta != -10;
+
+			step3.theta[i] = params.decay2Theta;
+			step3.phi[i] = params.decay2Phi;
+			step3.ex[i] = params.decay2Ex;
+			step3.rxnDepth[i] = params.rxnDepth;
+			step3.isActive[i] = step2.isActive[i] && params.cosdecay2Theta != -10;
+		}
+
+		m_step1.CalculateBatch(batch, {0, 1, 2, 3}, step1);
+		m_step2.CalculateBatch(batch, {3, 3, 4, 5}, step2);
+		m_step3.SetResidualEnergyLoss(true);
+		m_step3.CalculateBatch(batch, {5, 5, 6, 7}, step3);
+		CountStatus(batch);
 	}
 
 }
\ No newline at end of file
@@ -29,13 +29,15 @@ namespace Mask {
 		ThreeStepSystem(const std::vector<StepParameters>& params);
 		~ThreeStepSystem();
 
-		virtual void SetLayeredTarget(const LayeredTarget& target) override;
-		virtual void RunSystem() override;
+		virtual void SetLayeredTarget(const LayeredTarget& target, const BeamEnergyLossMap* beamElossMap) override;
+		virtual ReactionStatus RunSystem() override;
+		virtual void RunBatch(EventBatch& batch, uint64_t firstEvent, std::size_t size) override;
 		
 	protected:
 		void Init(const std::vector<StepParameters>& params);
 		void SetSystemEquation() override;
 		ThreeStepParameters SampleParameters();
+		bool SampleExcitations(ThreeStepParameters& params);
 	
 		Reaction m_step1, m_step2, m_step3;
 	
@@ -53,27 +53,29 @@ namespace Mask {
 		SetSystemEquation();
 
 		//Step one sampling parameters
-		AddBeamDistribution(step1Params.meanBeamEnergy, step1Params.sigmaBeamEnergy);
+		AddBeamDistribution(step1Params.meanBeamEnergy, step1Params.sigmaBeamEnergy, step1Params.beamEnergyFile);
 		m_step1.SetEjectileThetaType(step1Params.thetaType);
 		AddThetaRange(step1Params.thetaMin, step1Params.thetaMax);
 		AddPhiRange(step1Params.phiMin, step1Params.phiMax);
-		AddExcitationDistribution(step1Params.meanResidualEx, step1Params.sigmaResidualEx);
+		FixReactionDirection(m_step1);
+		AddExcitationDistribution(step1Params.meanResidualEx, step1Params.sigmaResidualEx, step1Params.residualExFile);
 
 		//Step two sampling parameters
 		AddPhiRange(step2Params.phiMin, step2Params.phiMax);
 		AddDecayAngularDistribution(step2Params.angularDistFile);
-		AddExcitationDistribution(step2Params.meanResidualEx, step2Params.sigmaResidualEx);
+		AddExcitationDistribution(step2Params.meanResidualEx, step2Params.sigmaResidualEx, step2Params.residualExFile);
 	}
 	
-	void TwoStepSystem::SetLayeredTarget(const LayeredTarget& target)
+	void TwoStepSystem::SetLayeredTarget(const LayeredTarget& target, const BeamEnergyLossMap* beamElossMap)
 	{
-		m_target = target;
-		m_rxnLayer = m_target.FindLayerContaining(m_nuclei[0].Z, m_nuclei[0].A);
-		if(m_rxnLayer != m_target.GetNumberOfLayers())
+		m_target = &target;
+		m_rxnLayer = m_target->FindLayerContaining(m_nuclei[0].Z, m_nuclei[0].A);
+		if(m_rxnLayer != m_target->GetNumberOfLayers())
 		{
-			m_step1.SetLayeredTarget(&m_target);
-			m_step2.SetLayeredTarget(&m_target);
+			m_step1.SetLayeredTarget(m_target);
+			m_step2.SetLayeredTarget(m_target);
 			m_step1.SetRxnLayer(m_rxnLayer);
+			m_step1.SetBeamEnergyLossMap(beamElossMap);
 			m_step2.SetRxnLayer(m_rxnLayer);
 			m_isTargetSet = true;
 		}
@@ -96,21 +98,29 @@ namespace Mask {
 	TwoStepParameters TwoStepSystem::SampleParameters()
 	{
 		TwoStepParameters params;
-		std::mt19937& gen = RandomGenerator::GetInstance().GetGenerator();
-		params.beamEnergy = (m_beamDistributions[0])(gen);
-		params.rxnTheta = std::acos((m_thetaRanges[0])(gen));
-		params.rxnPhi = (m_phiRanges[0])(gen);
-		params.cosdecay1Theta = m_decayAngularDistributions[0].GetRandomCosTheta();
+		double cosTheta;
+		SampleDirection(0, m_thetaRanges[0], m_phiRanges[0], cosTheta, params.rxnPhi);
+		params.rxnTheta = std::acos(cosTheta);
+		SampleDirection(1, m_decayAngularDistributions[0], m_phiRanges[1], params.cosdecay1Theta, params.decay1Phi);
 		params.decay1Theta = std::acos(params.cosdecay1Theta);
-		params.decay1Phi = m_phiRanges[1](gen);
-		params.residEx = (m_exDistributions[0])(gen);
-		params.decay2Ex = m_exDistributions[1](gen);
-		params.rxnDepth = (m_rxnDepthDist(gen));
+		params.rxnDepth = SampleDepth();
+		StartExcitations();
+		while(!SampleExcitations(params))
+			RedrawExcitations();
 		return params;
 	}
+
+	//Beam energy and excitations, each excitation truncated to the region allowed by the step before it
+	bool TwoStepSystem::SampleExcitations(TwoStepParameters& params)
+	{
+		params.beamEnergy = SampleBeamEnergy();
+		return SampleExcitation(0, m_step1.GetReactionExcitationLimit(params.beamEnergy), params.residEx) &&
+			   SampleExcitation(1, m_step2.GetDecayExcitationLimit(params.residEx), params.decay2Ex);
+	}
 	
-	void TwoStepSystem::RunSystem()
+	ReactionStatus TwoStepSystem::RunSystem()
 	{
+		ReactionStatus status;
 		//Sample parameters
 		// std::mt19937& gen = RandomGenerator::GetInstance().GetGenerator();
 		// double bke = (m_beamDistributions[0])(gen);
@@ -123,13 +133,7 @@ namespace Mask {
 		// double decay2Ex = m_exDistributions[1](gen);
 		// double rxnDepth = (m_rxnDepthDist(gen));
 
-		TwoStepParameters params;
-		do
-		{
-			params = SampleParameters();
-		}
-		while(!(m_step1.CheckReactionThreshold(params.beamEnergy, params.residEx) 
-				&& m_step2.CheckDecayThreshold(params.residEx, params.decay2Ex)));
+		TwoStepParameters params = SampleParameters();
 		
 		m_step1.SetReactionDepth(params.rxnDepth);
 		m_step1.SetBeamKE(params.beamEnergy);
@@ -142,18 +146,56 @@ namespace Mask {
 		m_step2.SetAzimRxnAngle(params.decay1Phi);
 		m_step2.SetExcitation(params.decay2Ex);
 		
-		m_step1.Calculate();
+		status = m_step1.Calculate();
+		if(status != ReactionStatus::Success)
+			return status;
 	
 		if(params.cosdecay1Theta == -10)
 		{
 			m_nuclei[4].vec4.SetPxPyPzE(0., 0., 0., m_nuclei[4].groundStateMass);
 			m_nuclei[5].vec4.SetPxPyPzE(0., 0., 0., m_nuclei[5].groundStateMass);
-			return;
+			return ReactionStatus::Success;
 		}
 		m_step2.SetResidualEnergyLoss(true);
-		m_step2.Calculate();
+		return m_step2.Calculate();
 	
 	
 	}
 
+	//Parameters are sampled event by event (each event has its own random stream), then the kinematics run over the whole batch
+	void TwoStepSystem::RunBatch(EventBatch& batch, uint64_t firstEvent, std::size_t size)
+	{
+		batch.Resize(m_nuclei.size(), size);
+		batch.SetFirstEvent(firstEvent);
+		m_stepColumns.resize(2);
+		StepColumns& step1 = m_stepColumns[0];
+		StepColumns& step2 = m_stepColumns[1];
+		step1.Resize(size);
+		step2.Resize(size);
+
+		TwoStepParameters params;
+		for(std::size_t i=0; i<size; i++)
+		{
+			StartEvent(firstEvent + i);
+			params = SampleParameters();
+			batch.SetWeight(i, m_eventWeight);
+			step1.beamEnergy[i] = params.beamEnergy;
+			step1.theta[i] = params.rxnTheta;
+			step1.phi[i] = params.rxnPhi;
+			step1.ex[i] = params.residEx;
+			step1.rxnDepth[i] = params.rxnDepth;
+
+			step2.theta[i] = params.decay1Theta;
+			step2.phi[i] = params.decay1Phi;
+			step2.ex[i] = params.decay2Ex;
+			step2.rxnDepth[i] = params.rxnDepth;
+			step2.isActive[i] = params.cosdecay1Theta != -10;
+		}
+
+		m_step1.CalculateBatch(batch, {0, 1, 2, 3}, step1);
+		m_step2.SetResidualEnergyLoss(true);
+		m_step2.CalculateBatch(batch, {3, 3, 4, 5}, step2);
+		CountStatus(batch);
+	}
+
 }
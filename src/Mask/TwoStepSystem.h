@@ -25,13 +25,15 @@ namespace Mask {
 		TwoStepSystem(const std::vector<StepParameters>& params);
 		~TwoStepSystem();
 
-		virtual void SetLayeredTarget(const LayeredTarget& target) override;
-		virtual void RunSystem() override;
+		virtual void SetLayeredTarget(const LayeredTarget& target, const BeamEnergyLossMap* beamElossMap) override;
+		virtual ReactionStatus RunSystem() override;
+		virtual void RunBatch(EventBatch& batch, uint64_t firstEvent, std::size_t size) override;
 	
 	private:
 		void Init(const std::vector<StepParameters>& params);
 		void SetSystemEquation() override;
 		TwoStepParameters SampleParameters();
+		bool SampleExcitations(TwoStepParameters& params);
 
 		Reaction m_step1, m_step2;
 	};
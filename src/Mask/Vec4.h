@@ -0,0 +1,129 @@
+/*
+	Vec4.h
+	Lightweight three-vector, four-vector and Lorentz boost types for the kinematics calculations. Everything is inline (and
+	constexpr where the standard library allows it), so the compiler can keep the components in registers instead of calling into
+	the ROOT GenVector library. Angles are never stored: a momentum which changes magnitude (i.e. energy loss) is rescaled along
+	its direction, which avoids the atan2/acos round trip of rebuilding it from Theta() and Phi().
+
+	The ROOT types are only used at the I/O boundary (Nucleus::vec4); see ToROOT and FromROOT.
+*/
+#ifndef VEC4_H
+#define VEC4_H
+
+#include <cmath>
+#include "Math/Vector4D.h"
+
+namespace Mask {
+
+	struct Vec3
+	{
+		constexpr Vec3() = default;
+		constexpr Vec3(double x, double y, double z) : x(x), y(y), z(z) {}
+
+		//Unit vector along (theta, phi)
+		static Vec3 FromSpherical(double theta, double phi)
+		{
+			double sinTheta = std::sin(theta);
+			return Vec3(sinTheta*std::cos(phi), sinTheta*std::sin(phi), std::cos(theta));
+		}
+
+		constexpr double Dot(const Vec3& other) const { return x*other.x + y*other.y + z*other.z; }
+		constexpr double Mag2() const { return Dot(*this); }
+		double Mag() const { return std::sqrt(Mag2()); }
+
+		//Polar angle, for the energy loss path length
+		double Theta() const
+		{
+			double mag = Mag();
+			return mag > 0.0 ? std::acos(z/mag) : 0.0;
+		}
+
+		//Unit vector; the zero vector is taken to point along z, as in ROOT
+		Vec3 Unit() const
+		{
+			double mag = Mag();
+			return mag > 0.0 ? (*this)*(1.0/mag) : Vec3(0.0, 0.0, 1.0);
+		}
+
+		constexpr Vec3 operator+(const Vec3& other) const { return Vec3(x + other.x, y + other.y, z + other.z); }
+		constexpr Vec3 operator-(const Vec3& other) const { return Vec3(x - other.x, y - other.y, z - other.z); }
+		constexpr Vec3 operator-() const { return Vec3(-x, -y, -z); }
+		constexpr Vec3 operator*(double scale) const { return Vec3(x*scale, y*scale, z*scale); }
+
+		double x = 0.0;
+		double y = 0.0;
+		double z = 0.0;
+	};
+
+	struct Vec4
+	{
+		constexpr Vec4() = default;
+		constexpr Vec4(const Vec3& p, double E) : p(p), E(E) {}
+		constexpr Vec4(double px, double py, double pz, double E) : p(px, py, pz), E(E) {}
+
+		//Four-vector of momentum magnitude momentum along the unit vector direction
+		static constexpr Vec4 FromDirection(const Vec3& direction, double momentum, double E) { return Vec4(direction*momentum, E); }
+
+		static Vec4 FromSpherical(double theta, double phi, double momentum, double E)
+		{
+			return FromDirection(Vec3::FromSpherical(theta, phi), momentum, E);
+		}
+
+		constexpr double M2() const { return E*E - p.Mag2(); }
+		double M() const
+		{
+			double m2 = M2();
+			return m2 > 0.0 ? std::sqrt(m2) : 0.0;
+		}
+		double P() const { return p.Mag(); }
+		double KE() const { return E - M(); }
+		double Theta() const { return p.Theta(); }
+
+		//Velocity of the frame in which this four-vector is at rest
+		constexpr Vec3 BoostVector() const { return p*(1.0/E); }
+
+		//Same direction, new momentum magnitude and energy
+		Vec4 Rescaled(double momentum, double energy) const { return FromDirection(p.Unit(), momentum, energy); }
+
+		constexpr Vec4 operator+(const Vec4& other) const { return Vec4(p + other.p, E + other.E); }
+		constexpr Vec4 operator-(const Vec4& other) const { return Vec4(p - other.p, E - other.E); }
+
+		Vec3 p;
+		double E = 0.0;
+	};
+
+	//Pure Lorentz boost by velocity beta (in units of c)
+	class LorentzBoost
+	{
+	public:
+		LorentzBoost(const Vec3& beta) :
+			m_beta(beta)
+		{
+			double beta2 = beta.Mag2();
+			m_gamma = 1.0/std::sqrt(1.0 - beta2);
+			m_gammaFactor = beta2 > 0.0 ? (m_gamma - 1.0)/beta2 : 0.0;
+		}
+
+		Vec4 operator()(const Vec4& vec) const
+		{
+			double betaP = m_beta.Dot(vec.p);
+			return Vec4(vec.p + m_beta*(m_gammaFactor*betaP + m_gamma*vec.E), m_gamma*(vec.E + betaP));
+		}
+
+		LorentzBoost Inverse() const { return LorentzBoost(-m_beta); }
+
+		//Boost to the rest frame of vec
+		static LorentzBoost ToRestFrame(const Vec4& vec) { return LorentzBoost(-vec.BoostVector()); }
+
+	private:
+		Vec3 m_beta;
+		double m_gamma;
+		double m_gammaFactor;
+	};
+
+	inline ROOT::Math::PxPyPzEVector ToROOT(const Vec4& vec) { return ROOT::Math::PxPyPzEVector(vec.p.x, vec.p.y, vec.p.z, vec.E); }
+	inline Vec4 FromROOT(const ROOT::Math::PxPyPzEVector& vec) { return Vec4(vec.Px(), vec.Py(), vec.Pz(), vec.E()); }
+
+}
+
+#endif
@@ -12,9 +12,10 @@ static double FullPhi(double phi)
 }
 
 RootPlotter::RootPlotter() :
-	m_target({5},{9},{1}, 74.0)
+	m_weight(1.0), m_target({5},{9},{1}, 74.0)
 {
 	TH1::AddDirectory(kFALSE);
+	m_target.SetEnergyLossMode(Mask::EnergyLossMode::Tabulated);
 }
 
 RootPlotter::~RootPlotter() {}
@@ -25,6 +26,10 @@ void RootPlotter::Run(const std::string& inputname, const std::string& outputnam
 	TTree* tree = (TTree*) input->Get("SimTree");
 	std::vector<Mask::Nucleus>* dataHandle = new std::vector<Mask::Nucleus>();
 	tree->SetBranchAddress("nuclei", &dataHandle);
+	//Older files have no weight branch; every event has weight 1
+	Double_t weight = 1.0;
+	if(tree->GetBranch("weight") != nullptr)
+		tree->SetBranchAddress("weight", &weight);
 
 	TFile* output = TFile::Open(outputname.c_str(), "RECREATE");
 
@@ -44,6 +49,7 @@ void RootPlotter::Run(const std::string& inputname, const std::string& outputnam
 			std::cout<<"\rPercent of data processed: "<<flushCount*flushFrac*100<<"%"<<std::flush;
 		}
 		tree->GetEntry(i);
+		m_weight = weight;
 		// for(Mask::Nucleus& nuc : *(dataHandle))
 		// {
 		// 	FillData(nuc);
@@ -129,12 +135,18 @@ void RootPlotter::Correlations(const std::vector<Mask::Nucleus>& event)
     {
         return;
     }
+	//Only built on the first event for each species
+	const Mask::Species& secondarySpecies = Mask::SpeciesLookup::GetInstance().FindSpecies(secondary.Z, secondary.A);
+	const Mask::Species& primarySpecies = Mask::SpeciesLookup::GetInstance().FindSpecies(primary.Z, primary.A);
+	m_target.BuildEnergyLossTable(secondarySpecies);
+	m_target.BuildEnergyLossTable(primarySpecies);
+
 	ROOT::Math::Boost boostParent(parent.vec4.BoostToCM());
 	ROOT::Math::Boost boostIntermediate(li.vec4.BoostToCM());
 	ROOT::Math::PxPyPzEVector a2Vec = (secondary.vec4);
     ROOT::Math::PxPyPzEVector a1Vec = (primary.vec4);
 
-	double a2KE = secondary.GetKE() + m_target.GetReverseEnergyLossFractionalDepth(secondary.Z, secondary.A, secondary.GetKE(), a2Vec.Theta(), targetDepth);
+	double a2KE = secondary.GetKE() + m_target.GetReverseEnergyLossFractionalDepth(secondarySpecies, secondary.GetKE(), a2Vec.Theta(), targetDepth);
 	double a2P = std::sqrt(a2KE * (a2KE + 2.0 * secondary.groundStateMass));
 	a2Vec.SetPxPyPzE(
 		a2P * std::sin(a2Vec.Theta()) * std::cos(a2Vec.Phi()),
@@ -143,7 +155,7 @@ void RootPlotter::Correlations(const std::vector<Mask::Nucleus>& event)
 		a2KE + secondary.groundStateMass
 	);
 
-	double a1KE = primary.GetKE() + m_target.GetReverseEnergyLossFractionalDepth(primary.Z, primary.A, primary.GetKE(), a1Vec.Theta(), targetDepth);
+	double a1KE = primary.GetKE() + m_target.GetReverseEnergyLossFractionalDepth(primarySpecies, primary.GetKE(), a1Vec.Theta(), targetDepth);
 	double a1P = std::sqrt(a1KE * (a1KE + 2.0 * primary.groundStateMass));
 	a1Vec.SetPxPyPzE(
 		a1P * std::sin(a1Vec.Theta()) * std::cos(a1Vec.Phi()),
@@ -207,12 +219,12 @@ void RootPlotter::MyFill(const std::string& name, const std::string& title, int
 	if(iter != m_map.end())
 	{
 		std::shared_ptr<TH1> h = std::static_pointer_cast<TH1>(iter->second);
-		h->Fill(val);
+		h->Fill(val, m_weight);
 	}
 	else
 	{
 		std::shared_ptr<TH1F> h = std::make_shared<TH1F>(name.c_str(), title.c_str(), bins, min, max);
-		h->Fill(val);
+		h->Fill(val, m_weight);
 		m_map[name] = h;
 	}
 }
@@ -224,12 +236,12 @@ void RootPlotter::MyFill(const std::string& name, const std::string& title, int
 	if(iter != m_map.end())
 	{
 		std::shared_ptr<TH2> h = std::static_pointer_cast<TH2>(iter->second);
-		h->Fill(valx, valy);
+		h->Fill(valx, valy, m_weight);
 	}
 	else
 	{
 		std::shared_ptr<TH2F> h = std::make_shared<TH2F>(name.c_str(), title.c_str(), binsx, minx, maxx, binsy, miny, maxy);
-		h->Fill(valx, valy);
+		h->Fill(valx, valy, m_weight);
 		m_map[name] = h;
 	}
 }
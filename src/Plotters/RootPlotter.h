@@ -30,6 +30,8 @@ private:
 
 	std::unordered_map<std::string, std::shared_ptr<TObject>> m_map;
 
+	double m_weight; //Of the current event; histograms are filled with it, so acceptance-biased samples give unbiased distributions
+
 	static constexpr double s_rad2deg = 180.0/M_PI;
 	Mask::Target m_target;
 };